@@ -0,0 +1,553 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Copyright (c) 2015-2019 Sartura Ltd.
+ *
+ * Author: Luka Perkov <luka.perkov@sartura.hr>
+ *
+ * https://www.sartura.hr/
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "debug.h"
+
+#ifdef DEBUG_RUNTIME
+
+#define DEBUG_MODULES_MAX 64
+#define DEBUG_MODULE_NAME_SIZE 64
+
+typedef struct {
+	size_t count;
+	struct {
+		char name[DEBUG_MODULE_NAME_SIZE];
+		debug_level level;
+	} modules[DEBUG_MODULES_MAX];
+} debug_module_table_t;
+
+// everything compiled in is enabled until configured otherwise
+atomic_int debug_level_max = DEBUG_LEVEL_DEBUG3;
+static atomic_int debug_level_global = DEBUG_LEVEL_DEBUG3;
+
+// replaced as a whole on every change so readers never lock, old tables are small and intentionally not freed
+static debug_module_table_t *_Atomic debug_module_table = NULL;
+static pthread_mutex_t debug_module_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static bool debug_module_match(const char *module, const char *name)
+{
+	size_t length = strlen(name);
+
+	// "list" matches "list.c" as well as "list"
+	return strncmp(module, name, length) == 0 && (module[length] == '\0' || (module[length] == '.' && strchr(name, '.') == NULL));
+}
+
+// called with debug_module_lock held
+static void debug_level_max_update(debug_module_table_t *table)
+{
+	int level_max = atomic_load(&debug_level_global);
+
+	for (size_t i = 0; table && i < table->count; i++) {
+		if ((int) table->modules[i].level > level_max) {
+			level_max = table->modules[i].level;
+		}
+	}
+
+	atomic_store(&debug_level_max, level_max);
+}
+
+bool debug_level_enabled(debug_level level, const char *module)
+{
+	debug_module_table_t *table = atomic_load_explicit(&debug_module_table, memory_order_acquire);
+
+	for (size_t i = 0; table && i < table->count; i++) {
+		if (debug_module_match(module, table->modules[i].name)) {
+			return level <= table->modules[i].level;
+		}
+	}
+
+	return (int) level <= atomic_load_explicit(&debug_level_global, memory_order_relaxed);
+}
+
+void debug_level_set(debug_level level)
+{
+	pthread_mutex_lock(&debug_module_lock);
+	atomic_store(&debug_level_global, level);
+	debug_level_max_update(atomic_load(&debug_module_table));
+	pthread_mutex_unlock(&debug_module_lock);
+}
+
+debug_level debug_level_get(void)
+{
+	return (debug_level) atomic_load(&debug_level_global);
+}
+
+static int debug_module_table_update(const char *module, debug_level level, bool clear)
+{
+	if (module == NULL || strlen(module) >= DEBUG_MODULE_NAME_SIZE) {
+		return -1;
+	}
+
+	debug_module_table_t *table = calloc(1, sizeof(debug_module_table_t));
+	if (table == NULL) {
+		return -1;
+	}
+
+	pthread_mutex_lock(&debug_module_lock);
+
+	debug_module_table_t *table_old = atomic_load(&debug_module_table);
+	bool found = false;
+
+	for (size_t i = 0; table_old && i < table_old->count; i++) {
+		if (strcmp(table_old->modules[i].name, module) == 0) {
+			found = true;
+			if (clear) {
+				continue;
+			}
+			table->modules[table->count] = table_old->modules[i];
+			table->modules[table->count].level = level;
+		} else {
+			table->modules[table->count] = table_old->modules[i];
+		}
+		table->count++;
+	}
+
+	if (found == false && clear == false) {
+		if (table->count == DEBUG_MODULES_MAX) {
+			pthread_mutex_unlock(&debug_module_lock);
+			free(table);
+			return -1;
+		}
+
+		strcpy(table->modules[table->count].name, module);
+		table->modules[table->count].level = level;
+		table->count++;
+	}
+
+	atomic_store_explicit(&debug_module_table, table, memory_order_release);
+	debug_level_max_update(table);
+
+	pthread_mutex_unlock(&debug_module_lock);
+
+	return 0;
+}
+
+int debug_module_level_set(const char *module, debug_level level)
+{
+	return debug_module_table_update(module, level, false);
+}
+
+int debug_module_level_clear(const char *module)
+{
+	return debug_module_table_update(module, DEBUG_LEVEL_NONE, true);
+}
+
+static int debug_level_parse(const char *value, debug_level *level)
+{
+	static const char *const names[] = {"none", "error", "warning", "log", "debug1", "debug2", "debug3"};
+	char *end = NULL;
+
+	for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+		if (strcmp(value, names[i]) == 0) {
+			*level = (debug_level) ((int) i + DEBUG_LEVEL_NONE);
+			return 0;
+		}
+	}
+
+	long number = strtol(value, &end, 10);
+	if (end == value || *end != '\0' || number < DEBUG_LEVEL_NONE || number > DEBUG_LEVEL_DEBUG3) {
+		return -1;
+	}
+
+	*level = (debug_level) number;
+
+	return 0;
+}
+
+__attribute__((constructor)) static void debug_runtime_init(void)
+{
+	const char *value = getenv("DEBUG_LEVEL");
+	debug_level level;
+
+	if (value && debug_level_parse(value, &level) == 0) {
+		debug_level_set(level);
+	}
+
+	value = getenv("DEBUG_MODULES");
+	if (value == NULL) {
+		return;
+	}
+
+	char *modules = strdup(value);
+	char *save = NULL;
+
+	for (char *module = modules ? strtok_r(modules, ",", &save) : NULL; module; module = strtok_r(NULL, ",", &save)) {
+		char *separator = strchr(module, '=');
+		if (separator == NULL) {
+			continue;
+		}
+
+		*separator = '\0';
+		if (debug_level_parse(separator + 1, &level) == 0) {
+			debug_module_level_set(module, level);
+		}
+	}
+
+	free(modules);
+}
+
+#endif
+
+#ifdef DEBUG_ASYNC
+
+#define DEBUG_ASYNC_RING_RECORDS 512 // power of two
+#define DEBUG_ASYNC_MESSAGE_SIZE 232 // records are 256 bytes
+#define DEBUG_ASYNC_OUTPUT_SIZE (64 * 1024)
+#define DEBUG_ASYNC_IDLE_NS (10 * 1000 * 1000)
+
+typedef struct debug_async_ring_s debug_async_ring_t;
+
+typedef struct {
+	const char *file;
+	uint32_t time;
+	int32_t line;
+	uint16_t level;
+	uint16_t length;
+	char message[DEBUG_ASYNC_MESSAGE_SIZE];
+} debug_async_record_t;
+
+// single producer (the owning thread), single consumer (the writer thread)
+struct debug_async_ring_s {
+	atomic_size_t head;
+	char head_padding[64 - sizeof(atomic_size_t)];
+	atomic_size_t tail;
+	atomic_size_t dropped;
+	size_t dropped_reported;
+	atomic_bool orphaned; // owning thread exited, freed by the writer once drained
+	debug_async_ring_t *next;
+	debug_async_record_t records[DEBUG_ASYNC_RING_RECORDS];
+};
+
+static pthread_once_t debug_async_once = PTHREAD_ONCE_INIT;
+static pthread_key_t debug_async_ring_key;
+static __thread debug_async_ring_t *debug_async_ring = NULL;
+
+// ring registry and writer thread state, protected by debug_async_lock
+static pthread_mutex_t debug_async_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t debug_async_cond = PTHREAD_COND_INITIALIZER;
+static debug_async_ring_t *debug_async_rings = NULL;
+static uint64_t debug_async_flush_requested = 0;
+static uint64_t debug_async_flush_done = 0;
+static pthread_t debug_async_thread;
+
+static atomic_bool debug_async_running = false;
+static atomic_flag debug_async_draining = ATOMIC_FLAG_INIT;
+static bool debug_async_tty = false;
+static char debug_async_output[DEBUG_ASYNC_OUTPUT_SIZE];
+
+static const int debug_async_signals[] = {SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT};
+static struct sigaction debug_async_signals_previous[sizeof(debug_async_signals) / sizeof(debug_async_signals[0])];
+
+static void debug_async_write(const char *data, size_t size)
+{
+	while (size > 0) {
+		ssize_t written = write(STDERR_FILENO, data, size);
+		if (written < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return;
+		}
+
+		data += written;
+		size -= (size_t) written;
+	}
+}
+
+static size_t debug_async_format(char *output, size_t size, debug_async_record_t *record)
+{
+	static const char *const tags[] = {"ERR", "WRN", "LOG", "DBG", "DBG", "DBG"};
+	const char *file = strrchr(record->file, '/') ? strrchr(record->file, '/') + 1 : record->file;
+	bool color = debug_async_tty && record->level <= DEBUG_LEVEL_WARNING;
+	int length = snprintf(output,
+						  size,
+						  "[%u] %s[%s] %s (%d): %.*s%s\n",
+						  (unsigned) record->time,
+						  color ? (record->level == DEBUG_LEVEL_ERROR ? C_RED : C_YEL) : "",
+						  tags[record->level],
+						  file,
+						  (int) record->line,
+						  (int) record->length,
+						  record->message,
+						  color ? C_CLR : "");
+
+	if (length < 0) {
+		return 0;
+	}
+
+	return (size_t) length < size ? (size_t) length : size - 1;
+}
+
+// writes everything queued so far, output has to fit at least one formatted record
+static size_t debug_async_drain(char *output, size_t output_size)
+{
+	size_t output_length = 0;
+	size_t records = 0;
+
+	for (debug_async_ring_t *ring = debug_async_rings; ring; ring = ring->next) {
+		size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+		size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+		for (; tail != head; tail++, records++) {
+			if (output_size - output_length < DEBUG_ASYNC_MESSAGE_SIZE + 256) {
+				debug_async_write(output, output_length);
+				output_length = 0;
+			}
+
+			output_length += debug_async_format(output + output_length, output_size - output_length, &ring->records[tail & (DEBUG_ASYNC_RING_RECORDS - 1)]);
+		}
+
+		atomic_store_explicit(&ring->tail, tail, memory_order_release);
+
+		size_t dropped = atomic_load_explicit(&ring->dropped, memory_order_relaxed);
+		if (dropped != ring->dropped_reported) {
+			int length = snprintf(output + output_length,
+								  output_size - output_length,
+								  "[%u] [WRN] debug.c: dropped %zu messages, log ring buffer full\n",
+								  (unsigned) time(NULL),
+								  dropped - ring->dropped_reported);
+			if (length > 0 && (size_t) length < output_size - output_length) {
+				output_length += (size_t) length;
+			}
+			ring->dropped_reported = dropped;
+		}
+	}
+
+	debug_async_write(output, output_length);
+
+	return records;
+}
+
+// frees rings of exited threads that have nothing left to write, called with debug_async_lock held
+static void debug_async_reap(void)
+{
+	debug_async_ring_t **ring = &debug_async_rings;
+
+	while (*ring) {
+		debug_async_ring_t *current = *ring;
+
+		if (atomic_load_explicit(&current->orphaned, memory_order_acquire) &&
+			atomic_load_explicit(&current->head, memory_order_acquire) == atomic_load_explicit(&current->tail, memory_order_relaxed)) {
+			*ring = current->next;
+			free(current);
+		} else {
+			ring = &current->next;
+		}
+	}
+}
+
+static void debug_async_drain_locked(void)
+{
+	while (atomic_flag_test_and_set_explicit(&debug_async_draining, memory_order_acquire)) {
+		sched_yield();
+	}
+
+	debug_async_drain(debug_async_output, sizeof(debug_async_output));
+
+	atomic_flag_clear_explicit(&debug_async_draining, memory_order_release);
+}
+
+static void *debug_async_thread_cb(void *arg)
+{
+	(void) arg;
+
+	pthread_mutex_lock(&debug_async_lock);
+
+	while (atomic_load(&debug_async_running)) {
+		uint64_t flush_requested = debug_async_flush_requested;
+
+		debug_async_drain_locked();
+		debug_async_reap();
+
+		debug_async_flush_done = flush_requested;
+		pthread_cond_broadcast(&debug_async_cond);
+
+		if (flush_requested == debug_async_flush_requested && atomic_load(&debug_async_running)) {
+			struct timespec timeout = {0};
+			clock_gettime(CLOCK_REALTIME, &timeout);
+			timeout.tv_nsec += DEBUG_ASYNC_IDLE_NS;
+			if (timeout.tv_nsec >= 1000000000L) {
+				timeout.tv_sec++;
+				timeout.tv_nsec -= 1000000000L;
+			}
+			pthread_cond_timedwait(&debug_async_cond, &debug_async_lock, &timeout);
+		}
+	}
+
+	pthread_mutex_unlock(&debug_async_lock);
+
+	return NULL;
+}
+
+// the writer may free the ring as soon as it is orphaned, a log from a later TSD destructor on this thread
+// gets a fresh ring, which pthread_setspecific() hands to another destructor round
+static void debug_async_ring_orphan(void *data)
+{
+	debug_async_ring = NULL;
+	atomic_store_explicit(&((debug_async_ring_t *) data)->orphaned, true, memory_order_release);
+}
+
+static void debug_async_exit(void)
+{
+	pthread_mutex_lock(&debug_async_lock);
+	atomic_store(&debug_async_running, false);
+	pthread_cond_broadcast(&debug_async_cond);
+	pthread_mutex_unlock(&debug_async_lock);
+
+	pthread_join(debug_async_thread, NULL);
+
+	pthread_mutex_lock(&debug_async_lock);
+	debug_async_drain_locked();
+	pthread_mutex_unlock(&debug_async_lock);
+}
+
+// best effort, the crashing thread may hold debug_async_lock or be the writer itself
+static void debug_async_signal_cb(int signal_number)
+{
+	char output[4096];
+
+	for (int i = 0; i < 1000 && atomic_flag_test_and_set_explicit(&debug_async_draining, memory_order_acquire); i++) {
+		sched_yield();
+	}
+
+	debug_async_drain(output, sizeof(output));
+
+	for (size_t i = 0; i < sizeof(debug_async_signals) / sizeof(debug_async_signals[0]); i++) {
+		if (debug_async_signals[i] == signal_number) {
+			sigaction(signal_number, &debug_async_signals_previous[i], NULL);
+		}
+	}
+
+	raise(signal_number);
+}
+
+static void debug_async_init(void)
+{
+	debug_async_tty = isatty(STDERR_FILENO);
+
+	if (pthread_key_create(&debug_async_ring_key, debug_async_ring_orphan) != 0) {
+		return;
+	}
+
+	atomic_store(&debug_async_running, true);
+	if (pthread_create(&debug_async_thread, NULL, debug_async_thread_cb, NULL) != 0) {
+		atomic_store(&debug_async_running, false);
+		return;
+	}
+
+	atexit(debug_async_exit);
+
+	struct sigaction action = {0};
+	action.sa_handler = debug_async_signal_cb;
+	sigemptyset(&action.sa_mask);
+	for (size_t i = 0; i < sizeof(debug_async_signals) / sizeof(debug_async_signals[0]); i++) {
+		sigaction(debug_async_signals[i], &action, &debug_async_signals_previous[i]);
+	}
+}
+
+static debug_async_ring_t *debug_async_ring_get(void)
+{
+	if (debug_async_ring) {
+		return debug_async_ring;
+	}
+
+	pthread_once(&debug_async_once, debug_async_init);
+	if (atomic_load(&debug_async_running) == false) {
+		return NULL;
+	}
+
+	debug_async_ring_t *ring = calloc(1, sizeof(debug_async_ring_t));
+	if (ring == NULL) {
+		return NULL;
+	}
+
+	pthread_mutex_lock(&debug_async_lock);
+	ring->next = debug_async_rings;
+	debug_async_rings = ring;
+	pthread_mutex_unlock(&debug_async_lock);
+
+	pthread_setspecific(debug_async_ring_key, ring);
+	debug_async_ring = ring;
+
+	return ring;
+}
+
+void debug_async_log(debug_level level, const char *file, int line, const char *fmt, ...)
+{
+	debug_async_ring_t *ring = debug_async_ring_get();
+	va_list args;
+
+	// writer thread not running (failed to start or already stopped at exit), write synchronously
+	if (ring == NULL || atomic_load_explicit(&debug_async_running, memory_order_relaxed) == false) {
+		debug_async_record_t record = {.file = file, .time = (uint32_t) time(NULL), .line = line, .level = (uint16_t) level};
+		char output[DEBUG_ASYNC_MESSAGE_SIZE + 256];
+
+		va_start(args, fmt);
+		int length = vsnprintf(record.message, sizeof(record.message), fmt, args);
+		va_end(args);
+		record.length = length < 0 ? 0 : length < (int) sizeof(record.message) ? (uint16_t) length : sizeof(record.message) - 1;
+
+		debug_async_write(output, debug_async_format(output, sizeof(output), &record));
+		return;
+	}
+
+	size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	if (head - atomic_load_explicit(&ring->tail, memory_order_acquire) == DEBUG_ASYNC_RING_RECORDS) {
+		atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+		return;
+	}
+
+	debug_async_record_t *record = &ring->records[head & (DEBUG_ASYNC_RING_RECORDS - 1)];
+	struct timespec now;
+
+	clock_gettime(CLOCK_REALTIME_COARSE, &now);
+	record->file = file;
+	record->time = (uint32_t) now.tv_sec;
+	record->line = line;
+	record->level = (uint16_t) level;
+
+	va_start(args, fmt);
+	int length = vsnprintf(record->message, sizeof(record->message), fmt, args);
+	va_end(args);
+	record->length = length < 0 ? 0 : length < (int) sizeof(record->message) ? (uint16_t) length : sizeof(record->message) - 1;
+
+	atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+
+	// don't wait for the idle timeout once the ring is half full
+	if (head + 1 - atomic_load_explicit(&ring->tail, memory_order_relaxed) == DEBUG_ASYNC_RING_RECORDS / 2) {
+		pthread_cond_signal(&debug_async_cond);
+	}
+}
+
+void debug_async_flush(void)
+{
+	if (atomic_load(&debug_async_running) == false) {
+		return;
+	}
+
+	pthread_mutex_lock(&debug_async_lock);
+	uint64_t flush_requested = ++debug_async_flush_requested;
+	pthread_cond_broadcast(&debug_async_cond);
+	while (debug_async_flush_done < flush_requested && atomic_load(&debug_async_running)) {
+		pthread_cond_wait(&debug_async_cond, &debug_async_lock);
+	}
+	pthread_mutex_unlock(&debug_async_lock);
+}
+
+#endif
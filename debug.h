@@ -17,89 +17,193 @@
 #include <unistd.h>
 #include <time.h>
 
+// resolved at compile time where the compiler provides the basename
+#ifdef __FILE_NAME__
+#define __FILENAME__ __FILE_NAME__
+#else
 #define __FILENAME__ (strrchr(__FILE__, '/') ? strrchr(__FILE__, '/') + 1 : __FILE__)
+#endif
 #define C_RED "\x1B[31m"
 #define C_YEL "\x1B[33m"
 #define C_CLR "\x1B[0m"
 
+typedef enum {
+	DEBUG_LEVEL_NONE = -1,
+	DEBUG_LEVEL_ERROR = 0,
+	DEBUG_LEVEL_WARNING,
+	DEBUG_LEVEL_LOG,
+	DEBUG_LEVEL_DEBUG1,
+	DEBUG_LEVEL_DEBUG2,
+	DEBUG_LEVEL_DEBUG3,
+} debug_level;
+
+// runtime level control, build with -DDEBUG_RUNTIME and link debug.c
+// - only levels enabled at compile time (LOG, WARNING, ERROR, DEBUG1-3) can be enabled at runtime
+// - the global level and per module (file basename, with or without extension) levels are set with the API below or
+//   with DEBUG_LEVEL=<level> and DEBUG_MODULES=<module>=<level>,... in the environment, <level> is a name (none, error,
+//   warning, log, debug1, debug2, debug3) or a number
+// - a call site disabled everywhere costs one branch on debug_level_max, the per module check is only done past it
+#ifdef DEBUG_RUNTIME
+#include <stdatomic.h>
+#include <stdbool.h>
+
+extern atomic_int debug_level_max; // highest level enabled globally or for any module
+
+bool debug_level_enabled(debug_level level, const char *module);
+void debug_level_set(debug_level level);
+debug_level debug_level_get(void);
+int debug_module_level_set(const char *module, debug_level level);
+int debug_module_level_clear(const char *module);
+
+#define DEBUG_ENABLED(level)                                                                                                                         \
+	(__builtin_expect((level) <= atomic_load_explicit(&debug_level_max, memory_order_relaxed), 0) && debug_level_enabled((level), __FILENAME__))
+#else
+#define DEBUG_ENABLED(level) 1
+#endif
+
+// asynchronous backend, build with -DDEBUG_ASYNC and link debug.c
+// - callers format into a per thread lock-free ring buffer, a background thread batches the writes to stderr
+// - messages that do not fit into a full ring are dropped and counted, the count is reported in the output
+// - pending messages are flushed at exit and, best effort, on fatal signals
+#ifdef DEBUG_ASYNC
+void debug_async_log(debug_level level, const char *file, int line, const char *fmt, ...) __attribute__((format(printf, 4, 5)));
+void debug_async_flush(void);
+
+#define DEBUG_PRINT(level, tag, fmt, ...) debug_async_log(level, __FILENAME__, __LINE__, fmt, ##__VA_ARGS__)
+
+#define DEBUG_PRINT_COLOR(level, tag, color, fmt, ...) debug_async_log(level, __FILENAME__, __LINE__, fmt, ##__VA_ARGS__)
+#else
+#define DEBUG_PRINT(level, tag, fmt, ...)                                                                                                            \
+	fprintf(stderr, "[%u] [" tag "] %s (%d): " fmt "\n", (unsigned) time(NULL), __FILENAME__, __LINE__, ##__VA_ARGS__)
+
+#define DEBUG_PRINT_COLOR(level, tag, color, fmt, ...)                                                                                               \
+	fprintf(stderr,                                                                                                                                  \
+			"[%u] %s[" tag "] %s (%d): " fmt "%s\n",                                                                                                 \
+			(unsigned) time(NULL),                                                                                                                   \
+			isatty(STDERR_FILENO) ? color : "",                                                                                                      \
+			__FILENAME__,                                                                                                                            \
+			__LINE__,                                                                                                                                \
+			##__VA_ARGS__,                                                                                                                           \
+			isatty(STDERR_FILENO) ? C_CLR : "")
+#endif
+
 #ifdef LOG
+#define DEBUG_COMPILED_LOG 1
 #define _log(fmt, ...)                                                                                                                               \
 	do {                                                                                                                                             \
-		fprintf(stderr, "[%u] [LOG] %s (%d): " fmt "\n", (unsigned) time(NULL), __FILENAME__, __LINE__, ##__VA_ARGS__);                              \
+		if (DEBUG_ENABLED(DEBUG_LEVEL_LOG)) {                                                                                                        \
+			DEBUG_PRINT(DEBUG_LEVEL_LOG, "LOG", fmt, ##__VA_ARGS__);                                                                                 \
+		}                                                                                                                                            \
 	} while (0)
 #else
+#define DEBUG_COMPILED_LOG 0
 #define _log(fmt, ...)                                                                                                                               \
 	do {                                                                                                                                             \
 	} while (0)
 #endif
 
 #ifdef WARNING
+#define DEBUG_COMPILED_WARNING 1
 #define _warning(fmt, ...)                                                                                                                           \
 	do {                                                                                                                                             \
-		fprintf(stderr,                                                                                                                              \
-				"[%u] %s[WRN] %s (%d): " fmt "%s\n",                                                                                                 \
-				(unsigned) time(NULL),                                                                                                               \
-				isatty(STDERR_FILENO) ? C_YEL : "",                                                                                                  \
-				__FILENAME__,                                                                                                                        \
-				__LINE__,                                                                                                                            \
-				##__VA_ARGS__,                                                                                                                       \
-				isatty(STDERR_FILENO) ? C_CLR : "");                                                                                                 \
+		if (DEBUG_ENABLED(DEBUG_LEVEL_WARNING)) {                                                                                                    \
+			DEBUG_PRINT_COLOR(DEBUG_LEVEL_WARNING, "WRN", C_YEL, fmt, ##__VA_ARGS__);                                                                \
+		}                                                                                                                                            \
 	} while (0)
 #else
+#define DEBUG_COMPILED_WARNING 0
 #define _warning(fmt, ...)                                                                                                                           \
 	do {                                                                                                                                             \
 	} while (0)
 #endif
 
 #ifdef ERROR
+#define DEBUG_COMPILED_ERROR 1
 #define _error(fmt, ...)                                                                                                                             \
 	do {                                                                                                                                             \
-		fprintf(stderr,                                                                                                                              \
-				"[%u] %s[ERR] %s (%d): " fmt "%s\n",                                                                                                 \
-				(unsigned) time(NULL),                                                                                                               \
-				isatty(STDERR_FILENO) ? C_RED : "",                                                                                                  \
-				__FILENAME__,                                                                                                                        \
-				__LINE__,                                                                                                                            \
-				##__VA_ARGS__,                                                                                                                       \
-				isatty(STDERR_FILENO) ? C_CLR : "");                                                                                                 \
+		if (DEBUG_ENABLED(DEBUG_LEVEL_ERROR)) {                                                                                                      \
+			DEBUG_PRINT_COLOR(DEBUG_LEVEL_ERROR, "ERR", C_RED, fmt, ##__VA_ARGS__);                                                                  \
+		}                                                                                                                                            \
 	} while (0)
 #else
+#define DEBUG_COMPILED_ERROR 0
 #define _error(fmt, ...)                                                                                                                             \
 	do {                                                                                                                                             \
 	} while (0)
 #endif
 
 #ifdef DEBUG1
+#define DEBUG_COMPILED_DEBUG1 1
 #define _debug(fmt, ...)                                                                                                                             \
 	do {                                                                                                                                             \
-		fprintf(stderr, "[%u] [DBG] %s (%d): " fmt "\n", (unsigned) time(NULL), __FILENAME__, __LINE__, ##__VA_ARGS__);                              \
+		if (DEBUG_ENABLED(DEBUG_LEVEL_DEBUG1)) {                                                                                                     \
+			DEBUG_PRINT(DEBUG_LEVEL_DEBUG1, "DBG", fmt, ##__VA_ARGS__);                                                                              \
+		}                                                                                                                                            \
 	} while (0)
 #else
+#define DEBUG_COMPILED_DEBUG1 0
 #define _debug(fmt, ...)                                                                                                                             \
 	do {                                                                                                                                             \
 	} while (0)
 #endif
 
 #ifdef DEBUG2
+#define DEBUG_COMPILED_DEBUG2 1
 #define __debug(fmt, ...)                                                                                                                            \
 	do {                                                                                                                                             \
-		fprintf(stderr, "[%u] [DBG] %s (%d): " fmt "\n", (unsigned) time(NULL), __FILENAME__, __LINE__, ##__VA_ARGS__);                              \
+		if (DEBUG_ENABLED(DEBUG_LEVEL_DEBUG2)) {                                                                                                     \
+			DEBUG_PRINT(DEBUG_LEVEL_DEBUG2, "DBG", fmt, ##__VA_ARGS__);                                                                              \
+		}                                                                                                                                            \
 	} while (0)
 #else
+#define DEBUG_COMPILED_DEBUG2 0
 #define __debug(fmt, ...)                                                                                                                            \
 	do {                                                                                                                                             \
 	} while (0)
 #endif
 
 #ifdef DEBUG3
+#define DEBUG_COMPILED_DEBUG3 1
 #define ___debug(fmt, ...)                                                                                                                           \
 	do {                                                                                                                                             \
-		fprintf(stderr, "[%u] [DBG] %s (%d): " fmt "\n", (unsigned) time(NULL), __FILENAME__, __LINE__, ##__VA_ARGS__);                              \
+		if (DEBUG_ENABLED(DEBUG_LEVEL_DEBUG3)) {                                                                                                     \
+			DEBUG_PRINT(DEBUG_LEVEL_DEBUG3, "DBG", fmt, ##__VA_ARGS__);                                                                              \
+		}                                                                                                                                            \
 	} while (0)
 #else
+#define DEBUG_COMPILED_DEBUG3 0
 #define ___debug(fmt, ...)                                                                                                                           \
 	do {                                                                                                                                             \
 	} while (0)
 #endif
 
+// sampled and rate limited logging for hot call sites, level is the compile time flag name, e.g.
+//   DEBUG_EVERY_N(DEBUG3, 1000, ___debug("curl_socket_poll_cb"));
+//   DEBUG_RATELIMIT(WARNING, 1000, _warning("socket error"));
+// nothing is counted or timed when the level is disabled at compile time or at runtime
+#define DEBUG_EVERY_N(level, n, log)                                                                                                                 \
+	do {                                                                                                                                             \
+		if (DEBUG_COMPILED_##level && DEBUG_ENABLED(DEBUG_LEVEL_##level)) {                                                                          \
+			static unsigned long debug_every_n_count = 0;                                                                                            \
+			if (__atomic_fetch_add(&debug_every_n_count, 1, __ATOMIC_RELAXED) % (n) == 0) {                                                          \
+				log;                                                                                                                                 \
+			}                                                                                                                                        \
+		}                                                                                                                                            \
+	} while (0)
+
+#define DEBUG_RATELIMIT(level, interval_ms, log)                                                                                                     \
+	do {                                                                                                                                             \
+		if (DEBUG_COMPILED_##level && DEBUG_ENABLED(DEBUG_LEVEL_##level)) {                                                                          \
+			static unsigned long long debug_ratelimit_ms = 0;                                                                                        \
+			struct timespec debug_now;                                                                                                               \
+			clock_gettime(CLOCK_MONOTONIC_COARSE, &debug_now);                                                                                       \
+			unsigned long long debug_now_ms = (unsigned long long) debug_now.tv_sec * 1000 + (unsigned long long) debug_now.tv_nsec / 1000000;       \
+			unsigned long long debug_last_ms = __atomic_load_n(&debug_ratelimit_ms, __ATOMIC_RELAXED);                                               \
+			if ((debug_last_ms == 0 || debug_now_ms - debug_last_ms >= (unsigned long long) (interval_ms)) &&                                        \
+				__atomic_compare_exchange_n(&debug_ratelimit_ms, &debug_last_ms, debug_now_ms, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {             \
+				log;                                                                                                                                 \
+			}                                                                                                                                        \
+		}                                                                                                                                            \
+	} while (0)
+
 #endif /* DEBUG_H_ONCE */
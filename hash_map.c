@@ -0,0 +1,355 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Copyright (c) 2015-2019 Sartura Ltd.
+ *
+ * Author: Domagoj Pintaric <domagoj.pintaric@sartura.hr>
+ *
+ * https://www.sartura.hr/
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hash_map.h"
+
+#define HASH_MAP_CAPACITY_MIN 16
+#define HASH_MAP_MIGRATE_SLOTS 64 // slots moved from the old table per insert/remove
+
+// reserved slot hash values, real hashes are remapped above them
+#define HASH_MAP_SLOT_EMPTY 0
+#define HASH_MAP_SLOT_DELETED 1
+
+typedef struct {
+	uint64_t hash;
+	const void *key;
+	void *value;
+} hash_map_slot_t;
+
+struct hash_map_table_s {
+	hash_map_slot_t *slots;
+	size_t capacity; // power of two
+	size_t size;	 // live slots
+	size_t used;	 // live and deleted slots
+};
+
+struct hash_map_s {
+	hash_map_key_type key_type;
+	hash_map_hash_cb hash_cb;
+	hash_map_table_t table;
+	hash_map_table_t table_old; // non empty while a resize is in progress
+	size_t migrate_index;
+};
+
+uint64_t hash_map_string_hash(const void *key)
+{
+	// FNV-1a
+	uint64_t hash = 0xcbf29ce484222325ULL;
+
+	for (const unsigned char *c = key; *c; c++) {
+		hash ^= *c;
+		hash *= 0x100000001b3ULL;
+	}
+
+	return hash;
+}
+
+uint64_t hash_map_integer_hash(const void *key)
+{
+	// splitmix64 finalizer
+	uint64_t hash = (uint64_t) (uintptr_t) key;
+
+	hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	hash = (hash ^ (hash >> 27)) * 0x94d049bb133111ebULL;
+	hash = hash ^ (hash >> 31);
+
+	return hash;
+}
+
+static uint64_t hash_map_hash(hash_map_t *map, const void *key)
+{
+	uint64_t hash = map->hash_cb(key);
+
+	return hash > HASH_MAP_SLOT_DELETED ? hash : hash + 2;
+}
+
+static bool hash_map_key_equal(hash_map_t *map, const void *key_a, const void *key_b)
+{
+	if (map->key_type == HASH_MAP_KEY_STRING) {
+		return key_a == key_b || strcmp(key_a, key_b) == 0;
+	}
+
+	return key_a == key_b;
+}
+
+static hash_map_slot_t *hash_map_table_find(hash_map_t *map, hash_map_table_t *table, uint64_t hash, const void *key)
+{
+	if (table->size == 0) {
+		return NULL;
+	}
+
+	size_t mask = table->capacity - 1;
+
+	// bounded, a table being migrated can run out of empty slots
+	for (size_t i = hash & mask, probes = 0; probes < table->capacity; i = (i + 1) & mask, probes++) {
+		hash_map_slot_t *slot = &table->slots[i];
+
+		if (slot->hash == HASH_MAP_SLOT_EMPTY) {
+			return NULL;
+		}
+
+		if (slot->hash == hash && hash_map_key_equal(map, slot->key, key)) {
+			return slot;
+		}
+	}
+
+	return NULL;
+}
+
+// the caller guarantees the key is not in the table and there is a free slot
+static void hash_map_table_put(hash_map_table_t *table, uint64_t hash, const void *key, void *value)
+{
+	size_t mask = table->capacity - 1;
+	size_t i = hash & mask;
+
+	while (table->slots[i].hash > HASH_MAP_SLOT_DELETED) {
+		i = (i + 1) & mask;
+	}
+
+	if (table->slots[i].hash == HASH_MAP_SLOT_EMPTY) {
+		table->used++;
+	}
+
+	table->slots[i].hash = hash;
+	table->slots[i].key = key;
+	table->slots[i].value = value;
+	table->size++;
+}
+
+static void hash_map_migrate(hash_map_t *map, size_t slots)
+{
+	hash_map_table_t *table_old = &map->table_old;
+
+	if (table_old->slots == NULL) {
+		return;
+	}
+
+	for (; slots > 0 && map->migrate_index < table_old->capacity; slots--, map->migrate_index++) {
+		hash_map_slot_t *slot = &table_old->slots[map->migrate_index];
+
+		// migrated slots keep the probe chains of not yet migrated slots intact
+		// empty slots stay empty, they end the chains and keep old table lookups as short as before the resize
+		if (slot->hash > HASH_MAP_SLOT_DELETED) {
+			hash_map_table_put(&map->table, slot->hash, slot->key, slot->value);
+			table_old->size--;
+			slot->hash = HASH_MAP_SLOT_DELETED;
+			slot->key = NULL;
+			slot->value = NULL;
+		}
+	}
+
+	if (map->migrate_index == table_old->capacity || table_old->size == 0) {
+		free(table_old->slots);
+		memset(table_old, 0, sizeof(hash_map_table_t));
+		map->migrate_index = 0;
+	}
+}
+
+// make room for one more slot, starts a new migration when the load factor would exceed 3/4
+static hash_map_rc hash_map_reserve(hash_map_t *map)
+{
+	// entries still in the old table will land in the current one as well
+	if ((map->table.used + map->table_old.size + 1) * 4 <= map->table.capacity * 3) {
+		return HASH_MAP_SUCCESS;
+	}
+
+	hash_map_migrate(map, SIZE_MAX);
+
+	size_t capacity = HASH_MAP_CAPACITY_MIN;
+	while (capacity < (map->table.size + 1) * 2) {
+		capacity *= 2;
+	}
+
+	hash_map_slot_t *slots = calloc(capacity, sizeof(hash_map_slot_t));
+	if (slots == NULL) {
+		return HASH_MAP_FAILURE_MEMORY;
+	}
+
+	map->table_old = map->table;
+	map->table.slots = slots;
+	map->table.capacity = capacity;
+	map->table.size = 0;
+	map->table.used = 0;
+	map->migrate_index = 0;
+
+	return HASH_MAP_SUCCESS;
+}
+
+hash_map_rc hash_map_new(hash_map_t **map, hash_map_key_type key_type, hash_map_hash_cb hash_cb)
+{
+	if (map == NULL || (key_type != HASH_MAP_KEY_STRING && key_type != HASH_MAP_KEY_INTEGER)) {
+		return HASH_MAP_FAILURE_ARGUMENTS;
+	}
+
+	*map = calloc(1, sizeof(hash_map_t));
+	if (*map == NULL) {
+		return HASH_MAP_FAILURE_MEMORY;
+	}
+
+	(*map)->table.slots = calloc(HASH_MAP_CAPACITY_MIN, sizeof(hash_map_slot_t));
+	if ((*map)->table.slots == NULL) {
+		free(*map);
+		*map = NULL;
+		return HASH_MAP_FAILURE_MEMORY;
+	}
+
+	(*map)->key_type = key_type;
+	(*map)->hash_cb = hash_cb ? hash_cb : key_type == HASH_MAP_KEY_STRING ? hash_map_string_hash : hash_map_integer_hash;
+	(*map)->table.capacity = HASH_MAP_CAPACITY_MIN;
+
+	return HASH_MAP_SUCCESS;
+}
+
+hash_map_rc hash_map_destroy(hash_map_t *map)
+{
+	if (map == NULL) {
+		return HASH_MAP_FAILURE_ARGUMENTS;
+	}
+
+	free(map->table.slots);
+	free(map->table_old.slots);
+	free(map);
+
+	return HASH_MAP_SUCCESS;
+}
+
+hash_map_rc hash_map_size_get(hash_map_t *map, size_t *size)
+{
+	if (map == NULL || size == NULL) {
+		return HASH_MAP_FAILURE_ARGUMENTS;
+	}
+
+	*size = map->table.size + map->table_old.size;
+
+	return HASH_MAP_SUCCESS;
+}
+
+hash_map_rc hash_map_insert(hash_map_t *map, const void *key, void *value)
+{
+	if (map == NULL || (map->key_type == HASH_MAP_KEY_STRING && key == NULL)) {
+		return HASH_MAP_FAILURE_ARGUMENTS;
+	}
+
+	uint64_t hash = hash_map_hash(map, key);
+
+	if (hash_map_table_find(map, &map->table, hash, key) || hash_map_table_find(map, &map->table_old, hash, key)) {
+		return HASH_MAP_FAILURE_EXISTS;
+	}
+
+	hash_map_rc rc = hash_map_reserve(map);
+	if (rc != HASH_MAP_SUCCESS) {
+		return rc;
+	}
+
+	hash_map_table_put(&map->table, hash, key, value);
+	hash_map_migrate(map, HASH_MAP_MIGRATE_SLOTS);
+
+	return HASH_MAP_SUCCESS;
+}
+
+hash_map_rc hash_map_get(hash_map_t *map, const void *key, void **value)
+{
+	if (map == NULL || (map->key_type == HASH_MAP_KEY_STRING && key == NULL) || value == NULL) {
+		return HASH_MAP_FAILURE_ARGUMENTS;
+	}
+
+	uint64_t hash = hash_map_hash(map, key);
+
+	hash_map_slot_t *slot = hash_map_table_find(map, &map->table, hash, key);
+	if (slot == NULL) {
+		slot = hash_map_table_find(map, &map->table_old, hash, key);
+	}
+
+	if (slot == NULL) {
+		return HASH_MAP_FAILURE_NOT_FOUND;
+	}
+
+	*value = slot->value;
+
+	return HASH_MAP_SUCCESS;
+}
+
+hash_map_rc hash_map_remove(hash_map_t *map, const void *key, void **value)
+{
+	if (map == NULL || (map->key_type == HASH_MAP_KEY_STRING && key == NULL)) {
+		return HASH_MAP_FAILURE_ARGUMENTS;
+	}
+
+	uint64_t hash = hash_map_hash(map, key);
+	hash_map_table_t *table = &map->table;
+
+	hash_map_slot_t *slot = hash_map_table_find(map, table, hash, key);
+	if (slot == NULL) {
+		table = &map->table_old;
+		slot = hash_map_table_find(map, table, hash, key);
+	}
+
+	if (slot == NULL) {
+		return HASH_MAP_FAILURE_NOT_FOUND;
+	}
+
+	if (value) {
+		*value = slot->value;
+	}
+
+	slot->hash = HASH_MAP_SLOT_DELETED;
+	slot->key = NULL;
+	slot->value = NULL;
+	table->size--;
+
+	hash_map_migrate(map, HASH_MAP_MIGRATE_SLOTS);
+
+	return HASH_MAP_SUCCESS;
+}
+
+hash_map_rc hash_map_iterator_init(hash_map_t *map, hash_map_iterator_t *map_iterator)
+{
+	if (map == NULL || map_iterator == NULL) {
+		return HASH_MAP_FAILURE_ARGUMENTS;
+	}
+
+	map_iterator->map = map;
+	map_iterator->table = 0;
+	map_iterator->index = 0;
+
+	if (map->table.size + map->table_old.size == 0) {
+		return HASH_MAP_FAILURE_EMPTY;
+	}
+
+	return HASH_MAP_SUCCESS;
+}
+
+hash_map_rc hash_map_iterator_next(hash_map_iterator_t *map_iterator, const void **key, void **value)
+{
+	if (map_iterator == NULL || key == NULL || value == NULL) {
+		return HASH_MAP_FAILURE_ARGUMENTS;
+	}
+
+	for (; map_iterator->table < 2; map_iterator->table++, map_iterator->index = 0) {
+		hash_map_table_t *table = map_iterator->table == 0 ? &map_iterator->map->table : &map_iterator->map->table_old;
+
+		while (map_iterator->index < table->capacity) {
+			hash_map_slot_t *slot = &table->slots[map_iterator->index++];
+
+			if (slot->hash > HASH_MAP_SLOT_DELETED) {
+				*key = slot->key;
+				*value = slot->value;
+				return HASH_MAP_SUCCESS;
+			}
+		}
+	}
+
+	return HASH_MAP_ITERATOR_FAILURE_END;
+}
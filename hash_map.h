@@ -0,0 +1,69 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Copyright (c) 2015-2019 Sartura Ltd.
+ *
+ * Author: Domagoj Pintaric <domagoj.pintaric@sartura.hr>
+ *
+ * https://www.sartura.hr/
+ */
+
+#ifndef HASH_MAP_H_ONCE
+#define HASH_MAP_H_ONCE
+
+#include <stddef.h>
+#include <stdint.h>
+
+// open addressing (linear probing) hash map
+// - keys and values are not copied or freed, string keys must stay valid while they are in the map
+// - resizing is incremental, a few slots are moved on every insert/remove instead of rehashing everything at once
+// - lookups do not modify the map, so concurrent hash_map_get() calls are safe under a read lock
+
+typedef struct hash_map_s hash_map_t;
+typedef struct hash_map_table_s hash_map_table_t;
+typedef struct hash_map_iterator_s hash_map_iterator_t;
+
+typedef enum {
+	HASH_MAP_SUCCESS = 0,
+	HASH_MAP_FAILURE_ARGUMENTS = -1,
+	HASH_MAP_FAILURE_MEMORY = -2,
+	HASH_MAP_FAILURE_EMPTY = -3,
+	HASH_MAP_FAILURE_NOT_FOUND = -4,
+	HASH_MAP_FAILURE_EXISTS = -5,
+	HASH_MAP_ITERATOR_FAILURE_END = -6,
+} hash_map_rc;
+
+typedef enum {
+	HASH_MAP_KEY_STRING = 0x1, // key is a NUL terminated string
+	HASH_MAP_KEY_INTEGER,	   // key is an integer stored in the pointer, see HASH_MAP_KEY()
+} hash_map_key_type;
+
+// pass integer keys (ids, file descriptors, ...) as HASH_MAP_KEY(fd)
+#define HASH_MAP_KEY(integer) ((const void *) (uintptr_t) (integer))
+
+typedef uint64_t (*hash_map_hash_cb)(const void *key);
+
+// public so the iterator can live on the stack
+struct hash_map_iterator_s {
+	hash_map_t *map;
+	int table; // 0: current table, 1: table being migrated
+	size_t index;
+};
+
+// hash map API
+hash_map_rc hash_map_new(hash_map_t **map, hash_map_key_type key_type, hash_map_hash_cb hash_cb); // hash_cb NULL selects the default hash
+hash_map_rc hash_map_destroy(hash_map_t *map);
+hash_map_rc hash_map_size_get(hash_map_t *map, size_t *size);
+hash_map_rc hash_map_insert(hash_map_t *map, const void *key, void *value);
+hash_map_rc hash_map_get(hash_map_t *map, const void *key, void **value);
+hash_map_rc hash_map_remove(hash_map_t *map, const void *key, void **value); // value can be NULL
+
+// hash map iterator API, the map must not be modified while iterating
+hash_map_rc hash_map_iterator_init(hash_map_t *map, hash_map_iterator_t *map_iterator);
+hash_map_rc hash_map_iterator_next(hash_map_iterator_t *map_iterator, const void **key, void **value);
+
+// default hash functions
+uint64_t hash_map_string_hash(const void *key);
+uint64_t hash_map_integer_hash(const void *key);
+
+#endif /* HASH_MAP_H_ONCE */
@@ -0,0 +1,180 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Copyright (c) 2019 Sartura Ltd.
+ *
+ * Author: Domagoj Pintaric <domagoj.pintaric@sartura.hr>
+ *
+ * https://www.sartura.hr/
+ */
+
+// benchmark for hash_map.h
+// usage: hash_map_bench [-n keys] [-l lookups]
+// - growth: inserts 100k, 1M and 4M keys (or -n keys) into an empty map and reports the per insert latency,
+//   the worst single insert shows whether a resize or a migration in progress stalls an insert, at millions of keys it is the
+//   insert that frees the fully migrated table (munmap of the old slots)
+// - lookup: hash_map_get() against a LIST_FOREACH scan of a list_t holding the same keys, half hits and half misses
+// build: cc -O2 -D_GNU_SOURCE hash_map_bench.c hash_map.c list.c histogram.c -lm
+
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hash_map.h"
+#include "histogram.h"
+#include "list.h"
+
+#define BENCH_LOOKUPS_DEFAULT 1000000
+#define BENCH_KEY_SIZE 32
+
+static const size_t bench_growth_suite[] = {100000, 1000000, 4000000};
+static const size_t bench_lookup_suite[] = {4, 16, 64, 256, 1024, 4096};
+
+static char (*bench_keys_string(size_t count))[BENCH_KEY_SIZE]
+{
+	char(*keys)[BENCH_KEY_SIZE] = malloc(count * BENCH_KEY_SIZE);
+
+	for (size_t i = 0; i < count; i++) {
+		snprintf(keys[i], BENCH_KEY_SIZE, "/transfer/%zu", i);
+	}
+
+	return keys;
+}
+
+static void bench_growth(hash_map_key_type key_type, size_t count)
+{
+	char(*keys)[BENCH_KEY_SIZE] = key_type == HASH_MAP_KEY_STRING ? bench_keys_string(count) : NULL;
+	histogram_t *latency = NULL;
+	histogram_snapshot_t *snapshot = malloc(sizeof(histogram_snapshot_t));
+	hash_map_t *map = NULL;
+	uint64_t worst = 0, worst_index = 0, total = 0, p50 = 0, p99 = 0, p999 = 0;
+
+	histogram_new(&latency);
+	hash_map_new(&map, key_type, NULL);
+
+	for (size_t i = 0; i < count; i++) {
+		const void *key = keys ? (const void *) keys[i] : HASH_MAP_KEY(i + 1);
+		uint64_t start = histogram_clock();
+
+		if (hash_map_insert(map, key, (void *) key) != HASH_MAP_SUCCESS) {
+			fprintf(stderr, "insert %zu failed\n", i);
+			exit(EXIT_FAILURE);
+		}
+
+		uint64_t elapsed = histogram_clock() - start;
+
+		histogram_record(latency, elapsed);
+		total += elapsed;
+		if (elapsed > worst) {
+			worst = elapsed;
+			worst_index = i;
+		}
+	}
+
+	histogram_snapshot(latency, snapshot);
+	histogram_snapshot_percentile(snapshot, 50, &p50);
+	histogram_snapshot_percentile(snapshot, 99, &p99);
+	histogram_snapshot_percentile(snapshot, 99.9, &p999);
+
+	printf("%7s %9zu %9.1f %9.1f %9.1f %9.1f %11.1f %11" PRIu64 "\n", key_type == HASH_MAP_KEY_STRING ? "string" : "integer", count,
+		   (double) total / (double) count, (double) p50, (double) p99, (double) p999, (double) worst / 1000, worst_index);
+
+	hash_map_destroy(map);
+	histogram_destroy(latency);
+	free(snapshot);
+	free(keys);
+}
+
+static void bench_lookup(size_t count, size_t lookups)
+{
+	char(*keys)[BENCH_KEY_SIZE] = bench_keys_string(count * 2);
+	hash_map_t *map = NULL;
+	list_t *list = NULL;
+	list_node_t *list_node = NULL;
+	size_t found_map = 0, found_list = 0;
+	void *value = NULL;
+
+	hash_map_new(&map, HASH_MAP_KEY_STRING, NULL);
+	list_new(&list);
+
+	// keys [0, count) are stored, keys [count, 2 * count) are misses
+	for (size_t i = 0; i < count; i++) {
+		hash_map_insert(map, keys[i], keys[i]);
+		list_node_new(&list_node, keys[i]);
+		list_insert(list, LIST_OPT_TAIL, list_node);
+	}
+
+	uint64_t start = histogram_clock();
+	for (size_t i = 0; i < lookups; i++) {
+		found_map += hash_map_get(map, keys[i % (count * 2)], &value) == HASH_MAP_SUCCESS;
+	}
+	uint64_t map_elapsed = histogram_clock() - start;
+
+	start = histogram_clock();
+	for (size_t i = 0; i < lookups; i++) {
+		const char *key = keys[i % (count * 2)];
+
+		LIST_FOREACH(list, list_node)
+		{
+			if (strcmp(list_node->data, key) == 0) {
+				found_list++;
+				break;
+			}
+		}
+	}
+	uint64_t list_elapsed = histogram_clock() - start;
+
+	if (found_map != found_list) {
+		fprintf(stderr, "lookup mismatch: hash map %zu, list %zu\n", found_map, found_list);
+		exit(EXIT_FAILURE);
+	}
+
+	printf("%9zu %11.1f %11.1f %9.1fx\n", count, (double) map_elapsed / (double) lookups, (double) list_elapsed / (double) lookups,
+		   (double) list_elapsed / (double) map_elapsed);
+
+	list_destroy_all(list, NULL);
+	hash_map_destroy(map);
+	free(keys);
+}
+
+int main(int argc, char **argv)
+{
+	size_t count = 0;
+	size_t lookups = BENCH_LOOKUPS_DEFAULT;
+	int option = 0;
+
+	while ((option = getopt(argc, argv, "n:l:")) != -1) {
+		switch (option) {
+			case 'n':
+				count = strtoul(optarg, NULL, 10);
+				break;
+			case 'l':
+				lookups = strtoul(optarg, NULL, 10);
+				break;
+			default:
+				fprintf(stderr, "usage: %s [-n keys] [-l lookups]\n", argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+
+	printf("growth, insert latency in ns, worst in us\n");
+	printf("%7s %9s %9s %9s %9s %9s %11s %11s\n", "keys", "count", "mean", "p50", "p99", "p999", "worst us", "worst at");
+	for (size_t i = 0; i < sizeof(bench_growth_suite) / sizeof(bench_growth_suite[0]); i++) {
+		if (count && i) {
+			break;
+		}
+		bench_growth(HASH_MAP_KEY_INTEGER, count ? count : bench_growth_suite[i]);
+		bench_growth(HASH_MAP_KEY_STRING, count ? count : bench_growth_suite[i]);
+	}
+
+	printf("\nlookup, ns per lookup, half hits and half misses\n");
+	printf("%9s %11s %11s %10s\n", "keys", "hash map", "list scan", "speedup");
+	for (size_t i = 0; i < sizeof(bench_lookup_suite) / sizeof(bench_lookup_suite[0]); i++) {
+		// keep the list scans of the larger sizes within a few seconds
+		bench_lookup(bench_lookup_suite[i], bench_lookup_suite[i] > 256 ? lookups / (bench_lookup_suite[i] / 256) : lookups);
+	}
+
+	return EXIT_SUCCESS;
+}
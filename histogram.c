@@ -0,0 +1,284 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Copyright (c) 2019 Sartura Ltd.
+ *
+ * Author: Domagoj Pintaric <domagoj.pintaric@sartura.hr>
+ *
+ * https://www.sartura.hr/
+ */
+
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+
+#include "histogram.h"
+
+struct histogram_s {
+	atomic_uint_fast64_t count;
+	atomic_uint_fast64_t sum;
+	atomic_uint_fast64_t min;
+	atomic_uint_fast64_t max;
+	atomic_uint_fast64_t counts[HISTOGRAM_BUCKETS];
+};
+
+size_t histogram_bucket_index(uint64_t value)
+{
+	if (value < HISTOGRAM_SUB_BUCKETS) {
+		return (size_t) value;
+	}
+
+	// the top HISTOGRAM_SUB_BUCKET_BITS + 1 bits select the bucket, the rest is dropped
+	unsigned int shift = (unsigned int) (63 - __builtin_clzll(value)) - HISTOGRAM_SUB_BUCKET_BITS;
+
+	return (size_t) (shift + 1) * HISTOGRAM_SUB_BUCKETS + (size_t) ((value >> shift) - HISTOGRAM_SUB_BUCKETS);
+}
+
+void histogram_bucket_range(size_t index, uint64_t *lower, uint64_t *upper)
+{
+	if (index < HISTOGRAM_SUB_BUCKETS) {
+		*lower = index;
+		*upper = index;
+		return;
+	}
+
+	unsigned int shift = (unsigned int) (index / HISTOGRAM_SUB_BUCKETS) - 1;
+	uint64_t mantissa = (uint64_t) (index % HISTOGRAM_SUB_BUCKETS) + HISTOGRAM_SUB_BUCKETS;
+
+	*lower = mantissa << shift;
+	*upper = *lower + ((1ULL << shift) - 1);
+}
+
+histogram_rc histogram_new(histogram_t **histogram)
+{
+	if (histogram == NULL) {
+		return HISTOGRAM_FAILURE_ARGUMENTS;
+	}
+
+	*histogram = calloc(1, sizeof(histogram_t));
+	if (*histogram == NULL) {
+		return HISTOGRAM_FAILURE_MEMORY;
+	}
+
+	atomic_init(&(*histogram)->min, UINT64_MAX);
+
+	return HISTOGRAM_SUCCESS;
+}
+
+histogram_rc histogram_destroy(histogram_t *histogram)
+{
+	if (histogram == NULL) {
+		return HISTOGRAM_FAILURE_ARGUMENTS;
+	}
+
+	free(histogram);
+
+	return HISTOGRAM_SUCCESS;
+}
+
+static void histogram_min_max_update(histogram_t *histogram, uint64_t min, uint64_t max)
+{
+	// the loads keep the common case (no new extreme) free of read-modify-write operations
+	uint_fast64_t current = atomic_load_explicit(&histogram->min, memory_order_relaxed);
+	while (min < current && !atomic_compare_exchange_weak_explicit(&histogram->min, &current, min, memory_order_relaxed, memory_order_relaxed)) {
+	}
+
+	current = atomic_load_explicit(&histogram->max, memory_order_relaxed);
+	while (max > current && !atomic_compare_exchange_weak_explicit(&histogram->max, &current, max, memory_order_relaxed, memory_order_relaxed)) {
+	}
+}
+
+histogram_rc histogram_record_n(histogram_t *histogram, uint64_t value, uint64_t n)
+{
+	if (histogram == NULL) {
+		return HISTOGRAM_FAILURE_ARGUMENTS;
+	}
+
+	if (n == 0) {
+		return HISTOGRAM_SUCCESS;
+	}
+
+	atomic_fetch_add_explicit(&histogram->counts[histogram_bucket_index(value)], n, memory_order_relaxed);
+	atomic_fetch_add_explicit(&histogram->count, n, memory_order_relaxed);
+	atomic_fetch_add_explicit(&histogram->sum, value * n, memory_order_relaxed);
+	histogram_min_max_update(histogram, value, value);
+
+	return HISTOGRAM_SUCCESS;
+}
+
+histogram_rc histogram_record(histogram_t *histogram, uint64_t value)
+{
+	return histogram_record_n(histogram, value, 1);
+}
+
+histogram_rc histogram_merge(histogram_t *histogram, histogram_t *other)
+{
+	if (histogram == NULL || other == NULL || histogram == other) {
+		return HISTOGRAM_FAILURE_ARGUMENTS;
+	}
+
+	uint64_t count = 0;
+
+	for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++) {
+		uint64_t bucket_count = atomic_load_explicit(&other->counts[i], memory_order_relaxed);
+		if (bucket_count == 0) {
+			continue;
+		}
+
+		atomic_fetch_add_explicit(&histogram->counts[i], bucket_count, memory_order_relaxed);
+		count += bucket_count;
+	}
+
+	if (count == 0) {
+		return HISTOGRAM_SUCCESS;
+	}
+
+	atomic_fetch_add_explicit(&histogram->count, count, memory_order_relaxed);
+	atomic_fetch_add_explicit(&histogram->sum, atomic_load_explicit(&other->sum, memory_order_relaxed), memory_order_relaxed);
+	histogram_min_max_update(histogram, atomic_load_explicit(&other->min, memory_order_relaxed),
+							 atomic_load_explicit(&other->max, memory_order_relaxed));
+
+	return HISTOGRAM_SUCCESS;
+}
+
+histogram_rc histogram_reset(histogram_t *histogram)
+{
+	if (histogram == NULL) {
+		return HISTOGRAM_FAILURE_ARGUMENTS;
+	}
+
+	for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++) {
+		atomic_store_explicit(&histogram->counts[i], 0, memory_order_relaxed);
+	}
+
+	atomic_store_explicit(&histogram->count, 0, memory_order_relaxed);
+	atomic_store_explicit(&histogram->sum, 0, memory_order_relaxed);
+	atomic_store_explicit(&histogram->min, UINT64_MAX, memory_order_relaxed);
+	atomic_store_explicit(&histogram->max, 0, memory_order_relaxed);
+
+	return HISTOGRAM_SUCCESS;
+}
+
+histogram_rc histogram_snapshot(histogram_t *histogram, histogram_snapshot_t *snapshot)
+{
+	if (histogram == NULL || snapshot == NULL) {
+		return HISTOGRAM_FAILURE_ARGUMENTS;
+	}
+
+	// count is rebuilt from the buckets so percentiles stay consistent while other threads record
+	snapshot->count = 0;
+	for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++) {
+		snapshot->counts[i] = atomic_load_explicit(&histogram->counts[i], memory_order_relaxed);
+		snapshot->count += snapshot->counts[i];
+	}
+
+	snapshot->sum = atomic_load_explicit(&histogram->sum, memory_order_relaxed);
+	snapshot->min = atomic_load_explicit(&histogram->min, memory_order_relaxed);
+	snapshot->max = atomic_load_explicit(&histogram->max, memory_order_relaxed);
+
+	if (snapshot->count == 0) {
+		snapshot->min = 0;
+	}
+
+	return HISTOGRAM_SUCCESS;
+}
+
+histogram_rc histogram_snapshot_percentile(histogram_snapshot_t *snapshot, double percentile, uint64_t *value)
+{
+	if (snapshot == NULL || value == NULL || percentile < 0.0 || percentile > 100.0) {
+		return HISTOGRAM_FAILURE_ARGUMENTS;
+	}
+
+	if (snapshot->count == 0) {
+		return HISTOGRAM_FAILURE_EMPTY;
+	}
+
+	uint64_t target = (uint64_t) (percentile / 100.0 * (double) snapshot->count + 0.5);
+	if (target == 0) {
+		target = 1;
+	}
+
+	if (target > snapshot->count) {
+		target = snapshot->count;
+	}
+
+	uint64_t seen = 0;
+	for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++) {
+		seen += snapshot->counts[i];
+		if (seen < target) {
+			continue;
+		}
+
+		// highest value equivalent to the bucket, bounded by what was actually recorded
+		uint64_t lower = 0;
+		uint64_t upper = 0;
+		histogram_bucket_range(i, &lower, &upper);
+		*value = upper;
+		if (*value > snapshot->max && snapshot->max >= lower) {
+			*value = snapshot->max;
+		}
+		if (*value < snapshot->min) {
+			*value = snapshot->min;
+		}
+
+		return HISTOGRAM_SUCCESS;
+	}
+
+	*value = snapshot->max;
+
+	return HISTOGRAM_SUCCESS;
+}
+
+histogram_rc histogram_snapshot_mean(histogram_snapshot_t *snapshot, double *mean)
+{
+	if (snapshot == NULL || mean == NULL) {
+		return HISTOGRAM_FAILURE_ARGUMENTS;
+	}
+
+	if (snapshot->count == 0) {
+		return HISTOGRAM_FAILURE_EMPTY;
+	}
+
+	*mean = (double) snapshot->sum / (double) snapshot->count;
+
+	return HISTOGRAM_SUCCESS;
+}
+
+// one summary line followed by one line per non empty bucket: lower upper count
+histogram_rc histogram_snapshot_export(histogram_snapshot_t *snapshot, const char *name, FILE *output)
+{
+	static const double percentiles[] = {50.0, 90.0, 99.0, 99.9};
+	uint64_t value = 0;
+	double mean = 0.0;
+
+	if (snapshot == NULL || output == NULL) {
+		return HISTOGRAM_FAILURE_ARGUMENTS;
+	}
+
+	histogram_snapshot_mean(snapshot, &mean);
+
+	fprintf(output, "%s count=%" PRIu64 " min=%" PRIu64 " max=%" PRIu64 " mean=%.1f", name ? name : "histogram", snapshot->count, snapshot->min,
+			snapshot->max, mean);
+
+	for (size_t i = 0; i < sizeof(percentiles) / sizeof(percentiles[0]); i++) {
+		if (histogram_snapshot_percentile(snapshot, percentiles[i], &value) != HISTOGRAM_SUCCESS) {
+			value = 0;
+		}
+		fprintf(output, " p%g=%" PRIu64, percentiles[i], value);
+	}
+	fprintf(output, "\n");
+
+	for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++) {
+		uint64_t lower = 0;
+		uint64_t upper = 0;
+
+		if (snapshot->counts[i] == 0) {
+			continue;
+		}
+
+		histogram_bucket_range(i, &lower, &upper);
+		fprintf(output, "%" PRIu64 " %" PRIu64 " %" PRIu64 "\n", lower, upper, snapshot->counts[i]);
+	}
+
+	return HISTOGRAM_SUCCESS;
+}
@@ -0,0 +1,104 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Copyright (c) 2019 Sartura Ltd.
+ *
+ * Author: Domagoj Pintaric <domagoj.pintaric@sartura.hr>
+ *
+ * https://www.sartura.hr/
+ */
+
+#ifndef HISTOGRAM_H_ONCE
+#define HISTOGRAM_H_ONCE
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#if defined(HISTOGRAM_RDTSC) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#endif
+
+// log-linear (HDR style) histogram of uint64_t values
+// - every power of two range is split into HISTOGRAM_SUB_BUCKETS linear buckets, the relative error is below 1 / HISTOGRAM_SUB_BUCKETS
+// - values below HISTOGRAM_SUB_BUCKETS are exact
+// - recording is lock-free and can be done from any thread, readers work on a snapshot
+// - histogram_reset() is not atomic with respect to concurrent recording
+
+#define HISTOGRAM_SUB_BUCKET_BITS 5
+#define HISTOGRAM_SUB_BUCKETS (1U << HISTOGRAM_SUB_BUCKET_BITS)
+#define HISTOGRAM_BUCKETS ((64 - HISTOGRAM_SUB_BUCKET_BITS + 1) * HISTOGRAM_SUB_BUCKETS)
+
+typedef struct histogram_s histogram_t;
+typedef struct histogram_snapshot_s histogram_snapshot_t;
+
+typedef enum {
+	HISTOGRAM_SUCCESS = 0,
+	HISTOGRAM_FAILURE_ARGUMENTS = -1,
+	HISTOGRAM_FAILURE_MEMORY = -2,
+	HISTOGRAM_FAILURE_EMPTY = -3,
+} histogram_rc;
+
+// public so the snapshot can be allocated by the caller
+struct histogram_snapshot_s {
+	uint64_t count;
+	uint64_t sum;
+	uint64_t min;
+	uint64_t max;
+	uint64_t counts[HISTOGRAM_BUCKETS];
+};
+
+// histogram API
+histogram_rc histogram_new(histogram_t **histogram);
+histogram_rc histogram_destroy(histogram_t *histogram);
+histogram_rc histogram_record(histogram_t *histogram, uint64_t value);
+histogram_rc histogram_record_n(histogram_t *histogram, uint64_t value, uint64_t n);
+histogram_rc histogram_merge(histogram_t *histogram, histogram_t *other); // adds other into histogram
+histogram_rc histogram_reset(histogram_t *histogram);
+histogram_rc histogram_snapshot(histogram_t *histogram, histogram_snapshot_t *snapshot);
+
+// histogram snapshot API
+histogram_rc histogram_snapshot_percentile(histogram_snapshot_t *snapshot, double percentile, uint64_t *value); // percentile in [0, 100]
+histogram_rc histogram_snapshot_mean(histogram_snapshot_t *snapshot, double *mean);
+histogram_rc histogram_snapshot_export(histogram_snapshot_t *snapshot, const char *name, FILE *output);
+
+// bucket index <-> value range, for custom exports
+size_t histogram_bucket_index(uint64_t value);
+void histogram_bucket_range(size_t index, uint64_t *lower, uint64_t *upper);
+
+// time source for the timer macros
+// - nanoseconds from CLOCK_MONOTONIC
+// - TSC ticks with -DHISTOGRAM_RDTSC on x86, cheaper but not converted and only comparable on a constant TSC
+static inline uint64_t histogram_clock(void)
+{
+#if defined(HISTOGRAM_RDTSC) && (defined(__x86_64__) || defined(__i386__))
+	return __rdtsc();
+#else
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (uint64_t) now.tv_sec * 1000000000ULL + (uint64_t) now.tv_nsec;
+#endif
+}
+
+typedef struct {
+	histogram_t *histogram;
+	uint64_t start;
+} histogram_timer_t;
+
+static inline void histogram_timer_stop(histogram_timer_t *timer)
+{
+	histogram_record(timer->histogram, histogram_clock() - timer->start);
+}
+
+// HISTOGRAM_TIMER_SCOPE(histogram) records the time until the end of the enclosing scope
+// HISTOGRAM_TIMER_START(timer, histogram) ... HISTOGRAM_TIMER_STOP(timer) for sections that do not match a scope
+#define HISTOGRAM_CONCAT_(a, b) a##b
+#define HISTOGRAM_CONCAT(a, b) HISTOGRAM_CONCAT_(a, b)
+#define HISTOGRAM_TIMER_SCOPE(histogram)                                                                                                             \
+	histogram_timer_t HISTOGRAM_CONCAT(histogram_timer_, __LINE__) __attribute__((cleanup(histogram_timer_stop))) = {(histogram), histogram_clock()}
+#define HISTOGRAM_TIMER_START(timer, histogram) histogram_timer_t timer = {(histogram), histogram_clock()}
+#define HISTOGRAM_TIMER_STOP(timer) histogram_timer_stop(&(timer))
+
+#endif /* HISTOGRAM_H_ONCE */
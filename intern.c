@@ -0,0 +1,206 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Copyright (c) 2019 Sartura Ltd.
+ *
+ * Author: Juraj Vijtiuk <juraj.vijtiuk@sartura.hr>
+ *
+ * https://www.sartura.hr/
+ */
+
+#include <pthread.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hash_map.h"
+#include "intern.h"
+#include "memory.h"
+
+// stored right in front of the string
+typedef struct {
+	uint64_t hash;
+	size_t length;
+} intern_header_t;
+
+struct intern_s {
+	int opts;
+	pthread_rwlock_t lock;
+	hash_map_t *map; // interned string -> interned string
+	xarena_t *arena;
+	size_t strings;
+	size_t bytes;
+	atomic_size_t requests;
+	atomic_size_t bytes_saved;
+};
+
+static void intern_read_lock(intern_t *intern)
+{
+	if (intern->opts & INTERN_OPT_THREAD_SAFE) {
+		pthread_rwlock_rdlock(&intern->lock);
+	}
+}
+
+static void intern_write_lock(intern_t *intern)
+{
+	if (intern->opts & INTERN_OPT_THREAD_SAFE) {
+		pthread_rwlock_wrlock(&intern->lock);
+	}
+}
+
+static void intern_unlock(intern_t *intern)
+{
+	if (intern->opts & INTERN_OPT_THREAD_SAFE) {
+		pthread_rwlock_unlock(&intern->lock);
+	}
+}
+
+intern_rc intern_new(intern_t **intern, int opts)
+{
+	if (intern == NULL) {
+		return INTERN_FAILURE_ARGUMENTS;
+	}
+
+	*intern = calloc(1, sizeof(intern_t));
+	if (*intern == NULL) {
+		return INTERN_FAILURE_MEMORY;
+	}
+
+	if (hash_map_new(&(*intern)->map, HASH_MAP_KEY_STRING, NULL) != HASH_MAP_SUCCESS) {
+		free(*intern);
+		*intern = NULL;
+		return INTERN_FAILURE_MEMORY;
+	}
+
+	if ((opts & INTERN_OPT_THREAD_SAFE) && pthread_rwlock_init(&(*intern)->lock, NULL) != 0) {
+		hash_map_destroy((*intern)->map);
+		free(*intern);
+		*intern = NULL;
+		return INTERN_FAILURE_MEMORY;
+	}
+
+	(*intern)->opts = opts;
+	(*intern)->arena = xarena_new(0);
+	atomic_init(&(*intern)->requests, 0);
+	atomic_init(&(*intern)->bytes_saved, 0);
+
+	return INTERN_SUCCESS;
+}
+
+intern_rc intern_destroy(intern_t *intern)
+{
+	if (intern == NULL) {
+		return INTERN_FAILURE_ARGUMENTS;
+	}
+
+	if (intern->opts & INTERN_OPT_THREAD_SAFE) {
+		pthread_rwlock_destroy(&intern->lock);
+	}
+
+	hash_map_destroy(intern->map);
+	xarena_destroy(intern->arena);
+	free(intern);
+
+	return INTERN_SUCCESS;
+}
+
+intern_rc intern_lookup(intern_t *intern, const char *s, const char **interned)
+{
+	if (intern == NULL || s == NULL || interned == NULL) {
+		return INTERN_FAILURE_ARGUMENTS;
+	}
+
+	void *value = NULL;
+
+	intern_read_lock(intern);
+	hash_map_rc rc = hash_map_get(intern->map, s, &value);
+	intern_unlock(intern);
+
+	if (rc != HASH_MAP_SUCCESS) {
+		return INTERN_FAILURE_NOT_FOUND;
+	}
+
+	*interned = value;
+
+	return INTERN_SUCCESS;
+}
+
+intern_rc intern_string(intern_t *intern, const char *s, const char **interned)
+{
+	if (intern == NULL || s == NULL || interned == NULL) {
+		return INTERN_FAILURE_ARGUMENTS;
+	}
+
+	atomic_fetch_add_explicit(&intern->requests, 1, memory_order_relaxed);
+
+	// fast path, most strings are already interned
+	if (intern_lookup(intern, s, interned) == INTERN_SUCCESS) {
+		atomic_fetch_add_explicit(&intern->bytes_saved, intern_length_get(*interned) + 1, memory_order_relaxed);
+		return INTERN_SUCCESS;
+	}
+
+	intern_write_lock(intern);
+
+	// another writer may have inserted it since the read lock was dropped
+	void *value = NULL;
+	if (hash_map_get(intern->map, s, &value) == HASH_MAP_SUCCESS) {
+		intern_unlock(intern);
+		*interned = value;
+		atomic_fetch_add_explicit(&intern->bytes_saved, intern_length_get(*interned) + 1, memory_order_relaxed);
+		return INTERN_SUCCESS;
+	}
+
+	size_t length = strlen(s);
+	xarena_mark_t mark = xarena_mark(intern->arena);
+	intern_header_t *header = xarena_alloc_aligned(intern->arena, sizeof(intern_header_t) + length + 1, alignof(intern_header_t));
+	char *string = (char *) (header + 1);
+
+	header->hash = hash_map_string_hash(s);
+	header->length = length;
+	memcpy(string, s, length + 1);
+
+	if (hash_map_insert(intern->map, string, string) != HASH_MAP_SUCCESS) {
+		// give the string back, nothing else points into the arena past the mark
+		xarena_rewind(intern->arena, mark);
+		intern_unlock(intern);
+		return INTERN_FAILURE_MEMORY;
+	}
+
+	intern->strings++;
+	intern->bytes += length + 1;
+
+	intern_unlock(intern);
+
+	*interned = string;
+
+	return INTERN_SUCCESS;
+}
+
+intern_rc intern_stats_get(intern_t *intern, intern_stats_t *stats)
+{
+	if (intern == NULL || stats == NULL) {
+		return INTERN_FAILURE_ARGUMENTS;
+	}
+
+	intern_read_lock(intern);
+	stats->strings = intern->strings;
+	stats->bytes = intern->bytes;
+	intern_unlock(intern);
+
+	stats->requests = atomic_load_explicit(&intern->requests, memory_order_relaxed);
+	stats->bytes_saved = atomic_load_explicit(&intern->bytes_saved, memory_order_relaxed);
+
+	return INTERN_SUCCESS;
+}
+
+uint64_t intern_hash_get(const char *interned)
+{
+	return ((const intern_header_t *) interned - 1)->hash;
+}
+
+size_t intern_length_get(const char *interned)
+{
+	return ((const intern_header_t *) interned - 1)->length;
+}
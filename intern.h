@@ -0,0 +1,53 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Copyright (c) 2019 Sartura Ltd.
+ *
+ * Author: Juraj Vijtiuk <juraj.vijtiuk@sartura.hr>
+ *
+ * https://www.sartura.hr/
+ */
+
+#ifndef INTERN_H_ONCE
+#define INTERN_H_ONCE
+
+#include <stddef.h>
+#include <stdint.h>
+
+// string interning
+// - every distinct string is stored once in an arena and has one canonical immutable pointer
+// - interned strings from the same table can be compared with ==
+// - the hash and length of an interned string are stored next to it
+// - strings live until intern_destroy()
+
+typedef struct intern_s intern_t;
+
+typedef enum {
+	INTERN_SUCCESS = 0,
+	INTERN_FAILURE_ARGUMENTS = -1,
+	INTERN_FAILURE_MEMORY = -2,
+	INTERN_FAILURE_NOT_FOUND = -3,
+} intern_rc;
+
+typedef enum {
+	INTERN_OPT_THREAD_SAFE = 0x1, // protect the table with a read/write lock
+} intern_opt;
+
+typedef struct {
+	size_t strings;		// distinct strings stored
+	size_t bytes;		// bytes stored, including the terminating NUL
+	size_t requests;	// intern_string() calls
+	size_t bytes_saved; // bytes that were not stored again because the string was already interned
+} intern_stats_t;
+
+intern_rc intern_new(intern_t **intern, int opts);
+intern_rc intern_destroy(intern_t *intern);
+intern_rc intern_string(intern_t *intern, const char *s, const char **interned);
+intern_rc intern_lookup(intern_t *intern, const char *s, const char **interned); // does not insert
+intern_rc intern_stats_get(intern_t *intern, intern_stats_t *stats);
+
+// only valid for pointers returned by intern_string()/intern_lookup()
+uint64_t intern_hash_get(const char *interned);
+size_t intern_length_get(const char *interned);
+
+#endif /* INTERN_H_ONCE */
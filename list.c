@@ -13,22 +13,32 @@
 
 #include "list.h"
 
-struct list_s {
-	size_t size;
-	list_node_t *head;
-	list_node_t *tail;
-};
-
-struct list_node_s {
-	void *data;
-	list_node_t *next;
-	list_node_t *previous;
-};
-
-struct list_iterator_s {
-	list_node_t *list_node_current;
-	list_opt opt;
-};
+// build with -DLIST_XPOOL to take nodes and iterators from process wide object pools instead of calloc()
+#ifdef LIST_XPOOL
+#include <pthread.h>
+
+#include "memory.h"
+
+static pthread_once_t list_xpool_once = PTHREAD_ONCE_INIT;
+static xpool_t *list_node_xpool = NULL;
+static xpool_t *list_iterator_xpool = NULL;
+
+static void list_xpool_init(void)
+{
+	list_node_xpool = xpool_new(sizeof(list_node_t), 0, XPOOL_OPT_ZERO);
+	list_iterator_xpool = xpool_new(sizeof(list_iterator_t), 0, XPOOL_OPT_ZERO);
+}
+
+#define LIST_NODE_ALLOC() (pthread_once(&list_xpool_once, list_xpool_init), xpool_get(list_node_xpool))
+#define LIST_NODE_FREE(list_node) xpool_put(list_node_xpool, list_node)
+#define LIST_ITERATOR_ALLOC() (pthread_once(&list_xpool_once, list_xpool_init), xpool_get(list_iterator_xpool))
+#define LIST_ITERATOR_FREE(list_iterator) xpool_put(list_iterator_xpool, list_iterator)
+#else
+#define LIST_NODE_ALLOC() calloc(1, sizeof(list_node_t))
+#define LIST_NODE_FREE(list_node) free(list_node)
+#define LIST_ITERATOR_ALLOC() calloc(1, sizeof(list_iterator_t))
+#define LIST_ITERATOR_FREE(list_iterator) free(list_iterator)
+#endif
 
 list_rc list_new(list_t **list)
 {
@@ -145,13 +155,202 @@ list_rc list_remove(list_t *list, list_node_t *list_node)
 	return LIST_SUCCESS;
 }
 
+list_rc list_destroy_all(list_t *list, void (*list_node_data_free_cb)(void *data))
+{
+	if (list == NULL) {
+		return LIST_FAILURE_ARGUMENTS;
+	}
+
+	list_node_t *list_node = NULL;
+	list_node_t *list_node_tmp = NULL;
+	LIST_FOREACH_SAFE(list, list_node, list_node_tmp)
+	{
+		list_node_destroy(list_node, list_node_data_free_cb);
+	}
+
+	free(list);
+
+	return LIST_SUCCESS;
+}
+
+list_rc list_concat(list_t *list, list_t *list_other)
+{
+	if (list == NULL || list_other == NULL || list == list_other) {
+		return LIST_FAILURE_ARGUMENTS;
+	}
+
+	return list_splice(list, list->tail, list_other);
+}
+
+list_rc list_splice(list_t *list, list_node_t *list_node, list_t *list_other)
+{
+	if (list == NULL || list_other == NULL || list == list_other) {
+		return LIST_FAILURE_ARGUMENTS;
+	}
+
+	if (list_other->head == NULL) {
+		return LIST_SUCCESS;
+	}
+
+	list_node_t *list_node_next = list_node ? list_node->next : list->head;
+
+	// link list_other between list_node and list_node_next
+	list_other->head->previous = list_node;
+	if (list_node != NULL) {
+		list_node->next = list_other->head;
+	} else {
+		list->head = list_other->head;
+	}
+
+	list_other->tail->next = list_node_next;
+	if (list_node_next != NULL) {
+		list_node_next->previous = list_other->tail;
+	} else {
+		list->tail = list_other->tail;
+	}
+
+	list->size += list_other->size;
+
+	list_other->size = 0;
+	list_other->head = NULL;
+	list_other->tail = NULL;
+
+	return LIST_SUCCESS;
+}
+
+list_rc list_split(list_t *list, list_node_t *list_node_first, list_node_t *list_node_last, list_t *list_other)
+{
+	if (list == NULL || list_node_first == NULL || list_node_last == NULL || list_other == NULL || list == list_other) {
+		return LIST_FAILURE_ARGUMENTS;
+	}
+
+	// the relinking itself is O(1), counting the range keeps size valid on both lists
+	size_t size = 1;
+	for (list_node_t *list_node = list_node_first; list_node != list_node_last; list_node = list_node->next) {
+		if (list_node->next == NULL) {
+			return LIST_FAILURE_ARGUMENTS;
+		}
+		size++;
+	}
+
+	// unlink range from list
+	if (list_node_first->previous != NULL) {
+		list_node_first->previous->next = list_node_last->next;
+	} else {
+		list->head = list_node_last->next;
+	}
+
+	if (list_node_last->next != NULL) {
+		list_node_last->next->previous = list_node_first->previous;
+	} else {
+		list->tail = list_node_first->previous;
+	}
+
+	list->size -= size;
+
+	// link range to the tail of list_other
+	list_node_first->previous = list_other->tail;
+	list_node_last->next = NULL;
+	if (list_other->tail != NULL) {
+		list_other->tail->next = list_node_first;
+	} else {
+		list_other->head = list_node_first;
+	}
+	list_other->tail = list_node_last;
+	list_other->size += size;
+
+	return LIST_SUCCESS;
+}
+
+list_rc list_sort(list_t *list, int (*list_node_data_compare_cb)(const void *data_a, const void *data_b))
+{
+	if (list == NULL || list_node_data_compare_cb == NULL) {
+		return LIST_FAILURE_ARGUMENTS;
+	}
+
+	if (list->size < 2) {
+		return LIST_SUCCESS;
+	}
+
+	// bottom-up merge sort over the next links, merging runs of width 1, 2, 4, ...
+	// previous links are rebuilt in a single pass at the end
+	list_node_t *head = list->head;
+	list_node_t *tail = NULL;
+
+	for (size_t width = 1;; width *= 2) {
+		list_node_t *a = head;
+		size_t merges = 0;
+
+		head = NULL;
+		tail = NULL;
+
+		while (a) {
+			list_node_t *b = a;
+			size_t a_size = 0;
+			size_t b_size = width;
+
+			merges++;
+
+			for (size_t i = 0; i < width && b; i++) {
+				a_size++;
+				b = b->next;
+			}
+
+			while (a_size > 0 || (b_size > 0 && b)) {
+				list_node_t *list_node = NULL;
+
+				// take from a on ties to keep the sort stable
+				if (a_size == 0) {
+					list_node = b;
+					b = b->next;
+					b_size--;
+				} else if (b_size == 0 || b == NULL || list_node_data_compare_cb(a->data, b->data) <= 0) {
+					list_node = a;
+					a = a->next;
+					a_size--;
+				} else {
+					list_node = b;
+					b = b->next;
+					b_size--;
+				}
+
+				if (tail) {
+					tail->next = list_node;
+				} else {
+					head = list_node;
+				}
+				tail = list_node;
+			}
+
+			a = b;
+		}
+
+		tail->next = NULL;
+
+		if (merges <= 1) {
+			break;
+		}
+	}
+
+	list_node_t *list_node_previous = NULL;
+	for (list_node_t *list_node = head; list_node; list_node = list_node->next) {
+		list_node->previous = list_node_previous;
+		list_node_previous = list_node;
+	}
+
+	list->head = head;
+	list->tail = tail;
+
+	return LIST_SUCCESS;
+}
+
 list_rc list_node_new(list_node_t **list_node, void *data)
 {
 	if (list_node == NULL || data == NULL) {
 		return LIST_FAILURE_ARGUMENTS;
 	}
 
-	*list_node = calloc(1, sizeof(list_node_t));
+	*list_node = LIST_NODE_ALLOC();
 	if (*list_node == NULL) {
 		return LIST_FAILURE_MEMORY;
 	}
@@ -175,7 +374,7 @@ list_rc list_node_destroy(list_node_t *list_node, void (*list_node_data_free_cb)
 	list_node->data = NULL;
 	list_node->previous = NULL;
 	list_node->next = NULL;
-	free(list_node);
+	LIST_NODE_FREE(list_node);
 
 	return LIST_SUCCESS;
 }
@@ -197,7 +396,7 @@ list_rc list_iterator_new(list_t *list, list_opt opt, list_iterator_t **list_ite
 		return LIST_FAILURE_ARGUMENTS;
 	}
 
-	*list_iterator = calloc(1, sizeof(list_iterator_t));
+	*list_iterator = LIST_ITERATOR_ALLOC();
 	if (*list_iterator == NULL) {
 		return LIST_FAILURE_MEMORY;
 	}
@@ -211,13 +410,28 @@ list_rc list_iterator_new(list_t *list, list_opt opt, list_iterator_t **list_ite
 	return LIST_SUCCESS;
 }
 
+list_rc list_iterator_init(list_t *list, list_opt opt, list_iterator_t *list_iterator)
+{
+	if (list == NULL || (opt != LIST_OPT_HEAD && opt != LIST_OPT_TAIL) || list_iterator == NULL) {
+		return LIST_FAILURE_ARGUMENTS;
+	}
+
+	list_iterator->opt = opt;
+	if (list_peek(list, opt, &list_iterator->list_node_current) == LIST_FAILURE_EMPTY) {
+		list_iterator->list_node_current = NULL;
+		return LIST_FAILURE_EMPTY;
+	}
+
+	return LIST_SUCCESS;
+}
+
 list_rc list_iterator_destroy(list_iterator_t *list_iterator)
 {
 	if (list_iterator == NULL) {
 		return LIST_FAILURE_ARGUMENTS;
 	}
 
-	free(list_iterator);
+	LIST_ITERATOR_FREE(list_iterator);
 
 	return LIST_SUCCESS;
 }
@@ -237,4 +451,138 @@ list_rc list_iterator_next(list_iterator_t *list_iterator, list_node_t **list_no
 		list_iterator->opt == LIST_OPT_HEAD ? list_iterator->list_node_current->next : list_iterator->list_node_current->previous;
 
 	return LIST_SUCCESS;
-}
\ No newline at end of file
+}
+
+list_rc list_intrusive_init(list_intrusive_t *list)
+{
+	if (list == NULL) {
+		return LIST_FAILURE_ARGUMENTS;
+	}
+
+	list->size = 0;
+	list->head = NULL;
+	list->tail = NULL;
+
+	return LIST_SUCCESS;
+}
+
+list_rc list_intrusive_size_get(list_intrusive_t *list, size_t *size)
+{
+	if (list == NULL || size == NULL) {
+		return LIST_FAILURE_ARGUMENTS;
+	}
+
+	*size = list->size;
+
+	return LIST_SUCCESS;
+}
+
+list_rc list_intrusive_insert(list_intrusive_t *list, list_opt opt, list_intrusive_node_t *list_node)
+{
+	if (list == NULL || (opt != LIST_OPT_HEAD && opt != LIST_OPT_TAIL) || list_node == NULL) {
+		return LIST_FAILURE_ARGUMENTS;
+	}
+
+	// embedded nodes are not zeroed by an allocator, so always set both links
+	list_node->next = NULL;
+	list_node->previous = NULL;
+
+	// list is empty
+	if (list->head == NULL && list->tail == NULL) {
+		list->head = list_node;
+		list->tail = list_node;
+		list->size++;
+
+		return LIST_SUCCESS;
+	}
+
+	switch (opt) {
+		case LIST_OPT_HEAD:
+			list_node->next = list->head;
+			list->head->previous = list_node;
+			list->head = list_node;
+			break;
+		case LIST_OPT_TAIL:
+			list_node->previous = list->tail;
+			list->tail->next = list_node;
+			list->tail = list_node;
+			break;
+	}
+
+	list->size++;
+
+	return LIST_SUCCESS;
+}
+
+list_rc list_intrusive_peek(list_intrusive_t *list, list_opt opt, list_intrusive_node_t **list_node)
+{
+	if (list == NULL || (opt != LIST_OPT_HEAD && opt != LIST_OPT_TAIL) || list_node == NULL) {
+		return LIST_FAILURE_ARGUMENTS;
+	}
+
+	if (list->head == NULL && list->tail == NULL) {
+		return LIST_FAILURE_EMPTY;
+	}
+
+	*list_node = opt == LIST_OPT_HEAD ? list->head : list->tail;
+
+	return LIST_SUCCESS;
+}
+
+list_rc list_intrusive_remove(list_intrusive_t *list, list_intrusive_node_t *list_node)
+{
+	if (list == NULL || list_node == NULL) {
+		return LIST_FAILURE_ARGUMENTS;
+	}
+
+	// unlink from list
+	if (list_node->previous != NULL) {
+		list_node->previous->next = list_node->next;
+	} else {
+		list->head = list_node->next;
+	}
+
+	if (list_node->next != NULL) {
+		list_node->next->previous = list_node->previous;
+	} else {
+		list->tail = list_node->previous;
+	}
+
+	list_node->next = NULL;
+	list_node->previous = NULL;
+	list->size--;
+
+	return LIST_SUCCESS;
+}
+
+list_rc list_intrusive_iterator_init(list_intrusive_t *list, list_opt opt, list_intrusive_iterator_t *list_iterator)
+{
+	if (list == NULL || (opt != LIST_OPT_HEAD && opt != LIST_OPT_TAIL) || list_iterator == NULL) {
+		return LIST_FAILURE_ARGUMENTS;
+	}
+
+	list_iterator->opt = opt;
+	if (list_intrusive_peek(list, opt, &list_iterator->list_node_current) == LIST_FAILURE_EMPTY) {
+		list_iterator->list_node_current = NULL;
+		return LIST_FAILURE_EMPTY;
+	}
+
+	return LIST_SUCCESS;
+}
+
+list_rc list_intrusive_iterator_next(list_intrusive_iterator_t *list_iterator, list_intrusive_node_t **list_node_next)
+{
+	if (list_iterator == NULL || list_node_next == NULL) {
+		return LIST_FAILURE_ARGUMENTS;
+	}
+
+	*list_node_next = list_iterator->list_node_current;
+	if (*list_node_next == NULL) {
+		return LIST_ITERATOR_FAILURE_END;
+	}
+
+	list_iterator->list_node_current =
+		list_iterator->opt == LIST_OPT_HEAD ? list_iterator->list_node_current->next : list_iterator->list_node_current->previous;
+
+	return LIST_SUCCESS;
+}
@@ -16,6 +16,9 @@
 typedef struct list_s list_t;
 typedef struct list_node_s list_node_t;
 typedef struct list_iterator_s list_iterator_t;
+typedef struct list_intrusive_s list_intrusive_t;
+typedef struct list_intrusive_node_s list_intrusive_node_t;
+typedef struct list_intrusive_iterator_s list_intrusive_iterator_t;
 
 typedef enum {
 	LIST_SUCCESS = 0,
@@ -30,6 +33,55 @@ typedef enum {
 	LIST_OPT_TAIL,		 // start from tail
 } list_opt;
 
+// list types are public so iterators can live on the stack and the LIST_FOREACH macros can be inlined
+struct list_s {
+	size_t size;
+	list_node_t *head;
+	list_node_t *tail;
+};
+
+struct list_node_s {
+	void *data;
+	list_node_t *next;
+	list_node_t *previous;
+};
+
+struct list_iterator_s {
+	list_node_t *list_node_current;
+	list_opt opt;
+};
+
+struct list_intrusive_node_s {
+	list_intrusive_node_t *next;
+	list_intrusive_node_t *previous;
+};
+
+struct list_intrusive_s {
+	size_t size;
+	list_intrusive_node_t *head;
+	list_intrusive_node_t *tail;
+};
+
+struct list_intrusive_iterator_s {
+	list_intrusive_node_t *list_node_current;
+	list_opt opt;
+};
+
+// get the struct embedding a list_intrusive_node_t, e.g. LIST_CONTAINER_OF(node, struct foo, list_node)
+#define LIST_CONTAINER_OF(ptr, type, member) ((type *) ((char *) (ptr) - offsetof(type, member)))
+
+// inline traversal for both list_t and list_intrusive_t
+// the _SAFE variants allow removing (and destroying) list_node while walking
+#define LIST_FOREACH(list, list_node) for ((list_node) = (list)->head; (list_node) != NULL; (list_node) = (list_node)->next)
+
+#define LIST_FOREACH_REVERSE(list, list_node) for ((list_node) = (list)->tail; (list_node) != NULL; (list_node) = (list_node)->previous)
+
+#define LIST_FOREACH_SAFE(list, list_node, list_node_tmp)                                                                                            \
+	for ((list_node) = (list)->head; (list_node) != NULL && ((list_node_tmp) = (list_node)->next, 1); (list_node) = (list_node_tmp))
+
+#define LIST_FOREACH_REVERSE_SAFE(list, list_node, list_node_tmp)                                                                                    \
+	for ((list_node) = (list)->tail; (list_node) != NULL && ((list_node_tmp) = (list_node)->previous, 1); (list_node) = (list_node_tmp))
+
 // list API
 list_rc list_new(list_t **list);
 list_rc list_destroy(list_t *list);
@@ -37,6 +89,11 @@ list_rc list_size_get(list_t *list, size_t *size);
 list_rc list_insert(list_t *list, list_opt opt, list_node_t *list_node);
 list_rc list_peek(list_t *list, list_opt opt, list_node_t **list_node);
 list_rc list_remove(list_t *list, list_node_t *list_node);
+list_rc list_destroy_all(list_t *list, void (*list_node_data_free_cb)(void *data)); // destroys all nodes and the list
+list_rc list_concat(list_t *list, list_t *list_other); // moves all nodes of list_other to the tail of list, O(1)
+list_rc list_splice(list_t *list, list_node_t *list_node, list_t *list_other); // moves all nodes of list_other after list_node (NULL for head), O(1)
+list_rc list_split(list_t *list, list_node_t *list_node_first, list_node_t *list_node_last, list_t *list_other); // moves the range to the tail of list_other
+list_rc list_sort(list_t *list, int (*list_node_data_compare_cb)(const void *data_a, const void *data_b)); // stable, does not allocate
 
 // list node API
 list_rc list_node_new(list_node_t **list_node, void *data);
@@ -45,7 +102,20 @@ list_rc list_node_data_get(list_node_t *list_node, void **data);
 
 // list iterator API
 list_rc list_iterator_new(list_t *list, list_opt opt, list_iterator_t **list_iterator);
+list_rc list_iterator_init(list_t *list, list_opt opt, list_iterator_t *list_iterator); // for iterators on the stack, no destroy needed
 list_rc list_iterator_destroy(list_iterator_t *list_iterator);
 list_rc list_iterator_next(list_iterator_t *list_iterator, list_node_t **list_node_next);
 
+// intrusive list API
+// nodes are embedded in the user data, so insert and remove never allocate
+list_rc list_intrusive_init(list_intrusive_t *list);
+list_rc list_intrusive_size_get(list_intrusive_t *list, size_t *size);
+list_rc list_intrusive_insert(list_intrusive_t *list, list_opt opt, list_intrusive_node_t *list_node);
+list_rc list_intrusive_peek(list_intrusive_t *list, list_opt opt, list_intrusive_node_t **list_node);
+list_rc list_intrusive_remove(list_intrusive_t *list, list_intrusive_node_t *list_node);
+
+// intrusive list iterator API
+list_rc list_intrusive_iterator_init(list_intrusive_t *list, list_opt opt, list_intrusive_iterator_t *list_iterator);
+list_rc list_intrusive_iterator_next(list_intrusive_iterator_t *list_iterator, list_intrusive_node_t **list_node_next);
+
 #endif /* LIST_H_ONCE */
\ No newline at end of file
@@ -0,0 +1,230 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Copyright (c) 2019 Sartura Ltd.
+ *
+ * Author: Domagoj Pintaric <domagoj.pintaric@sartura.hr>
+ *
+ * https://www.sartura.hr/
+ */
+
+// benchmark for the list_t walks, LIST_FOREACH macros and stack iterators against list_iterator_new()/next()/destroy()
+// usage: list_bench [-n nodes]
+// - 1k and 1M nodes (or -n nodes) are walked forward from the head, in reverse from the tail, and forward while every
+//   other node is removed (LIST_FOREACH_SAFE, the iterators already point past the node they return)
+// - removed nodes are moved to a second list with list_split() and put back in their place after the walk, outside of the measurement,
+//   so every walk sees the same node order
+// - the stack iterator is set up with list_iterator_init(), the heap iterator allocates and frees one iterator per walk
+// - small sizes are repeated so every measurement covers at least 10M nodes
+// build: cc -O2 list_bench.c list.c
+
+#include <getopt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "list.h"
+
+#define BENCH_NODES_MIN 10000000
+
+typedef enum {
+	BENCH_WALK_FORWARD = 0,
+	BENCH_WALK_REVERSE,
+	BENCH_WALK_REMOVE,
+	BENCH_WALK_COUNT,
+} bench_walk;
+
+typedef enum {
+	BENCH_METHOD_MACRO = 0,
+	BENCH_METHOD_STACK,
+	BENCH_METHOD_HEAP,
+	BENCH_METHOD_COUNT,
+} bench_method;
+
+static const size_t bench_suite[] = {1000, 1000000};
+static const char *const bench_walk_names[BENCH_WALK_COUNT] = {"forward", "reverse", "remove"};
+
+static uint64_t bench_clock(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (uint64_t) now.tv_sec * 1000000000ULL + (uint64_t) now.tv_nsec;
+}
+
+// keeps the walk results alive
+static volatile uintptr_t bench_sink;
+
+static uintptr_t bench_walk_macro(list_t *list, bench_walk walk, list_t *removed)
+{
+	list_node_t *list_node = NULL;
+	list_node_t *list_node_tmp = NULL;
+	uintptr_t sum = 0;
+	size_t index = 0;
+
+	switch (walk) {
+		case BENCH_WALK_FORWARD:
+			LIST_FOREACH(list, list_node)
+			{
+				sum += (uintptr_t) list_node->data;
+			}
+			break;
+		case BENCH_WALK_REVERSE:
+			LIST_FOREACH_REVERSE(list, list_node)
+			{
+				sum += (uintptr_t) list_node->data;
+			}
+			break;
+		default:
+			LIST_FOREACH_SAFE(list, list_node, list_node_tmp)
+			{
+				if (index++ % 2) {
+					list_split(list, list_node, list_node, removed);
+				} else {
+					sum += (uintptr_t) list_node->data;
+				}
+			}
+			break;
+	}
+
+	return sum;
+}
+
+static uintptr_t bench_walk_iterator(list_t *list, bench_walk walk, list_t *removed, list_iterator_t *list_iterator)
+{
+	list_node_t *list_node = NULL;
+	uintptr_t sum = 0;
+	size_t index = 0;
+
+	while (list_iterator_next(list_iterator, &list_node) == LIST_SUCCESS) {
+		if (walk == BENCH_WALK_REMOVE && index++ % 2) {
+			list_split(list, list_node, list_node, removed);
+		} else {
+			sum += (uintptr_t) list_node->data;
+		}
+	}
+
+	return sum;
+}
+
+// every other node was removed, put each one back after the node that preceded it
+static void bench_restore(list_t *list, list_t *removed)
+{
+	list_t *single = NULL;
+	list_node_t *list_node = list->head;
+	list_node_t *list_node_removed = NULL;
+
+	list_new(&single);
+	while (list_node && list_peek(removed, LIST_OPT_HEAD, &list_node_removed) == LIST_SUCCESS) {
+		list_split(removed, list_node_removed, list_node_removed, single);
+		list_splice(list, list_node, single);
+		list_node = list_node_removed->next;
+	}
+	list_destroy(single);
+}
+
+// ns per node
+static double bench_walk_run(list_t *list, bench_walk walk, bench_method method, size_t count, size_t repeat)
+{
+	list_t *removed = NULL;
+	list_iterator_t list_iterator = {0};
+	list_iterator_t *list_iterator_heap = NULL;
+	list_opt opt = walk == BENCH_WALK_REVERSE ? LIST_OPT_TAIL : LIST_OPT_HEAD;
+	uint64_t elapsed = 0, start = 0;
+	uintptr_t sum = 0;
+
+	list_new(&removed);
+
+	for (size_t r = 0; r < repeat; r++) {
+		start = bench_clock();
+		switch (method) {
+			case BENCH_METHOD_MACRO:
+				sum += bench_walk_macro(list, walk, removed);
+				break;
+			case BENCH_METHOD_STACK:
+				list_iterator_init(list, opt, &list_iterator);
+				sum += bench_walk_iterator(list, walk, removed, &list_iterator);
+				break;
+			default:
+				list_iterator_new(list, opt, &list_iterator_heap);
+				sum += bench_walk_iterator(list, walk, removed, list_iterator_heap);
+				list_iterator_destroy(list_iterator_heap);
+				break;
+		}
+		elapsed += bench_clock() - start;
+
+		if (walk == BENCH_WALK_REMOVE) {
+			bench_restore(list, removed);
+		}
+	}
+
+	bench_sink = sum;
+	list_destroy(removed);
+
+	return (double) elapsed / ((double) count * (double) repeat);
+}
+
+static void bench_run(size_t count)
+{
+	size_t repeat = count < BENCH_NODES_MIN ? BENCH_NODES_MIN / count : 1;
+	list_t *list = NULL;
+	list_node_t *list_node = NULL;
+	double result[BENCH_METHOD_COUNT] = {0};
+
+	list_new(&list);
+	for (size_t i = 0; i < count; i++) {
+		list_node_new(&list_node, (void *) (i + 1));
+		list_insert(list, LIST_OPT_TAIL, list_node);
+	}
+
+	// untimed, so the first measurement does not pay for the nodes just allocated
+	bench_sink = bench_walk_macro(list, BENCH_WALK_FORWARD, NULL);
+
+	for (int walk = 0; walk < BENCH_WALK_COUNT; walk++) {
+		for (int method = 0; method < BENCH_METHOD_COUNT; method++) {
+			result[method] = bench_walk_run(list, (bench_walk) walk, (bench_method) method, count, repeat);
+		}
+
+		char nodes[32] = "";
+		if (walk == BENCH_WALK_FORWARD) {
+			snprintf(nodes, sizeof(nodes), "%zu", count);
+		}
+
+		printf("%9s %9s %9.2f %9.2f %9.2f %8.1fx\n", nodes, bench_walk_names[walk], result[BENCH_METHOD_MACRO],
+			   result[BENCH_METHOD_STACK], result[BENCH_METHOD_HEAP], result[BENCH_METHOD_HEAP] / result[BENCH_METHOD_MACRO]);
+	}
+
+	list_destroy_all(list, NULL);
+}
+
+int main(int argc, char **argv)
+{
+	size_t count = 0;
+	int option = 0;
+
+	while ((option = getopt(argc, argv, "n:")) != -1) {
+		switch (option) {
+			case 'n':
+				count = strtoul(optarg, NULL, 10);
+				break;
+			default:
+				fprintf(stderr, "usage: %s [-n nodes]\n", argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+
+	printf("ns per node\n");
+	printf("%9s %9s %9s %9s %9s %9s\n", "nodes", "walk", "macro", "stack", "heap", "speedup");
+
+	if (count) {
+		bench_run(count);
+	} else {
+		for (size_t i = 0; i < sizeof(bench_suite) / sizeof(bench_suite[0]); i++) {
+			bench_run(bench_suite[i]);
+		}
+	}
+
+	return EXIT_SUCCESS;
+}
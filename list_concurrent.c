@@ -0,0 +1,401 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Copyright (c) 2015-2019 Sartura Ltd.
+ *
+ * Author: Domagoj Pintaric <domagoj.pintaric@sartura.hr>
+ *
+ * https://www.sartura.hr/
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "list_concurrent.h"
+
+#define LIST_CONCURRENT_CACHE_LINE 64
+
+struct list_concurrent_s {
+	list_concurrent_node_t *_Atomic head;
+	list_concurrent_node_t *_Atomic tail;
+	atomic_size_t size;
+	atomic_uint_fast64_t epoch;
+	void (*list_node_data_free_cb)(void *data);
+	// writer side, protected by writer_lock
+	pthread_mutex_t writer_lock;
+	list_concurrent_reader_t *readers;
+	list_concurrent_node_t *retired_head;
+};
+
+struct list_concurrent_node_s {
+	void *data;
+	list_concurrent_node_t *_Atomic next; // kept intact after removal so readers standing on the node can continue
+	list_concurrent_node_t *previous;	  // writer side only
+	list_concurrent_node_t *retired_next;
+	uint_fast64_t retired_epoch;
+};
+
+// aligned to a cache line, every reader only writes its own epoch
+struct list_concurrent_reader_s {
+	atomic_uint_fast64_t epoch; // 0 outside of a read side section
+	list_concurrent_t *list;
+	list_concurrent_reader_t *next;
+	unsigned int nesting;
+};
+
+static uint_fast64_t list_concurrent_epoch_min(list_concurrent_t *list)
+{
+	uint_fast64_t epoch_min = UINT_FAST64_MAX;
+
+	for (list_concurrent_reader_t *list_reader = list->readers; list_reader; list_reader = list_reader->next) {
+		uint_fast64_t epoch = atomic_load(&list_reader->epoch);
+		if (epoch != 0 && epoch < epoch_min) {
+			epoch_min = epoch;
+		}
+	}
+
+	return epoch_min;
+}
+
+// frees nodes retired before the oldest active reader entered, called with writer_lock held
+static size_t list_concurrent_reclaim(list_concurrent_t *list)
+{
+	uint_fast64_t epoch_min = list_concurrent_epoch_min(list);
+	list_concurrent_node_t **retired = &list->retired_head;
+	size_t pending = 0;
+
+	while (*retired) {
+		list_concurrent_node_t *list_node = *retired;
+
+		if (list_node->retired_epoch < epoch_min) {
+			*retired = list_node->retired_next;
+			if (list->list_node_data_free_cb) {
+				list->list_node_data_free_cb(list_node->data);
+			}
+			free(list_node);
+		} else {
+			retired = &list_node->retired_next;
+			pending++;
+		}
+	}
+
+	return pending;
+}
+
+list_rc list_concurrent_new(list_concurrent_t **list, void (*list_node_data_free_cb)(void *data))
+{
+	if (list == NULL) {
+		return LIST_FAILURE_ARGUMENTS;
+	}
+
+	*list = calloc(1, sizeof(list_concurrent_t));
+	if (*list == NULL) {
+		return LIST_FAILURE_MEMORY;
+	}
+
+	atomic_init(&(*list)->head, NULL);
+	atomic_init(&(*list)->tail, NULL);
+	atomic_init(&(*list)->size, 0);
+	atomic_init(&(*list)->epoch, 1);
+	(*list)->list_node_data_free_cb = list_node_data_free_cb;
+	(*list)->readers = NULL;
+	(*list)->retired_head = NULL;
+
+	if (pthread_mutex_init(&(*list)->writer_lock, NULL) != 0) {
+		free(*list);
+		*list = NULL;
+		return LIST_FAILURE_MEMORY;
+	}
+
+	return LIST_SUCCESS;
+}
+
+list_rc list_concurrent_destroy(list_concurrent_t *list)
+{
+	if (list == NULL) {
+		return LIST_FAILURE_ARGUMENTS;
+	}
+
+	list_concurrent_node_t *list_node = atomic_load(&list->head);
+	while (list_node) {
+		list_concurrent_node_t *list_node_next = atomic_load_explicit(&list_node->next, memory_order_relaxed);
+		if (list->list_node_data_free_cb) {
+			list->list_node_data_free_cb(list_node->data);
+		}
+		free(list_node);
+		list_node = list_node_next;
+	}
+
+	while (list->retired_head) {
+		list_node = list->retired_head;
+		list->retired_head = list_node->retired_next;
+		if (list->list_node_data_free_cb) {
+			list->list_node_data_free_cb(list_node->data);
+		}
+		free(list_node);
+	}
+
+	while (list->readers) {
+		list_concurrent_reader_t *list_reader = list->readers;
+		list->readers = list_reader->next;
+		free(list_reader);
+	}
+
+	pthread_mutex_destroy(&list->writer_lock);
+	free(list);
+
+	return LIST_SUCCESS;
+}
+
+list_rc list_concurrent_size_get(list_concurrent_t *list, size_t *size)
+{
+	if (list == NULL || size == NULL) {
+		return LIST_FAILURE_ARGUMENTS;
+	}
+
+	*size = atomic_load_explicit(&list->size, memory_order_relaxed);
+
+	return LIST_SUCCESS;
+}
+
+list_rc list_concurrent_insert(list_concurrent_t *list, list_opt opt, void *data, list_concurrent_node_t **list_node)
+{
+	if (list == NULL || (opt != LIST_OPT_HEAD && opt != LIST_OPT_TAIL) || data == NULL) {
+		return LIST_FAILURE_ARGUMENTS;
+	}
+
+	list_concurrent_node_t *list_node_new = calloc(1, sizeof(list_concurrent_node_t));
+	if (list_node_new == NULL) {
+		return LIST_FAILURE_MEMORY;
+	}
+
+	list_node_new->data = data;
+
+	pthread_mutex_lock(&list->writer_lock);
+
+	list_concurrent_node_t *head = atomic_load_explicit(&list->head, memory_order_relaxed);
+	list_concurrent_node_t *tail = atomic_load_explicit(&list->tail, memory_order_relaxed);
+
+	// the node is fully initialized before the release store makes it reachable for readers
+	switch (opt) {
+		case LIST_OPT_HEAD:
+			atomic_init(&list_node_new->next, head);
+			list_node_new->previous = NULL;
+			if (head) {
+				head->previous = list_node_new;
+			} else {
+				atomic_store_explicit(&list->tail, list_node_new, memory_order_release);
+			}
+			atomic_store_explicit(&list->head, list_node_new, memory_order_release);
+			break;
+		case LIST_OPT_TAIL:
+			atomic_init(&list_node_new->next, NULL);
+			list_node_new->previous = tail;
+			if (tail) {
+				atomic_store_explicit(&tail->next, list_node_new, memory_order_release);
+			} else {
+				atomic_store_explicit(&list->head, list_node_new, memory_order_release);
+			}
+			atomic_store_explicit(&list->tail, list_node_new, memory_order_release);
+			break;
+	}
+
+	atomic_fetch_add_explicit(&list->size, 1, memory_order_relaxed);
+
+	pthread_mutex_unlock(&list->writer_lock);
+
+	if (list_node) {
+		*list_node = list_node_new;
+	}
+
+	return LIST_SUCCESS;
+}
+
+list_rc list_concurrent_peek(list_concurrent_t *list, list_opt opt, list_concurrent_node_t **list_node)
+{
+	if (list == NULL || (opt != LIST_OPT_HEAD && opt != LIST_OPT_TAIL) || list_node == NULL) {
+		return LIST_FAILURE_ARGUMENTS;
+	}
+
+	*list_node = atomic_load_explicit(opt == LIST_OPT_HEAD ? &list->head : &list->tail, memory_order_acquire);
+	if (*list_node == NULL) {
+		return LIST_FAILURE_EMPTY;
+	}
+
+	return LIST_SUCCESS;
+}
+
+list_rc list_concurrent_remove(list_concurrent_t *list, list_concurrent_node_t *list_node)
+{
+	if (list == NULL || list_node == NULL) {
+		return LIST_FAILURE_ARGUMENTS;
+	}
+
+	pthread_mutex_lock(&list->writer_lock);
+
+	list_concurrent_node_t *list_node_next = atomic_load_explicit(&list_node->next, memory_order_relaxed);
+
+	// unlink from list, list_node->next stays valid for readers currently on list_node
+	if (list_node->previous != NULL) {
+		atomic_store_explicit(&list_node->previous->next, list_node_next, memory_order_release);
+	} else {
+		atomic_store_explicit(&list->head, list_node_next, memory_order_release);
+	}
+
+	if (list_node_next != NULL) {
+		list_node_next->previous = list_node->previous;
+	} else {
+		atomic_store_explicit(&list->tail, list_node->previous, memory_order_release);
+	}
+
+	atomic_fetch_sub_explicit(&list->size, 1, memory_order_relaxed);
+
+	// readers that enter from now on announce a newer epoch and can not reach list_node anymore
+	list_node->retired_epoch = atomic_fetch_add(&list->epoch, 1);
+	list_node->retired_next = list->retired_head;
+	list->retired_head = list_node;
+
+	list_concurrent_reclaim(list);
+
+	pthread_mutex_unlock(&list->writer_lock);
+
+	return LIST_SUCCESS;
+}
+
+list_rc list_concurrent_synchronize(list_concurrent_t *list)
+{
+	if (list == NULL) {
+		return LIST_FAILURE_ARGUMENTS;
+	}
+
+	pthread_mutex_lock(&list->writer_lock);
+	while (list_concurrent_reclaim(list) != 0) {
+		sched_yield();
+	}
+	pthread_mutex_unlock(&list->writer_lock);
+
+	return LIST_SUCCESS;
+}
+
+list_rc list_concurrent_node_data_get(list_concurrent_node_t *list_node, void **data)
+{
+	if (list_node == NULL || data == NULL) {
+		return LIST_FAILURE_ARGUMENTS;
+	}
+
+	*data = list_node->data;
+
+	return LIST_SUCCESS;
+}
+
+list_rc list_concurrent_reader_new(list_concurrent_t *list, list_concurrent_reader_t **list_reader)
+{
+	if (list == NULL || list_reader == NULL) {
+		return LIST_FAILURE_ARGUMENTS;
+	}
+
+	*list_reader = aligned_alloc(LIST_CONCURRENT_CACHE_LINE, LIST_CONCURRENT_CACHE_LINE);
+	if (*list_reader == NULL) {
+		return LIST_FAILURE_MEMORY;
+	}
+
+	atomic_init(&(*list_reader)->epoch, 0);
+	(*list_reader)->list = list;
+	(*list_reader)->nesting = 0;
+
+	pthread_mutex_lock(&list->writer_lock);
+	(*list_reader)->next = list->readers;
+	list->readers = *list_reader;
+	pthread_mutex_unlock(&list->writer_lock);
+
+	return LIST_SUCCESS;
+}
+
+list_rc list_concurrent_reader_destroy(list_concurrent_reader_t *list_reader)
+{
+	if (list_reader == NULL) {
+		return LIST_FAILURE_ARGUMENTS;
+	}
+
+	list_concurrent_t *list = list_reader->list;
+
+	pthread_mutex_lock(&list->writer_lock);
+	for (list_concurrent_reader_t **iterator = &list->readers; *iterator; iterator = &(*iterator)->next) {
+		if (*iterator == list_reader) {
+			*iterator = list_reader->next;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&list->writer_lock);
+
+	free(list_reader);
+
+	return LIST_SUCCESS;
+}
+
+list_rc list_concurrent_read_lock(list_concurrent_reader_t *list_reader)
+{
+	if (list_reader == NULL) {
+		return LIST_FAILURE_ARGUMENTS;
+	}
+
+	// nested sections keep the outermost epoch
+	if (list_reader->nesting++ > 0) {
+		return LIST_SUCCESS;
+	}
+
+	// seq_cst pairs with the epoch increment and reader scan in list_concurrent_remove()
+	atomic_store(&list_reader->epoch, atomic_load(&list_reader->list->epoch));
+	atomic_thread_fence(memory_order_seq_cst);
+
+	return LIST_SUCCESS;
+}
+
+list_rc list_concurrent_read_unlock(list_concurrent_reader_t *list_reader)
+{
+	if (list_reader == NULL || list_reader->nesting == 0) {
+		return LIST_FAILURE_ARGUMENTS;
+	}
+
+	if (--list_reader->nesting > 0) {
+		return LIST_SUCCESS;
+	}
+
+	atomic_store_explicit(&list_reader->epoch, 0, memory_order_release);
+
+	return LIST_SUCCESS;
+}
+
+list_rc list_concurrent_iterator_init(list_concurrent_t *list, list_concurrent_iterator_t *list_iterator)
+{
+	if (list == NULL || list_iterator == NULL) {
+		return LIST_FAILURE_ARGUMENTS;
+	}
+
+	list_iterator->list_node_current = atomic_load_explicit(&list->head, memory_order_acquire);
+	if (list_iterator->list_node_current == NULL) {
+		return LIST_FAILURE_EMPTY;
+	}
+
+	return LIST_SUCCESS;
+}
+
+list_rc list_concurrent_iterator_next(list_concurrent_iterator_t *list_iterator, list_concurrent_node_t **list_node_next)
+{
+	if (list_iterator == NULL || list_node_next == NULL) {
+		return LIST_FAILURE_ARGUMENTS;
+	}
+
+	*list_node_next = list_iterator->list_node_current;
+	if (*list_node_next == NULL) {
+		return LIST_ITERATOR_FAILURE_END;
+	}
+
+	list_iterator->list_node_current = atomic_load_explicit(&list_iterator->list_node_current->next, memory_order_acquire);
+
+	return LIST_SUCCESS;
+}
@@ -0,0 +1,56 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Copyright (c) 2015-2019 Sartura Ltd.
+ *
+ * Author: Domagoj Pintaric <domagoj.pintaric@sartura.hr>
+ *
+ * https://www.sartura.hr/
+ */
+
+#ifndef LIST_CONCURRENT_H_ONCE
+#define LIST_CONCURRENT_H_ONCE
+
+#include <stddef.h>
+
+#include "list.h"
+
+// concurrent list for read-mostly data shared between threads
+// - readers never lock, they enter a read side section with list_concurrent_read_lock() and walk from the head
+// - writers are serialized by an internal mutex
+// - removed nodes are freed (with their data) by writers once no reader can still reference them (epoch based reclamation)
+// - each reading thread needs its own reader, created once with list_concurrent_reader_new()
+
+typedef struct list_concurrent_s list_concurrent_t;
+typedef struct list_concurrent_node_s list_concurrent_node_t;
+typedef struct list_concurrent_reader_s list_concurrent_reader_t;
+typedef struct list_concurrent_iterator_s list_concurrent_iterator_t;
+
+// public so the iterator can live on the stack
+struct list_concurrent_iterator_s {
+	list_concurrent_node_t *list_node_current;
+};
+
+// list API
+list_rc list_concurrent_new(list_concurrent_t **list, void (*list_node_data_free_cb)(void *data));
+list_rc list_concurrent_destroy(list_concurrent_t *list); // no readers may be inside a read side section
+list_rc list_concurrent_size_get(list_concurrent_t *list, size_t *size);
+list_rc list_concurrent_insert(list_concurrent_t *list, list_opt opt, void *data, list_concurrent_node_t **list_node);
+list_rc list_concurrent_peek(list_concurrent_t *list, list_opt opt, list_concurrent_node_t **list_node); // read side
+list_rc list_concurrent_remove(list_concurrent_t *list, list_concurrent_node_t *list_node);
+list_rc list_concurrent_synchronize(list_concurrent_t *list); // waits until every removed node is freed
+
+// list node API
+list_rc list_concurrent_node_data_get(list_concurrent_node_t *list_node, void **data);
+
+// list reader API
+list_rc list_concurrent_reader_new(list_concurrent_t *list, list_concurrent_reader_t **list_reader);
+list_rc list_concurrent_reader_destroy(list_concurrent_reader_t *list_reader);
+list_rc list_concurrent_read_lock(list_concurrent_reader_t *list_reader);
+list_rc list_concurrent_read_unlock(list_concurrent_reader_t *list_reader);
+
+// list iterator API, read side, only from the head
+list_rc list_concurrent_iterator_init(list_concurrent_t *list, list_concurrent_iterator_t *list_iterator);
+list_rc list_concurrent_iterator_next(list_concurrent_iterator_t *list_iterator, list_concurrent_node_t **list_node_next);
+
+#endif /* LIST_CONCURRENT_H_ONCE */
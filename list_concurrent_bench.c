@@ -0,0 +1,249 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Copyright (c) 2019 Sartura Ltd.
+ *
+ * Author: Domagoj Pintaric <domagoj.pintaric@sartura.hr>
+ *
+ * https://www.sartura.hr/
+ */
+
+// read scaling benchmark for list_concurrent.h against a list_t behind a mutex
+// usage: list_concurrent_bench [-t readers] [-w writers] [-n size] [-d seconds]
+// - 1, 2, 4, ... readers up to the number of cpus (or -t readers), first without writers, then with -w writers (default 1)
+// - a read is one walk over the whole list, -n elements (default 64), inside one read side section or under the mutex
+// - every writer inserts a node at the tail and removes it again as fast as it can, the list keeps -n elements plus one per writer
+// - reads/s is the total over all readers, the writers are not counted, readers only scale while every thread has a cpu of its own
+// build: cc -O2 list_concurrent_bench.c list_concurrent.c list.c -lpthread
+
+#include <getopt.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "list.h"
+#include "list_concurrent.h"
+
+#define BENCH_SIZE_DEFAULT 64
+#define BENCH_DURATION_DEFAULT 1
+#define BENCH_WRITERS_DEFAULT 1
+
+typedef enum {
+	BENCH_LIST_MUTEX = 0,
+	BENCH_LIST_CONCURRENT,
+} bench_list;
+
+typedef struct {
+	bench_list type;
+	list_t *list;
+	pthread_mutex_t lock;
+	list_concurrent_t *list_concurrent;
+	pthread_barrier_t barrier;
+	atomic_bool stop;
+	atomic_size_t reads;
+} bench_t;
+
+static uint64_t bench_clock(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (uint64_t) now.tv_sec * 1000000000ULL + (uint64_t) now.tv_nsec;
+}
+
+// keeps the walk results alive
+static volatile uintptr_t bench_sink;
+
+static void *bench_reader_thread(void *arg)
+{
+	bench_t *bench = (bench_t *) arg;
+	list_concurrent_reader_t *list_reader = NULL;
+	list_concurrent_iterator_t list_iterator = {0};
+	list_concurrent_node_t *list_concurrent_node = NULL;
+	list_node_t *list_node = NULL;
+	size_t reads = 0;
+	uintptr_t sum = 0;
+	void *data = NULL;
+
+	if (bench->type == BENCH_LIST_CONCURRENT && list_concurrent_reader_new(bench->list_concurrent, &list_reader) != LIST_SUCCESS) {
+		fprintf(stderr, "unable to create a reader\n");
+		exit(EXIT_FAILURE);
+	}
+
+	pthread_barrier_wait(&bench->barrier);
+
+	while (!atomic_load_explicit(&bench->stop, memory_order_relaxed)) {
+		if (bench->type == BENCH_LIST_CONCURRENT) {
+			list_concurrent_read_lock(list_reader);
+			list_concurrent_iterator_init(bench->list_concurrent, &list_iterator);
+			while (list_concurrent_iterator_next(&list_iterator, &list_concurrent_node) == LIST_SUCCESS) {
+				list_concurrent_node_data_get(list_concurrent_node, &data);
+				sum += (uintptr_t) data;
+			}
+			list_concurrent_read_unlock(list_reader);
+		} else {
+			pthread_mutex_lock(&bench->lock);
+			LIST_FOREACH(bench->list, list_node)
+			{
+				sum += (uintptr_t) list_node->data;
+			}
+			pthread_mutex_unlock(&bench->lock);
+		}
+		reads++;
+	}
+
+	bench_sink = sum;
+	atomic_fetch_add(&bench->reads, reads);
+	if (list_reader) {
+		list_concurrent_reader_destroy(list_reader);
+	}
+
+	return NULL;
+}
+
+// only removes the node it inserted, so writers never race for the same node
+static void *bench_writer_thread(void *arg)
+{
+	bench_t *bench = (bench_t *) arg;
+	list_concurrent_node_t *list_concurrent_node = NULL;
+	list_node_t *list_node = NULL;
+
+	pthread_barrier_wait(&bench->barrier);
+
+	while (!atomic_load_explicit(&bench->stop, memory_order_relaxed)) {
+		if (bench->type == BENCH_LIST_CONCURRENT) {
+			list_concurrent_insert(bench->list_concurrent, LIST_OPT_TAIL, (void *) 1, &list_concurrent_node);
+			list_concurrent_remove(bench->list_concurrent, list_concurrent_node);
+		} else {
+			// allocated outside the lock, list_concurrent_insert() allocates before taking its writer lock as well
+			list_node_new(&list_node, (void *) 1);
+			pthread_mutex_lock(&bench->lock);
+			list_insert(bench->list, LIST_OPT_TAIL, list_node);
+			pthread_mutex_unlock(&bench->lock);
+			pthread_mutex_lock(&bench->lock);
+			list_remove(bench->list, list_node);
+			pthread_mutex_unlock(&bench->lock);
+			list_node_destroy(list_node, NULL);
+		}
+	}
+
+	return NULL;
+}
+
+// returns reads per second
+static double bench_run(bench_list type, size_t readers, size_t writers, size_t size, unsigned int duration)
+{
+	bench_t bench = {0};
+	pthread_t *threads = calloc(readers + writers, sizeof(pthread_t));
+	list_node_t *list_node = NULL;
+	uint64_t start = 0;
+
+	bench.type = type;
+	atomic_init(&bench.stop, false);
+	atomic_init(&bench.reads, 0);
+	pthread_mutex_init(&bench.lock, NULL);
+	pthread_barrier_init(&bench.barrier, NULL, (unsigned int) (readers + writers + 1));
+
+	if (type == BENCH_LIST_CONCURRENT) {
+		list_concurrent_new(&bench.list_concurrent, NULL);
+		for (size_t i = 0; i < size; i++) {
+			list_concurrent_insert(bench.list_concurrent, LIST_OPT_TAIL, (void *) (i + 1), NULL);
+		}
+	} else {
+		list_new(&bench.list);
+		for (size_t i = 0; i < size; i++) {
+			list_node_new(&list_node, (void *) (i + 1));
+			list_insert(bench.list, LIST_OPT_TAIL, list_node);
+		}
+	}
+
+	for (size_t i = 0; i < readers; i++) {
+		pthread_create(&threads[i], NULL, bench_reader_thread, &bench);
+	}
+	for (size_t i = 0; i < writers; i++) {
+		pthread_create(&threads[readers + i], NULL, bench_writer_thread, &bench);
+	}
+
+	pthread_barrier_wait(&bench.barrier);
+	start = bench_clock();
+	sleep(duration);
+	atomic_store(&bench.stop, true);
+
+	for (size_t i = 0; i < readers + writers; i++) {
+		pthread_join(threads[i], NULL);
+	}
+
+	uint64_t elapsed = bench_clock() - start;
+
+	if (type == BENCH_LIST_CONCURRENT) {
+		list_concurrent_destroy(bench.list_concurrent);
+	} else {
+		list_destroy_all(bench.list, NULL);
+	}
+	pthread_barrier_destroy(&bench.barrier);
+	pthread_mutex_destroy(&bench.lock);
+	free(threads);
+
+	return (double) atomic_load(&bench.reads) * 1e9 / (double) elapsed;
+}
+
+int main(int argc, char **argv)
+{
+	size_t readers_max = 0;
+	size_t writers = BENCH_WRITERS_DEFAULT;
+	size_t size = BENCH_SIZE_DEFAULT;
+	unsigned int duration = BENCH_DURATION_DEFAULT;
+	int option = 0;
+
+	while ((option = getopt(argc, argv, "t:w:n:d:")) != -1) {
+		switch (option) {
+			case 't':
+				readers_max = strtoul(optarg, NULL, 10);
+				break;
+			case 'w':
+				writers = strtoul(optarg, NULL, 10);
+				break;
+			case 'n':
+				size = strtoul(optarg, NULL, 10);
+				break;
+			case 'd':
+				duration = (unsigned int) strtoul(optarg, NULL, 10);
+				break;
+			default:
+				fprintf(stderr, "usage: %s [-t readers] [-w writers] [-n size] [-d seconds]\n", argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+
+	if (readers_max == 0) {
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		readers_max = cpus > 0 ? (size_t) cpus : 1;
+	}
+
+	printf("reads/s, one read walks %zu elements\n", size);
+	printf("%9s %9s %14s %14s %9s\n", "readers", "writers", "list_t+mutex", "concurrent", "speedup");
+
+	for (size_t w = 0; w < 2; w++) {
+		size_t run_writers = w ? writers : 0;
+
+		if (w && writers == 0) {
+			break;
+		}
+
+		// powers of two, and readers_max itself if it is not one
+		for (size_t readers = 1; readers <= readers_max; readers = readers * 2 > readers_max && readers < readers_max ? readers_max : readers * 2) {
+			double mutex = bench_run(BENCH_LIST_MUTEX, readers, run_writers, size, duration);
+			double concurrent = bench_run(BENCH_LIST_CONCURRENT, readers, run_writers, size, duration);
+
+			printf("%9zu %9zu %14.0f %14.0f %8.1fx\n", readers, run_writers, mutex, concurrent, concurrent / mutex);
+		}
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,330 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Copyright (c) 2019 Sartura Ltd.
+ *
+ * Author: Domagoj Pintaric <domagoj.pintaric@sartura.hr>
+ *
+ * https://www.sartura.hr/
+ */
+
+// stress test for list_concurrent.h, lock free readers walk the list while inserters and removers change it
+// usage: list_concurrent_stress [-r readers] [-i inserters] [-x removers] [-d seconds] [-n max_size]
+// - every item is poisoned by the free callback before it is freed, a reader that sees a poisoned item reports a use after free
+// - ThreadSanitizer reports readers racing with the free callback, AddressSanitizer reports reads of freed nodes and items
+// - at the end the list is checked against the counts of inserted and removed items, and every item has to be freed exactly once
+// exits with 1 on any failure
+// build: cc -O1 -g -fsanitize=thread list_concurrent_stress.c list_concurrent.c -lpthread
+//        cc -O1 -g -fsanitize=address,undefined list_concurrent_stress.c list_concurrent.c -lpthread
+
+#include <getopt.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "list_concurrent.h"
+
+#define STRESS_READERS_DEFAULT 4
+#define STRESS_INSERTERS_DEFAULT 2
+#define STRESS_REMOVERS_DEFAULT 2
+#define STRESS_DURATION_DEFAULT 5
+#define STRESS_SIZE_MAX_DEFAULT 1024
+
+#define STRESS_ITEM_LIVE 0x6c697665U
+#define STRESS_ITEM_FREED 0xdeadbeefU
+
+typedef struct {
+	atomic_uint state; // STRESS_ITEM_LIVE until the free callback runs
+	uint64_t id;
+} stress_item_t;
+
+// nodes that can still be removed, inserters push and removers take a random one
+typedef struct {
+	pthread_mutex_t lock;
+	list_concurrent_node_t **nodes;
+	size_t size;
+	size_t capacity;
+} stress_nodes_t;
+
+typedef struct {
+	list_concurrent_t *list;
+	stress_nodes_t nodes;
+	size_t size_max;
+	atomic_bool stop;
+	atomic_size_t inserted;
+	atomic_size_t removed;
+	atomic_size_t freed;
+	atomic_size_t reads;
+	atomic_size_t visited;
+	atomic_size_t failures;
+} stress_t;
+
+typedef struct {
+	stress_t *stress;
+	unsigned int seed;
+} stress_thread_t;
+
+static stress_t *stress_global; // for the free callback
+
+static void stress_item_free_cb(void *data)
+{
+	stress_item_t *item = (stress_item_t *) data;
+	unsigned int state = STRESS_ITEM_LIVE;
+
+	if (!atomic_compare_exchange_strong(&item->state, &state, STRESS_ITEM_FREED)) {
+		fprintf(stderr, "item %lu freed twice\n", (unsigned long) item->id);
+		atomic_fetch_add(&stress_global->failures, 1);
+		return;
+	}
+
+	atomic_fetch_add(&stress_global->freed, 1);
+	free(item);
+}
+
+static void *stress_reader_thread(void *arg)
+{
+	stress_thread_t *thread = (stress_thread_t *) arg;
+	stress_t *stress = thread->stress;
+	list_concurrent_reader_t *list_reader = NULL;
+	list_concurrent_iterator_t list_iterator = {0};
+	list_concurrent_node_t *list_node = NULL;
+	size_t reads = 0, visited = 0;
+
+	if (list_concurrent_reader_new(stress->list, &list_reader) != LIST_SUCCESS) {
+		atomic_fetch_add(&stress->failures, 1);
+		return NULL;
+	}
+
+	while (!atomic_load_explicit(&stress->stop, memory_order_relaxed)) {
+		list_concurrent_read_lock(list_reader);
+
+		// nested sections and peeks are part of the read side as well
+		if (reads % 16 == 0) {
+			list_concurrent_read_lock(list_reader);
+			if (list_concurrent_peek(stress->list, reads % 32 ? LIST_OPT_HEAD : LIST_OPT_TAIL, &list_node) == LIST_SUCCESS) {
+				stress_item_t *item = NULL;
+
+				list_concurrent_node_data_get(list_node, (void **) &item);
+				if (atomic_load_explicit(&item->state, memory_order_relaxed) != STRESS_ITEM_LIVE) {
+					fprintf(stderr, "reader saw freed item %lu through peek\n", (unsigned long) item->id);
+					atomic_fetch_add(&stress->failures, 1);
+				}
+			}
+			list_concurrent_read_unlock(list_reader);
+		}
+
+		if (list_concurrent_iterator_init(stress->list, &list_iterator) == LIST_SUCCESS) {
+			while (list_concurrent_iterator_next(&list_iterator, &list_node) == LIST_SUCCESS) {
+				stress_item_t *item = NULL;
+
+				list_concurrent_node_data_get(list_node, (void **) &item);
+				if (atomic_load_explicit(&item->state, memory_order_relaxed) != STRESS_ITEM_LIVE) {
+					fprintf(stderr, "reader saw freed item %lu\n", (unsigned long) item->id);
+					atomic_fetch_add(&stress->failures, 1);
+				}
+				visited++;
+			}
+		}
+
+		list_concurrent_read_unlock(list_reader);
+		reads++;
+	}
+
+	atomic_fetch_add(&stress->reads, reads);
+	atomic_fetch_add(&stress->visited, visited);
+	list_concurrent_reader_destroy(list_reader);
+
+	return NULL;
+}
+
+static void *stress_inserter_thread(void *arg)
+{
+	stress_thread_t *thread = (stress_thread_t *) arg;
+	stress_t *stress = thread->stress;
+	list_concurrent_node_t *list_node = NULL;
+	size_t size = 0;
+
+	while (!atomic_load_explicit(&stress->stop, memory_order_relaxed)) {
+		list_concurrent_size_get(stress->list, &size);
+		if (size >= stress->size_max) {
+			sched_yield();
+			continue;
+		}
+
+		stress_item_t *item = malloc(sizeof(stress_item_t));
+		atomic_init(&item->state, STRESS_ITEM_LIVE);
+		item->id = atomic_fetch_add(&stress->inserted, 1);
+
+		if (list_concurrent_insert(stress->list, rand_r(&thread->seed) % 2 ? LIST_OPT_HEAD : LIST_OPT_TAIL, item, &list_node) != LIST_SUCCESS) {
+			fprintf(stderr, "insert failed\n");
+			atomic_fetch_add(&stress->failures, 1);
+			free(item);
+			break;
+		}
+
+		pthread_mutex_lock(&stress->nodes.lock);
+		if (stress->nodes.size == stress->nodes.capacity) {
+			stress->nodes.capacity = stress->nodes.capacity ? stress->nodes.capacity * 2 : 1024;
+			stress->nodes.nodes = realloc(stress->nodes.nodes, stress->nodes.capacity * sizeof(list_concurrent_node_t *));
+		}
+		stress->nodes.nodes[stress->nodes.size++] = list_node;
+		pthread_mutex_unlock(&stress->nodes.lock);
+	}
+
+	return NULL;
+}
+
+static void *stress_remover_thread(void *arg)
+{
+	stress_thread_t *thread = (stress_thread_t *) arg;
+	stress_t *stress = thread->stress;
+
+	while (!atomic_load_explicit(&stress->stop, memory_order_relaxed)) {
+		list_concurrent_node_t *list_node = NULL;
+
+		// any node, not only the ends, so unlinking in the middle is covered
+		pthread_mutex_lock(&stress->nodes.lock);
+		if (stress->nodes.size) {
+			size_t index = (size_t) rand_r(&thread->seed) % stress->nodes.size;
+
+			list_node = stress->nodes.nodes[index];
+			stress->nodes.nodes[index] = stress->nodes.nodes[--stress->nodes.size];
+		}
+		pthread_mutex_unlock(&stress->nodes.lock);
+
+		if (list_node == NULL) {
+			sched_yield();
+			continue;
+		}
+
+		if (list_concurrent_remove(stress->list, list_node) != LIST_SUCCESS) {
+			fprintf(stderr, "remove failed\n");
+			atomic_fetch_add(&stress->failures, 1);
+			break;
+		}
+		atomic_fetch_add(&stress->removed, 1);
+
+		// a synchronize now and then, it has to wait for the readers instead of freeing under them
+		if (rand_r(&thread->seed) % 1024 == 0) {
+			list_concurrent_synchronize(stress->list);
+		}
+	}
+
+	return NULL;
+}
+
+static int stress_threads_start(stress_t *stress, pthread_t *threads, stress_thread_t *args, size_t count, void *(*start)(void *), size_t seed)
+{
+	for (size_t i = 0; i < count; i++) {
+		args[i].stress = stress;
+		args[i].seed = (unsigned int) (seed + i);
+		if (pthread_create(&threads[i], NULL, start, &args[i]) != 0) {
+			fprintf(stderr, "unable to start thread\n");
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	stress_t stress = {0};
+	size_t readers = STRESS_READERS_DEFAULT;
+	size_t inserters = STRESS_INSERTERS_DEFAULT;
+	size_t removers = STRESS_REMOVERS_DEFAULT;
+	unsigned int duration = STRESS_DURATION_DEFAULT;
+	list_concurrent_iterator_t list_iterator = {0};
+	list_concurrent_node_t *list_node = NULL;
+	size_t size = 0, count = 0;
+	int option = 0;
+
+	stress.size_max = STRESS_SIZE_MAX_DEFAULT;
+
+	while ((option = getopt(argc, argv, "r:i:x:d:n:")) != -1) {
+		switch (option) {
+			case 'r':
+				readers = strtoul(optarg, NULL, 10);
+				break;
+			case 'i':
+				inserters = strtoul(optarg, NULL, 10);
+				break;
+			case 'x':
+				removers = strtoul(optarg, NULL, 10);
+				break;
+			case 'd':
+				duration = (unsigned int) strtoul(optarg, NULL, 10);
+				break;
+			case 'n':
+				stress.size_max = strtoul(optarg, NULL, 10);
+				break;
+			default:
+				fprintf(stderr, "usage: %s [-r readers] [-i inserters] [-x removers] [-d seconds] [-n max_size]\n", argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+
+	size_t threads_count = readers + inserters + removers;
+	pthread_t *threads = calloc(threads_count ? threads_count : 1, sizeof(pthread_t));
+	stress_thread_t *args = calloc(threads_count ? threads_count : 1, sizeof(stress_thread_t));
+
+	stress_global = &stress;
+	pthread_mutex_init(&stress.nodes.lock, NULL);
+	if (list_concurrent_new(&stress.list, stress_item_free_cb) != LIST_SUCCESS) {
+		fprintf(stderr, "unable to create the list\n");
+		return EXIT_FAILURE;
+	}
+
+	if (stress_threads_start(&stress, threads, args, readers, stress_reader_thread, 1) != 0 ||
+		stress_threads_start(&stress, threads + readers, args + readers, inserters, stress_inserter_thread, 1000) != 0 ||
+		stress_threads_start(&stress, threads + readers + inserters, args + readers + inserters, removers, stress_remover_thread, 2000) != 0) {
+		return EXIT_FAILURE;
+	}
+
+	sleep(duration);
+	atomic_store(&stress.stop, true);
+	for (size_t i = 0; i < threads_count; i++) {
+		pthread_join(threads[i], NULL);
+	}
+
+	// every removed item is freed once no reader is left
+	list_concurrent_synchronize(stress.list);
+
+	size_t inserted = atomic_load(&stress.inserted);
+	size_t removed = atomic_load(&stress.removed);
+	size_t freed = atomic_load(&stress.freed);
+
+	list_concurrent_size_get(stress.list, &size);
+	if (list_concurrent_iterator_init(stress.list, &list_iterator) == LIST_SUCCESS) {
+		while (list_concurrent_iterator_next(&list_iterator, &list_node) == LIST_SUCCESS) {
+			count++;
+		}
+	}
+
+	if (size != inserted - removed || count != size || freed != removed) {
+		fprintf(stderr, "inserted %zu, removed %zu, freed %zu, size %zu, walked %zu\n", inserted, removed, freed, size, count);
+		atomic_fetch_add(&stress.failures, 1);
+	}
+
+	list_concurrent_destroy(stress.list);
+	if (atomic_load(&stress.freed) != inserted) {
+		fprintf(stderr, "%zu items freed after destroy, expected %zu\n", atomic_load(&stress.freed), inserted);
+		atomic_fetch_add(&stress.failures, 1);
+	}
+
+	printf("%zu readers, %zu inserters, %zu removers, %u s: %zu inserted, %zu removed, %zu reads, %zu nodes visited, %zu failures\n", readers,
+		   inserters, removers, duration, inserted, removed, atomic_load(&stress.reads), atomic_load(&stress.visited),
+		   atomic_load(&stress.failures));
+
+	pthread_mutex_destroy(&stress.nodes.lock);
+	free(stress.nodes.nodes);
+	free(threads);
+	free(args);
+
+	return atomic_load(&stress.failures) ? 1 : 0;
+}
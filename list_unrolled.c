@@ -0,0 +1,266 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Copyright (c) 2015-2019 Sartura Ltd.
+ *
+ * Author: Domagoj Pintaric <domagoj.pintaric@sartura.hr>
+ *
+ * https://www.sartura.hr/
+ */
+
+#include <stddef.h>
+#include <stdlib.h>
+
+#include "list_unrolled.h"
+
+struct list_unrolled_s {
+	size_t size;
+	list_unrolled_chunk_t *head;
+	list_unrolled_chunk_t *tail;
+	list_unrolled_chunk_t *spare; // last emptied chunk, avoids malloc/free ping-pong on a chunk boundary
+};
+
+// slots in [begin, end) are in use
+struct list_unrolled_chunk_s {
+	list_unrolled_chunk_t *next;
+	list_unrolled_chunk_t *previous;
+	unsigned int begin;
+	unsigned int end;
+	void *slots[LIST_UNROLLED_CHUNK_SLOTS];
+};
+
+static list_unrolled_chunk_t *list_unrolled_chunk_get(list_unrolled_t *list, list_opt opt)
+{
+	list_unrolled_chunk_t *chunk = NULL;
+
+	if (list->spare) {
+		chunk = list->spare;
+		list->spare = NULL;
+	} else {
+		chunk = malloc(sizeof(list_unrolled_chunk_t));
+		if (chunk == NULL) {
+			return NULL;
+		}
+	}
+
+	chunk->next = NULL;
+	chunk->previous = NULL;
+	// fill a head chunk from its end and a tail chunk from its start
+	chunk->begin = opt == LIST_OPT_HEAD ? LIST_UNROLLED_CHUNK_SLOTS : 0;
+	chunk->end = chunk->begin;
+
+	return chunk;
+}
+
+static void list_unrolled_chunk_put(list_unrolled_t *list, list_unrolled_chunk_t *chunk)
+{
+	if (list->spare) {
+		free(list->spare);
+	}
+
+	list->spare = chunk;
+}
+
+list_rc list_unrolled_new(list_unrolled_t **list)
+{
+	if (list == NULL) {
+		return LIST_FAILURE_ARGUMENTS;
+	}
+
+	*list = calloc(1, sizeof(list_unrolled_t));
+	if (*list == NULL) {
+		return LIST_FAILURE_MEMORY;
+	}
+
+	(*list)->size = 0;
+	(*list)->head = NULL;
+	(*list)->tail = NULL;
+	(*list)->spare = NULL;
+
+	return LIST_SUCCESS;
+}
+
+list_rc list_unrolled_destroy(list_unrolled_t *list)
+{
+	if (list == NULL) {
+		return LIST_FAILURE_ARGUMENTS;
+	}
+
+	list_unrolled_chunk_t *chunk = list->head;
+	while (chunk) {
+		list_unrolled_chunk_t *next = chunk->next;
+		free(chunk);
+		chunk = next;
+	}
+
+	free(list->spare);
+	free(list);
+
+	return LIST_SUCCESS;
+}
+
+list_rc list_unrolled_size_get(list_unrolled_t *list, size_t *size)
+{
+	if (list == NULL || size == NULL) {
+		return LIST_FAILURE_ARGUMENTS;
+	}
+
+	*size = list->size;
+
+	return LIST_SUCCESS;
+}
+
+list_rc list_unrolled_insert(list_unrolled_t *list, list_opt opt, void *data)
+{
+	if (list == NULL || (opt != LIST_OPT_HEAD && opt != LIST_OPT_TAIL) || data == NULL) {
+		return LIST_FAILURE_ARGUMENTS;
+	}
+
+	list_unrolled_chunk_t *chunk = opt == LIST_OPT_HEAD ? list->head : list->tail;
+
+	// list is empty or the end chunk is full
+	if (chunk == NULL || (opt == LIST_OPT_HEAD && chunk->begin == 0) || (opt == LIST_OPT_TAIL && chunk->end == LIST_UNROLLED_CHUNK_SLOTS)) {
+		list_unrolled_chunk_t *chunk_new = list_unrolled_chunk_get(list, opt);
+		if (chunk_new == NULL) {
+			return LIST_FAILURE_MEMORY;
+		}
+
+		if (chunk == NULL) {
+			list->head = chunk_new;
+			list->tail = chunk_new;
+		} else if (opt == LIST_OPT_HEAD) {
+			chunk_new->next = chunk;
+			chunk->previous = chunk_new;
+			list->head = chunk_new;
+		} else {
+			chunk_new->previous = chunk;
+			chunk->next = chunk_new;
+			list->tail = chunk_new;
+		}
+
+		chunk = chunk_new;
+	}
+
+	switch (opt) {
+		case LIST_OPT_HEAD:
+			chunk->slots[--chunk->begin] = data;
+			break;
+		case LIST_OPT_TAIL:
+			chunk->slots[chunk->end++] = data;
+			break;
+	}
+
+	list->size++;
+
+	return LIST_SUCCESS;
+}
+
+list_rc list_unrolled_peek(list_unrolled_t *list, list_opt opt, void **data)
+{
+	if (list == NULL || (opt != LIST_OPT_HEAD && opt != LIST_OPT_TAIL) || data == NULL) {
+		return LIST_FAILURE_ARGUMENTS;
+	}
+
+	if (list->size == 0) {
+		return LIST_FAILURE_EMPTY;
+	}
+
+	*data = opt == LIST_OPT_HEAD ? list->head->slots[list->head->begin] : list->tail->slots[list->tail->end - 1];
+
+	return LIST_SUCCESS;
+}
+
+list_rc list_unrolled_remove(list_unrolled_t *list, list_opt opt, void **data)
+{
+	if (list == NULL || (opt != LIST_OPT_HEAD && opt != LIST_OPT_TAIL) || data == NULL) {
+		return LIST_FAILURE_ARGUMENTS;
+	}
+
+	if (list->size == 0) {
+		return LIST_FAILURE_EMPTY;
+	}
+
+	list_unrolled_chunk_t *chunk = opt == LIST_OPT_HEAD ? list->head : list->tail;
+
+	switch (opt) {
+		case LIST_OPT_HEAD:
+			*data = chunk->slots[chunk->begin++];
+			break;
+		case LIST_OPT_TAIL:
+			*data = chunk->slots[--chunk->end];
+			break;
+	}
+
+	list->size--;
+
+	// unlink the emptied chunk
+	if (chunk->begin == chunk->end) {
+		if (chunk->previous != NULL) {
+			chunk->previous->next = chunk->next;
+		} else {
+			list->head = chunk->next;
+		}
+
+		if (chunk->next != NULL) {
+			chunk->next->previous = chunk->previous;
+		} else {
+			list->tail = chunk->previous;
+		}
+
+		list_unrolled_chunk_put(list, chunk);
+	}
+
+	return LIST_SUCCESS;
+}
+
+list_rc list_unrolled_iterator_init(list_unrolled_t *list, list_opt opt, list_unrolled_iterator_t *list_iterator)
+{
+	if (list == NULL || (opt != LIST_OPT_HEAD && opt != LIST_OPT_TAIL) || list_iterator == NULL) {
+		return LIST_FAILURE_ARGUMENTS;
+	}
+
+	list_iterator->opt = opt;
+	if (list->size == 0) {
+		list_iterator->chunk = NULL;
+		list_iterator->index = 0;
+		return LIST_FAILURE_EMPTY;
+	}
+
+	list_iterator->chunk = opt == LIST_OPT_HEAD ? list->head : list->tail;
+	list_iterator->index = opt == LIST_OPT_HEAD ? list->head->begin : list->tail->end - 1;
+
+	return LIST_SUCCESS;
+}
+
+list_rc list_unrolled_iterator_next(list_unrolled_iterator_t *list_iterator, void **data)
+{
+	if (list_iterator == NULL || data == NULL) {
+		return LIST_FAILURE_ARGUMENTS;
+	}
+
+	list_unrolled_chunk_t *chunk = list_iterator->chunk;
+	if (chunk == NULL) {
+		*data = NULL;
+		return LIST_ITERATOR_FAILURE_END;
+	}
+
+	*data = chunk->slots[list_iterator->index];
+
+	if (list_iterator->opt == LIST_OPT_HEAD) {
+		if (list_iterator->index + 1 < chunk->end) {
+			list_iterator->index++;
+		} else {
+			list_iterator->chunk = chunk->next;
+			list_iterator->index = chunk->next ? chunk->next->begin : 0;
+		}
+	} else {
+		if (list_iterator->index > chunk->begin) {
+			list_iterator->index--;
+		} else {
+			list_iterator->chunk = chunk->previous;
+			list_iterator->index = chunk->previous ? chunk->previous->end - 1 : 0;
+		}
+	}
+
+	return LIST_SUCCESS;
+}
@@ -0,0 +1,49 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Copyright (c) 2015-2019 Sartura Ltd.
+ *
+ * Author: Domagoj Pintaric <domagoj.pintaric@sartura.hr>
+ *
+ * https://www.sartura.hr/
+ */
+
+#ifndef LIST_UNROLLED_H_ONCE
+#define LIST_UNROLLED_H_ONCE
+
+#include <stddef.h>
+
+#include "list.h"
+
+// unrolled list: a deque of data pointers stored in fixed-size chunks
+// - one allocation per LIST_UNROLLED_CHUNK_SLOTS elements instead of one per element
+// - O(1) insert, peek and remove at both ends
+// - uses list_rc and list_opt from list.h, data pointers are passed directly instead of through nodes
+
+typedef struct list_unrolled_s list_unrolled_t;
+typedef struct list_unrolled_chunk_s list_unrolled_chunk_t;
+typedef struct list_unrolled_iterator_s list_unrolled_iterator_t;
+
+// slots per chunk, sized so that a chunk is 512 bytes on 64-bit platforms
+#define LIST_UNROLLED_CHUNK_SLOTS 61
+
+// public so the iterator can live on the stack
+struct list_unrolled_iterator_s {
+	list_unrolled_chunk_t *chunk;
+	size_t index;
+	list_opt opt;
+};
+
+// list API
+list_rc list_unrolled_new(list_unrolled_t **list);
+list_rc list_unrolled_destroy(list_unrolled_t *list);
+list_rc list_unrolled_size_get(list_unrolled_t *list, size_t *size);
+list_rc list_unrolled_insert(list_unrolled_t *list, list_opt opt, void *data);
+list_rc list_unrolled_peek(list_unrolled_t *list, list_opt opt, void **data);
+list_rc list_unrolled_remove(list_unrolled_t *list, list_opt opt, void **data);
+
+// list iterator API
+list_rc list_unrolled_iterator_init(list_unrolled_t *list, list_opt opt, list_unrolled_iterator_t *list_iterator);
+list_rc list_unrolled_iterator_next(list_unrolled_iterator_t *list_iterator, void **data);
+
+#endif /* LIST_UNROLLED_H_ONCE */
@@ -0,0 +1,195 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Copyright (c) 2019 Sartura Ltd.
+ *
+ * Author: Domagoj Pintaric <domagoj.pintaric@sartura.hr>
+ *
+ * https://www.sartura.hr/
+ */
+
+// benchmark for list_unrolled.h against list_t
+// usage: list_unrolled_bench [-n elements]
+// - 1k, 1M and 10M elements (or -n elements) are pushed to the tail, scanned from the head and popped from the head (fifo),
+//   then pushed to the head and popped from the head again (lifo)
+// - list_t is scanned with LIST_FOREACH, the cheapest way to walk it, the unrolled list with its iterator
+// - list_t nodes come from a fresh heap and end up mostly adjacent, so its scan is a best case, long lived lists scatter them
+// - small sizes are repeated so every measurement covers at least 10M elements
+// build: cc -O2 list_unrolled_bench.c list_unrolled.c list.c
+
+#include <getopt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "list.h"
+#include "list_unrolled.h"
+
+#define BENCH_ELEMENTS_MIN 10000000
+
+typedef struct {
+	double push;
+	double scan;
+	double pop;
+	double push_pop; // lifo
+} bench_result_t;
+
+static const size_t bench_suite[] = {1000, 1000000, 10000000};
+
+static uint64_t bench_clock(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (uint64_t) now.tv_sec * 1000000000ULL + (uint64_t) now.tv_nsec;
+}
+
+// keeps the scan results alive
+static volatile uintptr_t bench_sink;
+
+static void bench_list(size_t count, size_t repeat, bench_result_t *result)
+{
+	list_t *list = NULL;
+	list_node_t *list_node = NULL;
+	uint64_t push = 0, scan = 0, pop = 0, push_pop = 0, start = 0;
+	uintptr_t sum = 0;
+
+	list_new(&list);
+
+	for (size_t r = 0; r < repeat; r++) {
+		start = bench_clock();
+		for (size_t i = 0; i < count; i++) {
+			list_node_new(&list_node, (void *) (i + 1));
+			list_insert(list, LIST_OPT_TAIL, list_node);
+		}
+		push += bench_clock() - start;
+
+		start = bench_clock();
+		LIST_FOREACH(list, list_node)
+		{
+			sum += (uintptr_t) list_node->data;
+		}
+		scan += bench_clock() - start;
+
+		start = bench_clock();
+		while (list_peek(list, LIST_OPT_HEAD, &list_node) == LIST_SUCCESS) {
+			list_remove(list, list_node);
+			list_node_destroy(list_node, NULL);
+		}
+		pop += bench_clock() - start;
+
+		start = bench_clock();
+		for (size_t i = 0; i < count; i++) {
+			list_node_new(&list_node, (void *) (i + 1));
+			list_insert(list, LIST_OPT_HEAD, list_node);
+		}
+		while (list_peek(list, LIST_OPT_HEAD, &list_node) == LIST_SUCCESS) {
+			list_remove(list, list_node);
+			list_node_destroy(list_node, NULL);
+		}
+		push_pop += bench_clock() - start;
+	}
+
+	bench_sink = sum;
+	list_destroy(list);
+
+	double elements = (double) count * (double) repeat;
+	result->push = (double) push / elements;
+	result->scan = (double) scan / elements;
+	result->pop = (double) pop / elements;
+	result->push_pop = (double) push_pop / elements;
+}
+
+static void bench_list_unrolled(size_t count, size_t repeat, bench_result_t *result)
+{
+	list_unrolled_t *list = NULL;
+	list_unrolled_iterator_t list_iterator = {0};
+	uint64_t push = 0, scan = 0, pop = 0, push_pop = 0, start = 0;
+	uintptr_t sum = 0;
+	void *data = NULL;
+
+	list_unrolled_new(&list);
+
+	for (size_t r = 0; r < repeat; r++) {
+		start = bench_clock();
+		for (size_t i = 0; i < count; i++) {
+			list_unrolled_insert(list, LIST_OPT_TAIL, (void *) (i + 1));
+		}
+		push += bench_clock() - start;
+
+		start = bench_clock();
+		list_unrolled_iterator_init(list, LIST_OPT_HEAD, &list_iterator);
+		while (list_unrolled_iterator_next(&list_iterator, &data) == LIST_SUCCESS) {
+			sum += (uintptr_t) data;
+		}
+		scan += bench_clock() - start;
+
+		start = bench_clock();
+		while (list_unrolled_remove(list, LIST_OPT_HEAD, &data) == LIST_SUCCESS) {
+		}
+		pop += bench_clock() - start;
+
+		start = bench_clock();
+		for (size_t i = 0; i < count; i++) {
+			list_unrolled_insert(list, LIST_OPT_HEAD, (void *) (i + 1));
+		}
+		while (list_unrolled_remove(list, LIST_OPT_HEAD, &data) == LIST_SUCCESS) {
+		}
+		push_pop += bench_clock() - start;
+	}
+
+	bench_sink = sum;
+	list_unrolled_destroy(list);
+
+	double elements = (double) count * (double) repeat;
+	result->push = (double) push / elements;
+	result->scan = (double) scan / elements;
+	result->pop = (double) pop / elements;
+	result->push_pop = (double) push_pop / elements;
+}
+
+static void bench_run(size_t count)
+{
+	size_t repeat = count < BENCH_ELEMENTS_MIN ? BENCH_ELEMENTS_MIN / count : 1;
+	bench_result_t list = {0}, unrolled = {0};
+
+	bench_list(count, repeat, &list);
+	bench_list_unrolled(count, repeat, &unrolled);
+
+	printf("%9zu %9s %9.2f %9.2f %9.2f %9.2f\n", count, "list_t", list.push, list.scan, list.pop, list.push_pop);
+	printf("%9s %9s %9.2f %9.2f %9.2f %9.2f\n", "", "unrolled", unrolled.push, unrolled.scan, unrolled.pop, unrolled.push_pop);
+	printf("%9s %9s %8.1fx %8.1fx %8.1fx %8.1fx\n", "", "speedup", list.push / unrolled.push, list.scan / unrolled.scan, list.pop / unrolled.pop,
+		   list.push_pop / unrolled.push_pop);
+}
+
+int main(int argc, char **argv)
+{
+	size_t count = 0;
+	int option = 0;
+
+	while ((option = getopt(argc, argv, "n:")) != -1) {
+		switch (option) {
+			case 'n':
+				count = strtoul(optarg, NULL, 10);
+				break;
+			default:
+				fprintf(stderr, "usage: %s [-n elements]\n", argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+
+	printf("ns per element\n");
+	printf("%9s %9s %9s %9s %9s %9s\n", "elements", "list", "push", "scan", "pop", "push+pop");
+
+	if (count) {
+		bench_run(count);
+	} else {
+		for (size_t i = 0; i < sizeof(bench_suite) / sizeof(bench_suite[0]); i++) {
+			bench_run(bench_suite[i]);
+		}
+	}
+
+	return EXIT_SUCCESS;
+}
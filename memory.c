@@ -8,10 +8,99 @@
  * https://www.sartura.hr/
  */
 
+#include <pthread.h>
+#include <stdalign.h>
+#include <stdint.h>
 #include <string.h>
 
+#define MEMORY_PROFILE_INTERNAL
 #include "memory.h"
 
+#ifdef MEMORY_PROFILE
+#include <stdatomic.h>
+
+#define XMEMORY_PROFILE_SITES 4096 // power of two, allocations from further call sites are accounted to one overflow site
+#define XMEMORY_PROFILE_SIZE_CLASSES 65
+#define XMEMORY_PROFILE_MAGIC 0x70726f66696c6521ULL
+
+typedef struct {
+	atomic_int state; // 0 free, 1 being claimed, 2 ready
+	const char *file;
+	int line;
+	atomic_size_t count;
+	atomic_size_t bytes;
+	atomic_size_t bytes_live;
+	atomic_size_t bytes_peak;
+} xmemory_profile_site_t;
+
+// prepended to every profiled allocation, keeps max_align_t alignment of the returned pointer
+typedef struct {
+	alignas(max_align_t) size_t size;
+	xmemory_profile_site_t *site;
+	uint64_t magic;
+} xmemory_profile_header_t;
+
+static xmemory_profile_site_t xmemory_profile_sites[XMEMORY_PROFILE_SITES];
+static xmemory_profile_site_t xmemory_profile_site_overflow = {.state = 2, .file = "(other)", .line = 0};
+static atomic_size_t xmemory_profile_size_classes[XMEMORY_PROFILE_SIZE_CLASSES];
+static pthread_once_t xmemory_profile_once = PTHREAD_ONCE_INIT;
+#endif
+
+#define XARENA_CHUNK_SIZE_DEFAULT 4096
+#define XARENA_CHUNK_SIZE_MAX (1024 * 1024)
+
+#define XBUFFER_CAPACITY_MIN 64
+
+#define XPOOL_SLAB_OBJECTS_DEFAULT 256
+#define XPOOL_MAGAZINE_SIZE 64 // objects cached per thread, half of it is moved on refill/flush
+
+typedef struct xpool_object_s xpool_object_t;
+typedef struct xpool_slab_s xpool_slab_t;
+typedef struct xpool_magazine_s xpool_magazine_t;
+
+struct xarena_chunk_s {
+	xarena_chunk_t *next;
+	size_t size;
+	size_t offset;
+	alignas(max_align_t) unsigned char data[];
+};
+
+struct xarena_s {
+	xarena_chunk_t *head;
+	xarena_chunk_t *current;
+	size_t chunk_size; // size of the next chunk, doubles up to XARENA_CHUNK_SIZE_MAX
+};
+
+// free objects store the free list link in their first bytes
+struct xpool_object_s {
+	xpool_object_t *next;
+};
+
+struct xpool_slab_s {
+	xpool_slab_t *next;
+	alignas(max_align_t) unsigned char data[];
+};
+
+struct xpool_magazine_s {
+	xpool_t *pool;
+	xpool_magazine_t *next;
+	xpool_magazine_t *previous;
+	size_t count;
+	void *objects[XPOOL_MAGAZINE_SIZE];
+};
+
+struct xpool_s {
+	size_t object_size;
+	size_t slab_objects;
+	int opts;
+	pthread_key_t magazine_key;
+	// protected by lock
+	pthread_mutex_t lock;
+	xpool_object_t *free_list;
+	xpool_slab_t *slabs;
+	xpool_magazine_t *magazines;
+};
+
 void *xmalloc(size_t size)
 {
 	void *res;
@@ -63,3 +152,594 @@ char *xstrdup(const char *s)
 
 	return res;
 }
+
+static xarena_chunk_t *xarena_chunk_new(size_t size)
+{
+	xarena_chunk_t *chunk;
+
+	chunk = xmalloc(sizeof(xarena_chunk_t) + size);
+	chunk->next = NULL;
+	chunk->size = size;
+	chunk->offset = 0;
+
+	return chunk;
+}
+
+static void *xarena_chunk_alloc(xarena_chunk_t *chunk, size_t size, size_t alignment)
+{
+	uintptr_t base = (uintptr_t) chunk->data;
+	size_t offset = ((base + chunk->offset + alignment - 1) & ~(uintptr_t) (alignment - 1)) - base;
+
+	if (offset > chunk->size || chunk->size - offset < size) {
+		return NULL;
+	}
+
+	chunk->offset = offset + size;
+
+	return chunk->data + offset;
+}
+
+xarena_t *xarena_new(size_t chunk_size)
+{
+	xarena_t *arena;
+
+	arena = xmalloc(sizeof(xarena_t));
+	arena->chunk_size = chunk_size ? chunk_size : XARENA_CHUNK_SIZE_DEFAULT;
+	arena->head = xarena_chunk_new(arena->chunk_size);
+	arena->current = arena->head;
+
+	return arena;
+}
+
+void *xarena_alloc(xarena_t *arena, size_t size)
+{
+	return xarena_alloc_aligned(arena, size, alignof(max_align_t));
+}
+
+void *xarena_alloc_aligned(xarena_t *arena, size_t size, size_t alignment)
+{
+	void *res;
+
+	if (alignment == 0 || (alignment & (alignment - 1)) != 0) {
+		abort();
+	}
+
+	res = xarena_chunk_alloc(arena->current, size, alignment);
+	if (res) {
+		return res;
+	}
+
+	// reuse chunks kept by a previous reset/rewind
+	while (arena->current->next) {
+		arena->current = arena->current->next;
+		arena->current->offset = 0;
+
+		res = xarena_chunk_alloc(arena->current, size, alignment);
+		if (res) {
+			return res;
+		}
+	}
+
+	if (size > SIZE_MAX - alignment - sizeof(xarena_chunk_t)) {
+		abort();
+	}
+
+	size_t chunk_size = arena->chunk_size;
+	if (chunk_size < size + alignment) {
+		chunk_size = size + alignment;
+	}
+
+	if (arena->chunk_size < XARENA_CHUNK_SIZE_MAX) {
+		arena->chunk_size *= 2;
+	}
+
+	xarena_chunk_t *chunk = xarena_chunk_new(chunk_size);
+	arena->current->next = chunk;
+	arena->current = chunk;
+
+	return xarena_chunk_alloc(chunk, size, alignment);
+}
+
+char *xarena_strdup(xarena_t *arena, const char *s)
+{
+	char *res;
+	size_t size = strlen(s) + 1;
+
+	res = xarena_alloc_aligned(arena, size, 1);
+	memcpy(res, s, size);
+
+	return res;
+}
+
+xarena_mark_t xarena_mark(xarena_t *arena)
+{
+	return (xarena_mark_t){.chunk = arena->current, .offset = arena->current->offset};
+}
+
+void xarena_rewind(xarena_t *arena, xarena_mark_t mark)
+{
+	arena->current = mark.chunk;
+	arena->current->offset = mark.offset;
+}
+
+void xarena_reset(xarena_t *arena)
+{
+	arena->current = arena->head;
+	arena->current->offset = 0;
+}
+
+void xarena_destroy(xarena_t *arena)
+{
+	xarena_chunk_t *chunk = arena->head;
+
+	while (chunk) {
+		xarena_chunk_t *next = chunk->next;
+		free(chunk);
+		chunk = next;
+	}
+
+	free(arena);
+}
+
+// move up to count objects from the shared free list into the magazine, called with pool->lock held
+static void xpool_magazine_refill(xpool_t *pool, xpool_magazine_t *magazine, size_t count)
+{
+	if (pool->free_list == NULL) {
+		xpool_slab_t *slab = xmalloc(sizeof(xpool_slab_t) + pool->object_size * pool->slab_objects);
+		slab->next = pool->slabs;
+		pool->slabs = slab;
+
+		for (size_t i = pool->slab_objects; i > 0; i--) {
+			xpool_object_t *object = (xpool_object_t *) (slab->data + (i - 1) * pool->object_size);
+			object->next = pool->free_list;
+			pool->free_list = object;
+		}
+	}
+
+	while (count > 0 && pool->free_list) {
+		magazine->objects[magazine->count++] = pool->free_list;
+		pool->free_list = pool->free_list->next;
+		count--;
+	}
+}
+
+// move count objects from the magazine to the shared free list, called with pool->lock held
+static void xpool_magazine_flush(xpool_t *pool, xpool_magazine_t *magazine, size_t count)
+{
+	while (count > 0 && magazine->count > 0) {
+		xpool_object_t *object = magazine->objects[--magazine->count];
+		object->next = pool->free_list;
+		pool->free_list = object;
+		count--;
+	}
+}
+
+// thread exit, hand the cached objects back to the pool
+static void xpool_magazine_destroy(void *data)
+{
+	xpool_magazine_t *magazine = data;
+	xpool_t *pool = magazine->pool;
+
+	pthread_mutex_lock(&pool->lock);
+	xpool_magazine_flush(pool, magazine, magazine->count);
+	if (magazine->previous) {
+		magazine->previous->next = magazine->next;
+	} else {
+		pool->magazines = magazine->next;
+	}
+	if (magazine->next) {
+		magazine->next->previous = magazine->previous;
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	free(magazine);
+}
+
+static xpool_magazine_t *xpool_magazine_get(xpool_t *pool)
+{
+	xpool_magazine_t *magazine = pthread_getspecific(pool->magazine_key);
+
+	if (magazine) {
+		return magazine;
+	}
+
+	magazine = xcalloc(1, sizeof(xpool_magazine_t));
+	magazine->pool = pool;
+
+	pthread_mutex_lock(&pool->lock);
+	magazine->next = pool->magazines;
+	if (pool->magazines) {
+		pool->magazines->previous = magazine;
+	}
+	pool->magazines = magazine;
+	pthread_mutex_unlock(&pool->lock);
+
+	if (pthread_setspecific(pool->magazine_key, magazine) != 0) {
+		abort();
+	}
+
+	return magazine;
+}
+
+xpool_t *xpool_new(size_t object_size, size_t slab_objects, int opts)
+{
+	xpool_t *pool;
+	size_t alignment = alignof(max_align_t);
+
+	if (object_size < sizeof(xpool_object_t)) {
+		object_size = sizeof(xpool_object_t);
+	}
+
+	pool = xcalloc(1, sizeof(xpool_t));
+	pool->object_size = (object_size + alignment - 1) & ~(alignment - 1);
+	pool->slab_objects = slab_objects ? slab_objects : XPOOL_SLAB_OBJECTS_DEFAULT;
+	pool->opts = opts;
+
+	if (pool->slab_objects > (SIZE_MAX - sizeof(xpool_slab_t)) / pool->object_size) {
+		abort();
+	}
+
+	if (pthread_mutex_init(&pool->lock, NULL) != 0 || pthread_key_create(&pool->magazine_key, xpool_magazine_destroy) != 0) {
+		abort();
+	}
+
+	return pool;
+}
+
+void *xpool_get(xpool_t *pool)
+{
+	xpool_magazine_t *magazine = xpool_magazine_get(pool);
+
+	if (magazine->count == 0) {
+		pthread_mutex_lock(&pool->lock);
+		xpool_magazine_refill(pool, magazine, XPOOL_MAGAZINE_SIZE / 2);
+		pthread_mutex_unlock(&pool->lock);
+	}
+
+	void *res = magazine->objects[--magazine->count];
+
+	if (pool->opts & XPOOL_OPT_ZERO) {
+		memset(res, 0, pool->object_size);
+	}
+
+	return res;
+}
+
+void xpool_put(xpool_t *pool, void *object)
+{
+	if (object == NULL) {
+		return;
+	}
+
+	xpool_magazine_t *magazine = xpool_magazine_get(pool);
+
+	if (magazine->count == XPOOL_MAGAZINE_SIZE) {
+		pthread_mutex_lock(&pool->lock);
+		xpool_magazine_flush(pool, magazine, XPOOL_MAGAZINE_SIZE / 2);
+		pthread_mutex_unlock(&pool->lock);
+	}
+
+	magazine->objects[magazine->count++] = object;
+}
+
+void xpool_destroy(xpool_t *pool)
+{
+	// no destructors run for a deleted key, magazines of all threads are freed here
+	pthread_key_delete(pool->magazine_key);
+
+	while (pool->magazines) {
+		xpool_magazine_t *magazine = pool->magazines;
+		pool->magazines = magazine->next;
+		free(magazine);
+	}
+
+	while (pool->slabs) {
+		xpool_slab_t *slab = pool->slabs;
+		pool->slabs = slab->next;
+		free(slab);
+	}
+
+	pthread_mutex_destroy(&pool->lock);
+	free(pool);
+}
+
+void xbuffer_init(xbuffer_t *buffer)
+{
+	buffer->data = NULL;
+	buffer->offset = 0;
+	buffer->size = 0;
+	buffer->capacity = 0;
+}
+
+void xbuffer_free(xbuffer_t *buffer)
+{
+	FREE_SAFE(buffer->data);
+	xbuffer_init(buffer);
+}
+
+void xbuffer_reserve(xbuffer_t *buffer, size_t size)
+{
+	if (buffer->capacity - buffer->size >= size) {
+		return;
+	}
+
+	size_t used = buffer->size - buffer->offset;
+
+	if (size > SIZE_MAX - used) {
+		abort();
+	}
+
+	// moving the unconsumed data to the front is enough, and cheap if the consumed part is the larger one
+	if (buffer->capacity - used >= size && buffer->offset >= used) {
+		memmove(buffer->data, buffer->data + buffer->offset, used);
+		buffer->offset = 0;
+		buffer->size = used;
+		return;
+	}
+
+	size_t capacity = buffer->capacity ? buffer->capacity : XBUFFER_CAPACITY_MIN;
+	while (capacity - buffer->size < size) {
+		if (capacity > SIZE_MAX / 2) {
+			capacity = buffer->size + size;
+			break;
+		}
+		capacity *= 2;
+	}
+
+	buffer->data = xrealloc(buffer->data, capacity);
+	buffer->capacity = capacity;
+}
+
+void xbuffer_append(xbuffer_t *buffer, const void *data, size_t size)
+{
+	if (size == 0) {
+		return;
+	}
+
+	xbuffer_reserve(buffer, size);
+	memcpy(buffer->data + buffer->size, data, size);
+	buffer->size += size;
+}
+
+void xbuffer_consume(xbuffer_t *buffer, size_t size)
+{
+	if (size >= buffer->size - buffer->offset) {
+		buffer->offset = 0;
+		buffer->size = 0;
+		return;
+	}
+
+	buffer->offset += size;
+}
+
+xbuffer_slice_t xbuffer_slice(const xbuffer_t *buffer, size_t offset, size_t size)
+{
+	size_t used = buffer->size - buffer->offset;
+
+	if (offset > used) {
+		offset = used;
+	}
+
+	if (size > used - offset) {
+		size = used - offset;
+	}
+
+	return (xbuffer_slice_t){.data = buffer->data ? buffer->data + buffer->offset + offset : NULL, .size = size};
+}
+
+size_t xbuffer_write_cb(char *ptr, size_t size, size_t nmemb, void *userdata)
+{
+	if (nmemb != 0 && size > SIZE_MAX / nmemb) {
+		return 0;
+	}
+
+	xbuffer_append((xbuffer_t *) userdata, ptr, size * nmemb);
+
+	return size * nmemb;
+}
+
+#ifdef MEMORY_PROFILE
+static void xmemory_profile_report_atexit(void)
+{
+	xmemory_profile_report(stderr);
+}
+
+static void xmemory_profile_init(void)
+{
+	atexit(xmemory_profile_report_atexit);
+}
+
+static xmemory_profile_site_t *xmemory_profile_site_get(const char *file, int line)
+{
+	uint64_t hash = ((uint64_t) (uintptr_t) file ^ ((uint64_t) line << 32)) * 0x9e3779b97f4a7c15ULL;
+	size_t mask = XMEMORY_PROFILE_SITES - 1;
+
+	for (size_t i = (hash >> 32) & mask, probes = 0; probes < XMEMORY_PROFILE_SITES; i = (i + 1) & mask, probes++) {
+		xmemory_profile_site_t *site = &xmemory_profile_sites[i];
+		int state = atomic_load_explicit(&site->state, memory_order_acquire);
+
+		if (state == 0) {
+			if (atomic_compare_exchange_strong_explicit(&site->state, &state, 1, memory_order_acquire, memory_order_acquire)) {
+				site->file = file;
+				site->line = line;
+				atomic_store_explicit(&site->state, 2, memory_order_release);
+				pthread_once(&xmemory_profile_once, xmemory_profile_init);
+				return site;
+			}
+		}
+
+		// another thread is claiming this slot, wait for its key
+		while (state == 1) {
+			state = atomic_load_explicit(&site->state, memory_order_acquire);
+		}
+
+		if (site->file == file && site->line == line) {
+			return site;
+		}
+	}
+
+	return &xmemory_profile_site_overflow;
+}
+
+static void xmemory_profile_record(xmemory_profile_site_t *site, size_t size)
+{
+	size_t size_class = size ? 64 - (size_t) __builtin_clzll((unsigned long long) size) : 0;
+
+	atomic_fetch_add_explicit(&xmemory_profile_size_classes[size_class], 1, memory_order_relaxed);
+	atomic_fetch_add_explicit(&site->count, 1, memory_order_relaxed);
+	atomic_fetch_add_explicit(&site->bytes, size, memory_order_relaxed);
+
+	size_t bytes_live = atomic_fetch_add_explicit(&site->bytes_live, size, memory_order_relaxed) + size;
+	size_t bytes_peak = atomic_load_explicit(&site->bytes_peak, memory_order_relaxed);
+	while (bytes_live > bytes_peak &&
+		   !atomic_compare_exchange_weak_explicit(&site->bytes_peak, &bytes_peak, bytes_live, memory_order_relaxed, memory_order_relaxed)) {
+	}
+}
+
+// xfree() and xrealloc() only take memory from the profiled allocators, there is no way to tell other memory apart
+// without reading in front of it, so a missing magic (foreign pointer, double free) is a bug and aborts
+static xmemory_profile_header_t *xmemory_profile_header_get(void *ptr)
+{
+	xmemory_profile_header_t *header = (xmemory_profile_header_t *) ptr - 1;
+
+	if (header->magic != XMEMORY_PROFILE_MAGIC) {
+		abort();
+	}
+
+	return header;
+}
+
+static void *xmemory_profile_header_init(xmemory_profile_header_t *header, size_t size, const char *file, int line)
+{
+	header->size = size;
+	header->site = xmemory_profile_site_get(file, line);
+	header->magic = XMEMORY_PROFILE_MAGIC;
+
+	xmemory_profile_record(header->site, size);
+
+	return header + 1;
+}
+
+void *xmalloc_profile(size_t size, const char *file, int line)
+{
+	if (size > SIZE_MAX - sizeof(xmemory_profile_header_t)) {
+		abort();
+	}
+
+	return xmemory_profile_header_init(xmalloc(sizeof(xmemory_profile_header_t) + size), size, file, line);
+}
+
+void *xrealloc_profile(void *ptr, size_t size, const char *file, int line)
+{
+	if (ptr == NULL) {
+		return xmalloc_profile(size, file, line);
+	}
+
+	xmemory_profile_header_t *header = xmemory_profile_header_get(ptr);
+
+	if (size > SIZE_MAX - sizeof(xmemory_profile_header_t)) {
+		abort();
+	}
+
+	atomic_fetch_sub_explicit(&header->site->bytes_live, header->size, memory_order_relaxed);
+	header->magic = 0;
+
+	return xmemory_profile_header_init(xrealloc(header, sizeof(xmemory_profile_header_t) + size), size, file, line);
+}
+
+void *xcalloc_profile(size_t nmemb, size_t size, const char *file, int line)
+{
+	if (size != 0 && nmemb > SIZE_MAX / size) {
+		abort();
+	}
+
+	void *res = xmalloc_profile(nmemb * size, file, line);
+	memset(res, 0, nmemb * size);
+
+	return res;
+}
+
+char *xstrdup_profile(const char *s, const char *file, int line)
+{
+	size_t size = strlen(s) + 1;
+	char *res = xmalloc_profile(size, file, line);
+
+	memcpy(res, s, size);
+
+	return res;
+}
+
+void xfree_profile(void *ptr)
+{
+	if (ptr == NULL) {
+		return;
+	}
+
+	xmemory_profile_header_t *header = xmemory_profile_header_get(ptr);
+
+	atomic_fetch_sub_explicit(&header->site->bytes_live, header->size, memory_order_relaxed);
+	header->magic = 0;
+	free(header);
+}
+
+static int xmemory_profile_site_compare(const void *a, const void *b)
+{
+	size_t bytes_a = atomic_load_explicit(&(*(xmemory_profile_site_t *const *) a)->bytes, memory_order_relaxed);
+	size_t bytes_b = atomic_load_explicit(&(*(xmemory_profile_site_t *const *) b)->bytes, memory_order_relaxed);
+
+	return bytes_a < bytes_b ? 1 : bytes_a > bytes_b ? -1 : 0;
+}
+
+void xmemory_profile_totals(size_t *count, size_t *bytes)
+{
+	*count = atomic_load_explicit(&xmemory_profile_site_overflow.count, memory_order_relaxed);
+	*bytes = atomic_load_explicit(&xmemory_profile_site_overflow.bytes, memory_order_relaxed);
+
+	for (size_t i = 0; i < XMEMORY_PROFILE_SITES; i++) {
+		if (atomic_load_explicit(&xmemory_profile_sites[i].state, memory_order_acquire) == 2) {
+			*count += atomic_load_explicit(&xmemory_profile_sites[i].count, memory_order_relaxed);
+			*bytes += atomic_load_explicit(&xmemory_profile_sites[i].bytes, memory_order_relaxed);
+		}
+	}
+}
+
+void xmemory_profile_report(FILE *stream)
+{
+	xmemory_profile_site_t **sites = xmalloc(sizeof(xmemory_profile_site_t *) * (XMEMORY_PROFILE_SITES + 1));
+	size_t sites_count = 0;
+
+	for (size_t i = 0; i < XMEMORY_PROFILE_SITES; i++) {
+		if (atomic_load_explicit(&xmemory_profile_sites[i].state, memory_order_acquire) == 2) {
+			sites[sites_count++] = &xmemory_profile_sites[i];
+		}
+	}
+	if (atomic_load_explicit(&xmemory_profile_site_overflow.count, memory_order_relaxed)) {
+		sites[sites_count++] = &xmemory_profile_site_overflow;
+	}
+
+	qsort(sites, sites_count, sizeof(xmemory_profile_site_t *), xmemory_profile_site_compare);
+
+	fprintf(stream, "memory profile: %zu call sites\n", sites_count);
+	fprintf(stream, "%12s %14s %14s %14s  %s\n", "count", "bytes", "live", "peak", "site");
+	for (size_t i = 0; i < sites_count; i++) {
+		fprintf(stream,
+				"%12zu %14zu %14zu %14zu  %s:%d\n",
+				atomic_load_explicit(&sites[i]->count, memory_order_relaxed),
+				atomic_load_explicit(&sites[i]->bytes, memory_order_relaxed),
+				atomic_load_explicit(&sites[i]->bytes_live, memory_order_relaxed),
+				atomic_load_explicit(&sites[i]->bytes_peak, memory_order_relaxed),
+				sites[i]->file,
+				sites[i]->line);
+	}
+
+	fprintf(stream, "size classes:\n");
+	for (size_t i = 0; i < XMEMORY_PROFILE_SIZE_CLASSES; i++) {
+		size_t count = atomic_load_explicit(&xmemory_profile_size_classes[i], memory_order_relaxed);
+		if (count) {
+			fprintf(stream, "%12zu  <= %zu\n", count, i ? (size_t) ((i < 64) ? (1ULL << i) - 1 : SIZE_MAX) : 0);
+		}
+	}
+
+	free(sites);
+}
+#endif
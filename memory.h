@@ -11,11 +11,12 @@
 #ifndef MEMORY_H_ONCE
 #define MEMORY_H_ONCE
 
+#include <stddef.h>
 #include <stdlib.h>
 
 #define FREE_SAFE(x)                                                                                                                                 \
 	do {                                                                                                                                             \
-		free(x);                                                                                                                                     \
+		xfree(x);                                                                                                                                    \
 		(x) = NULL;                                                                                                                                  \
 	} while (0)
 
@@ -24,4 +25,94 @@ void *xrealloc(void *ptr, size_t size);
 void *xcalloc(size_t nmemb, size_t size);
 char *xstrdup(const char *s);
 
+// allocation profiling, build with -DMEMORY_PROFILE
+// - the x* allocators record count, bytes, live bytes and peak live bytes per call site and a size class histogram
+// - memory from the x* allocators has to be released with xfree() or FREE_SAFE() so live bytes can be tracked
+// - xfree(), FREE_SAFE() and xrealloc() only take memory from the x* allocators of a MEMORY_PROFILE build and abort on anything else,
+//   memory from libraries or from translation units built without MEMORY_PROFILE has to go to free()
+// - the report is sorted by allocated bytes and printed to stderr at exit or on demand with xmemory_profile_report()
+// - without MEMORY_PROFILE xfree() is free() and nothing is recorded
+#ifdef MEMORY_PROFILE
+#include <stdio.h>
+
+void *xmalloc_profile(size_t size, const char *file, int line);
+void *xrealloc_profile(void *ptr, size_t size, const char *file, int line);
+void *xcalloc_profile(size_t nmemb, size_t size, const char *file, int line);
+char *xstrdup_profile(const char *s, const char *file, int line);
+void xfree_profile(void *ptr);
+void xmemory_profile_report(FILE *stream);
+void xmemory_profile_totals(size_t *count, size_t *bytes); // sums over all call sites
+#endif
+
+// memory.c defines MEMORY_PROFILE_INTERNAL, its own allocations are not profiled
+#if defined(MEMORY_PROFILE) && !defined(MEMORY_PROFILE_INTERNAL)
+#define xmalloc(size) xmalloc_profile((size), __FILE__, __LINE__)
+#define xrealloc(ptr, size) xrealloc_profile((ptr), (size), __FILE__, __LINE__)
+#define xcalloc(nmemb, size) xcalloc_profile((nmemb), (size), __FILE__, __LINE__)
+#define xstrdup(s) xstrdup_profile((s), __FILE__, __LINE__)
+#define xfree(ptr) xfree_profile(ptr)
+#else
+#define xfree(ptr) free(ptr)
+#endif
+
+// arena allocator
+// - allocations are a pointer bump in the current chunk, new chunks are added (and grown) when it runs out
+// - there is no per allocation free, everything is released at once with xarena_reset() or xarena_destroy()
+// - chunks are kept on reset/rewind and reused by later allocations
+typedef struct xarena_s xarena_t;
+typedef struct xarena_chunk_s xarena_chunk_t;
+
+typedef struct {
+	xarena_chunk_t *chunk;
+	size_t offset;
+} xarena_mark_t;
+
+xarena_t *xarena_new(size_t chunk_size); // chunk_size 0 selects the default
+void *xarena_alloc(xarena_t *arena, size_t size);
+void *xarena_alloc_aligned(xarena_t *arena, size_t size, size_t alignment); // alignment must be a power of two
+char *xarena_strdup(xarena_t *arena, const char *s);
+xarena_mark_t xarena_mark(xarena_t *arena);
+void xarena_rewind(xarena_t *arena, xarena_mark_t mark); // releases everything allocated after the mark
+void xarena_reset(xarena_t *arena);
+void xarena_destroy(xarena_t *arena);
+
+// fixed-size object pool
+// - objects are carved out of slabs and recycled through an embedded free list, slabs are only freed on destroy
+// - every thread keeps a small cache of objects and refills/flushes it from the shared free list in batches
+// - objects can be put back from any thread
+typedef struct xpool_s xpool_t;
+
+typedef enum {
+	XPOOL_OPT_ZERO = 0x1, // zero objects in xpool_get()
+} xpool_opt;
+
+xpool_t *xpool_new(size_t object_size, size_t slab_objects, int opts); // slab_objects 0 selects the default
+void *xpool_get(xpool_t *pool);
+void xpool_put(xpool_t *pool, void *object);
+void xpool_destroy(xpool_t *pool); // no other thread may use the pool anymore
+
+// growable byte buffer
+// - capacity grows geometrically, consumed bytes at the front are reclaimed by compacting instead of growing when possible
+// - slices point into the buffer without copying and are valid until the next reserve/append/consume/free
+// - xbuffer_write_cb() has the CURLOPT_WRITEFUNCTION signature, use it with CURLOPT_WRITEDATA set to the buffer
+typedef struct {
+	char *data;
+	size_t offset;	 // start of the unconsumed data
+	size_t size;	 // end of the data
+	size_t capacity; // allocated size of data
+} xbuffer_t;
+
+typedef struct {
+	const char *data;
+	size_t size;
+} xbuffer_slice_t;
+
+void xbuffer_init(xbuffer_t *buffer);
+void xbuffer_free(xbuffer_t *buffer);
+void xbuffer_reserve(xbuffer_t *buffer, size_t size); // make room for size more bytes
+void xbuffer_append(xbuffer_t *buffer, const void *data, size_t size);
+void xbuffer_consume(xbuffer_t *buffer, size_t size);
+xbuffer_slice_t xbuffer_slice(const xbuffer_t *buffer, size_t offset, size_t size); // relative to the unconsumed data, clamped
+size_t xbuffer_write_cb(char *ptr, size_t size, size_t nmemb, void *userdata);
+
 #endif /* MEMORY_H_ONCE */
@@ -0,0 +1,85 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Copyright (c) 2019 Sartura Ltd.
+ *
+ * Author: Domagoj Pintaric <domagoj.pintaric@sartura.hr>
+ *
+ * https://www.sartura.hr/
+ */
+
+#include <stddef.h>
+
+#include "mpsc_queue.h"
+
+mpsc_queue_rc mpsc_queue_init(mpsc_queue_t *queue)
+{
+	if (queue == NULL) {
+		return MPSC_QUEUE_FAILURE_ARGUMENTS;
+	}
+
+	atomic_store_explicit(&queue->stub.next, NULL, memory_order_relaxed);
+	atomic_store_explicit(&queue->head, &queue->stub, memory_order_relaxed);
+	queue->tail = &queue->stub;
+
+	return MPSC_QUEUE_SUCCESS;
+}
+
+mpsc_queue_rc mpsc_queue_push(mpsc_queue_t *queue, mpsc_queue_node_t *queue_node)
+{
+	if (queue == NULL || queue_node == NULL) {
+		return MPSC_QUEUE_FAILURE_ARGUMENTS;
+	}
+
+	atomic_store_explicit(&queue_node->next, NULL, memory_order_relaxed);
+
+	// serialization point between producers, the link to the previous node is published afterwards
+	mpsc_queue_node_t *previous = atomic_exchange_explicit(&queue->head, queue_node, memory_order_acq_rel);
+	atomic_store_explicit(&previous->next, queue_node, memory_order_release);
+
+	return MPSC_QUEUE_SUCCESS;
+}
+
+mpsc_queue_rc mpsc_queue_pop(mpsc_queue_t *queue, mpsc_queue_node_t **queue_node)
+{
+	if (queue == NULL || queue_node == NULL) {
+		return MPSC_QUEUE_FAILURE_ARGUMENTS;
+	}
+
+	mpsc_queue_node_t *tail = queue->tail;
+	mpsc_queue_node_t *next = atomic_load_explicit(&tail->next, memory_order_acquire);
+
+	// skip the stub
+	if (tail == &queue->stub) {
+		if (next == NULL) {
+			return MPSC_QUEUE_FAILURE_EMPTY;
+		}
+
+		queue->tail = next;
+		tail = next;
+		next = atomic_load_explicit(&tail->next, memory_order_acquire);
+	}
+
+	if (next) {
+		queue->tail = next;
+		*queue_node = tail;
+		return MPSC_QUEUE_SUCCESS;
+	}
+
+	// tail is not the last node, a producer swapped head but has not linked it yet
+	if (tail != atomic_load_explicit(&queue->head, memory_order_acquire)) {
+		return MPSC_QUEUE_FAILURE_BUSY;
+	}
+
+	// tail is the last node, push the stub behind it so it can be handed out
+	mpsc_queue_push(queue, &queue->stub);
+
+	next = atomic_load_explicit(&tail->next, memory_order_acquire);
+	if (next) {
+		queue->tail = next;
+		*queue_node = tail;
+		return MPSC_QUEUE_SUCCESS;
+	}
+
+	return MPSC_QUEUE_FAILURE_BUSY;
+}
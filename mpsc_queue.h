@@ -0,0 +1,49 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Copyright (c) 2019 Sartura Ltd.
+ *
+ * Author: Domagoj Pintaric <domagoj.pintaric@sartura.hr>
+ *
+ * https://www.sartura.hr/
+ */
+
+#ifndef MPSC_QUEUE_H_ONCE
+#define MPSC_QUEUE_H_ONCE
+
+#include <stdatomic.h>
+
+// intrusive lock-free multi-producer/single-consumer FIFO (Vyukov)
+// - mpsc_queue_push() may be called from any thread and never blocks or allocates
+// - mpsc_queue_pop() must only be called from one consumer thread at a time
+
+typedef struct mpsc_queue_s mpsc_queue_t;
+typedef struct mpsc_queue_node_s mpsc_queue_node_t;
+
+typedef enum {
+	MPSC_QUEUE_SUCCESS = 0,
+	MPSC_QUEUE_FAILURE_ARGUMENTS = -1,
+	MPSC_QUEUE_FAILURE_EMPTY = -2,
+	MPSC_QUEUE_FAILURE_BUSY = -3, // a producer is in the middle of a push, retry later
+} mpsc_queue_rc;
+
+#define MPSC_QUEUE_CACHE_LINE 64
+
+// embed in the user struct, get it back with LIST_CONTAINER_OF() from list.h
+struct mpsc_queue_node_s {
+	mpsc_queue_node_t *_Atomic next;
+};
+
+// producers only touch head, the consumer only touches tail, keep them on separate cache lines
+struct mpsc_queue_s {
+	mpsc_queue_node_t *_Atomic head;
+	char head_padding[MPSC_QUEUE_CACHE_LINE - sizeof(mpsc_queue_node_t *)];
+	mpsc_queue_node_t *tail;
+	mpsc_queue_node_t stub;
+};
+
+mpsc_queue_rc mpsc_queue_init(mpsc_queue_t *queue);
+mpsc_queue_rc mpsc_queue_push(mpsc_queue_t *queue, mpsc_queue_node_t *queue_node);
+mpsc_queue_rc mpsc_queue_pop(mpsc_queue_t *queue, mpsc_queue_node_t **queue_node);
+
+#endif /* MPSC_QUEUE_H_ONCE */
@@ -0,0 +1,267 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Copyright (c) 2019 Sartura Ltd.
+ *
+ * Author: Domagoj Pintaric <domagoj.pintaric@sartura.hr>
+ *
+ * https://www.sartura.hr/
+ */
+
+// benchmark for uv_mpsc_queue.h against a mutex protected list_t with a uv_async_t per push
+// usage: mpsc_queue_bench [-p producers] [-m messages] [-r rate]
+// - 1, 2, 4, 8, 16 and 32 producer threads (or -p producers) hand messages to a libuv loop thread
+// - -m is the total number of messages per run, split over the producers
+// - producers push as fast as they can, or -r messages per second each, latency is measured from the push to the callback on the loop
+//   (saturated runs mostly measure the backlog, use -r for latency)
+// - loops are the loop iterations it took, each one an epoll_wait, fewer means more messages per wakeup
+// - the list_t variant is what the driver users did before: lock, allocate a node, insert, unlock, uv_async_send(), and a drain that
+//   moves the whole list out under the lock
+// build: cc -O2 -D_GNU_SOURCE mpsc_queue_bench.c mpsc_queue.c list.c histogram.c -luv -lpthread -lm
+
+#include <getopt.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "histogram.h"
+#include "list.h"
+#include "uv_mpsc_queue.h"
+
+#define BENCH_MESSAGES_DEFAULT 2000000
+
+typedef enum {
+	BENCH_MODE_MPSC = 0,
+	BENCH_MODE_LIST,
+} bench_mode;
+
+typedef struct {
+	mpsc_queue_node_t queue_node;
+	uint64_t sent;
+} bench_message_t;
+
+typedef struct bench_s bench_t;
+
+typedef struct {
+	bench_t *bench;
+	pthread_t thread;
+	bench_message_t *messages;
+	size_t count;
+} bench_producer_t;
+
+struct bench_s {
+	bench_mode mode;
+	uv_loop_t loop;
+	uv_mpsc_queue_t queue;
+	pthread_mutex_t list_lock;
+	list_t *list;
+	uv_async_t list_async;
+	histogram_t *latency;
+	size_t rate;
+	size_t expected;
+	size_t received;
+	size_t loops;
+	atomic_bool go;
+};
+
+static const size_t bench_suite[] = {1, 2, 4, 8, 16, 32};
+
+static void bench_message_receive(bench_t *bench, bench_message_t *message)
+{
+	histogram_record(bench->latency, histogram_clock() - message->sent);
+	bench->received++;
+}
+
+static void bench_mpsc_cb(uv_mpsc_queue_t *queue, mpsc_queue_node_t *queue_node)
+{
+	bench_t *bench = (bench_t *) queue->data;
+
+	bench_message_receive(bench, LIST_CONTAINER_OF(queue_node, bench_message_t, queue_node));
+}
+
+// every loop iteration is one epoll_wait
+static void bench_prepare_cb(uv_prepare_t *handle)
+{
+	((bench_t *) handle->data)->loops++;
+}
+
+static void bench_list_async_cb(uv_async_t *handle)
+{
+	bench_t *bench = (bench_t *) handle->data;
+	list_t list = {0};
+	list_node_t *list_node = NULL, *list_node_tmp = NULL;
+
+	pthread_mutex_lock(&bench->list_lock);
+	list_concat(&list, bench->list);
+	pthread_mutex_unlock(&bench->list_lock);
+
+	LIST_FOREACH_SAFE(&list, list_node, list_node_tmp)
+	{
+		bench_message_receive(bench, (bench_message_t *) list_node->data);
+		list_node_destroy(list_node, NULL);
+	}
+}
+
+// sleeps instead of spinning, the loop thread may share the core
+static void bench_producer_wait(bench_producer_t *producer, size_t i, uint64_t start)
+{
+	uint64_t due = start + (uint64_t) i * 1000000000ULL / producer->bench->rate;
+	struct timespec until = {.tv_sec = (time_t) (due / 1000000000ULL), .tv_nsec = (long) (due % 1000000000ULL)};
+
+	clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, NULL);
+}
+
+static void *bench_producer_thread(void *arg)
+{
+	bench_producer_t *producer = (bench_producer_t *) arg;
+	bench_t *bench = producer->bench;
+	list_node_t *list_node = NULL;
+
+	while (!atomic_load_explicit(&bench->go, memory_order_acquire)) {
+		sched_yield();
+	}
+
+	uint64_t start = histogram_clock();
+
+	for (size_t i = 0; i < producer->count; i++) {
+		bench_message_t *message = &producer->messages[i];
+
+		if (bench->rate) {
+			bench_producer_wait(producer, i, start);
+		}
+
+		message->sent = histogram_clock();
+		if (bench->mode == BENCH_MODE_MPSC) {
+			uv_mpsc_queue_push(&bench->queue, &message->queue_node);
+		} else {
+			pthread_mutex_lock(&bench->list_lock);
+			list_node_new(&list_node, message);
+			list_insert(bench->list, LIST_OPT_TAIL, list_node);
+			pthread_mutex_unlock(&bench->list_lock);
+			uv_async_send(&bench->list_async);
+		}
+	}
+
+	return NULL;
+}
+
+static void bench_run(bench_mode mode, size_t producers, size_t messages, size_t rate)
+{
+	bench_t bench = {0};
+	bench_producer_t *producer = calloc(producers, sizeof(bench_producer_t));
+	bench_message_t *message = calloc(messages, sizeof(bench_message_t));
+	histogram_snapshot_t *snapshot = malloc(sizeof(histogram_snapshot_t));
+	uv_prepare_t prepare;
+	uint64_t p50 = 0, p99 = 0, p999 = 0;
+
+	bench.mode = mode;
+	bench.rate = rate;
+	bench.expected = messages / producers * producers;
+	histogram_new(&bench.latency);
+	uv_loop_init(&bench.loop);
+
+	if (mode == BENCH_MODE_MPSC) {
+		uv_mpsc_queue_init(&bench.loop, &bench.queue, 0, bench_mpsc_cb);
+		bench.queue.data = &bench;
+	} else {
+		pthread_mutex_init(&bench.list_lock, NULL);
+		list_new(&bench.list);
+		uv_async_init(&bench.loop, &bench.list_async, bench_list_async_cb);
+		bench.list_async.data = &bench;
+	}
+
+	uv_prepare_init(&bench.loop, &prepare);
+	prepare.data = &bench;
+	uv_prepare_start(&prepare, bench_prepare_cb);
+
+	for (size_t i = 0; i < producers; i++) {
+		producer[i].bench = &bench;
+		producer[i].messages = message + i * (messages / producers);
+		producer[i].count = messages / producers;
+		pthread_create(&producer[i].thread, NULL, bench_producer_thread, &producer[i]);
+	}
+
+	uint64_t start = histogram_clock();
+	atomic_store_explicit(&bench.go, true, memory_order_release);
+	while (bench.received < bench.expected) {
+		uv_run(&bench.loop, UV_RUN_ONCE);
+	}
+	uint64_t elapsed = histogram_clock() - start;
+
+	// producers can still be inside uv_async_send() after their last message arrived, close the handles once they are gone
+	for (size_t i = 0; i < producers; i++) {
+		pthread_join(producer[i].thread, NULL);
+	}
+
+	if (mode == BENCH_MODE_MPSC) {
+		uv_mpsc_queue_close(&bench.queue, NULL);
+	} else {
+		uv_close((uv_handle_t *) &bench.list_async, NULL);
+	}
+	uv_close((uv_handle_t *) &prepare, NULL);
+	uv_run(&bench.loop, UV_RUN_DEFAULT);
+
+	histogram_snapshot(bench.latency, snapshot);
+	histogram_snapshot_percentile(snapshot, 50, &p50);
+	histogram_snapshot_percentile(snapshot, 99, &p99);
+	histogram_snapshot_percentile(snapshot, 99.9, &p999);
+
+	printf("%6s %9zu %11.0f %9.1f %9.1f %9.1f %9zu %11.1f\n", mode == BENCH_MODE_MPSC ? "mpsc" : "list_t", producers,
+		   (double) bench.received * 1e9 / (double) elapsed, (double) p50 / 1000, (double) p99 / 1000, (double) p999 / 1000, bench.loops,
+		   (double) bench.received / (double) (bench.loops ? bench.loops : 1));
+
+	uv_loop_close(&bench.loop);
+	if (mode == BENCH_MODE_LIST) {
+		list_destroy(bench.list);
+		pthread_mutex_destroy(&bench.list_lock);
+	}
+	histogram_destroy(bench.latency);
+	free(snapshot);
+	free(message);
+	free(producer);
+}
+
+int main(int argc, char **argv)
+{
+	size_t producers = 0;
+	size_t messages = BENCH_MESSAGES_DEFAULT;
+	size_t rate = 0;
+	int option = 0;
+
+	while ((option = getopt(argc, argv, "p:m:r:")) != -1) {
+		switch (option) {
+			case 'p':
+				producers = strtoul(optarg, NULL, 10);
+				break;
+			case 'm':
+				messages = strtoul(optarg, NULL, 10);
+				break;
+			case 'r':
+				rate = strtoul(optarg, NULL, 10);
+				break;
+			default:
+				fprintf(stderr, "usage: %s [-p producers] [-m messages] [-r rate]\n", argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+
+	printf("%6s %9s %11s %9s %9s %9s %9s %11s\n", "queue", "producers", "msg/s", "p50 us", "p99 us", "p999 us", "loops", "msg/loop");
+
+	for (size_t i = 0; i < sizeof(bench_suite) / sizeof(bench_suite[0]); i++) {
+		size_t count = producers ? producers : bench_suite[i];
+
+		bench_run(BENCH_MODE_MPSC, count, messages, rate);
+		bench_run(BENCH_MODE_LIST, count, messages, rate);
+		if (producers) {
+			break;
+		}
+	}
+
+	return EXIT_SUCCESS;
+}
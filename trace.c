@@ -0,0 +1,235 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Copyright (c) 2019 Sartura Ltd.
+ *
+ * Author: Domagoj Pintaric <domagoj.pintaric@sartura.hr>
+ *
+ * https://www.sartura.hr/
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+#ifdef TRACE
+
+#define TRACE_BUFFER_EVENTS 4096
+#define TRACE_FILE_DEFAULT "trace.bin"
+
+typedef struct trace_buffer_s trace_buffer_t;
+
+// in memory event, the name is only resolved when the buffer is written out
+typedef struct {
+	uint64_t timestamp;
+	const char *name;
+	trace_phase phase;
+} trace_event_t;
+
+struct trace_buffer_s {
+	trace_buffer_t *next;
+	trace_buffer_t *previous;
+	uint32_t thread_id;
+	size_t count;
+	trace_event_t events[TRACE_BUFFER_EVENTS];
+};
+
+static pthread_once_t trace_once = PTHREAD_ONCE_INIT;
+static pthread_key_t trace_buffer_key;
+static __thread trace_buffer_t *trace_buffer = NULL;
+static __thread bool trace_thread_exiting = false; // buffer destroyed, events from later TSD destructors are dropped
+
+// file and buffer registry, protected by trace_lock
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static int trace_fd = -1;
+static trace_buffer_t *trace_buffers = NULL;
+
+static void trace_write(const void *data, size_t size)
+{
+	const char *position = data;
+
+	while (size > 0) {
+		ssize_t written = write(trace_fd, position, size);
+		if (written < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return;
+		}
+
+		position += written;
+		size -= (size_t) written;
+	}
+}
+
+// called with trace_lock held
+static void trace_buffer_write(trace_buffer_t *buffer)
+{
+	char output[16 * 1024];
+	size_t output_length = 0;
+
+	if (trace_fd < 0) {
+		buffer->count = 0;
+		return;
+	}
+
+	for (size_t i = 0; i < buffer->count; i++) {
+		trace_event_t *event = &buffer->events[i];
+		size_t name_length = strlen(event->name);
+		trace_file_record_t record = {0};
+
+		if (name_length > UINT8_MAX) {
+			name_length = UINT8_MAX;
+		}
+
+		if (sizeof(output) - output_length < sizeof(record) + name_length) {
+			trace_write(output, output_length);
+			output_length = 0;
+		}
+
+		record.timestamp = event->timestamp;
+		record.thread_id = buffer->thread_id;
+		record.phase = (uint8_t) event->phase;
+		record.name_length = (uint8_t) name_length;
+
+		memcpy(output + output_length, &record, sizeof(record));
+		memcpy(output + output_length + sizeof(record), event->name, name_length);
+		output_length += sizeof(record) + name_length;
+	}
+
+	trace_write(output, output_length);
+	buffer->count = 0;
+}
+
+static void trace_buffer_destroy(void *data)
+{
+	trace_buffer_t *buffer = data;
+
+	pthread_mutex_lock(&trace_lock);
+	trace_buffer_write(buffer);
+	if (buffer->previous) {
+		buffer->previous->next = buffer->next;
+	} else {
+		trace_buffers = buffer->next;
+	}
+	if (buffer->next) {
+		buffer->next->previous = buffer->previous;
+	}
+	pthread_mutex_unlock(&trace_lock);
+
+	free(buffer);
+
+	// a new buffer would never be flushed, it is created after this destructor ran
+	trace_buffer = NULL;
+	trace_thread_exiting = true;
+}
+
+// best effort for threads that are still running, they should call trace_flush() before the process exits
+static void trace_exit(void)
+{
+	pthread_mutex_lock(&trace_lock);
+	for (trace_buffer_t *buffer = trace_buffers; buffer; buffer = buffer->next) {
+		trace_buffer_write(buffer);
+	}
+	if (trace_fd >= 0) {
+		close(trace_fd);
+		trace_fd = -1;
+	}
+	pthread_mutex_unlock(&trace_lock);
+}
+
+static void trace_init(void)
+{
+	const char *path = getenv("TRACE_FILE");
+
+	if (pthread_key_create(&trace_buffer_key, trace_buffer_destroy) != 0) {
+		return;
+	}
+
+	trace_fd = open(path ? path : TRACE_FILE_DEFAULT, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (trace_fd < 0) {
+		return;
+	}
+
+	trace_write(TRACE_FILE_MAGIC, sizeof(TRACE_FILE_MAGIC) - 1);
+	atexit(trace_exit);
+}
+
+static trace_buffer_t *trace_buffer_get(void)
+{
+	if (trace_buffer) {
+		return trace_buffer;
+	}
+
+	if (trace_thread_exiting) {
+		return NULL;
+	}
+
+	pthread_once(&trace_once, trace_init);
+
+	trace_buffer_t *buffer = calloc(1, sizeof(trace_buffer_t));
+	if (buffer == NULL) {
+		return NULL;
+	}
+
+	buffer->thread_id = (uint32_t) syscall(SYS_gettid);
+
+	pthread_mutex_lock(&trace_lock);
+	buffer->next = trace_buffers;
+	if (trace_buffers) {
+		trace_buffers->previous = buffer;
+	}
+	trace_buffers = buffer;
+	pthread_mutex_unlock(&trace_lock);
+
+	pthread_setspecific(trace_buffer_key, buffer);
+	trace_buffer = buffer;
+
+	return buffer;
+}
+
+void trace_record(trace_phase phase, const char *name)
+{
+	trace_buffer_t *buffer = trace_buffer_get();
+	struct timespec now;
+
+	if (buffer == NULL) {
+		return;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	trace_event_t *event = &buffer->events[buffer->count++];
+	event->timestamp = (uint64_t) now.tv_sec * 1000000000ULL + (uint64_t) now.tv_nsec;
+	event->name = name;
+	event->phase = phase;
+
+	if (buffer->count == TRACE_BUFFER_EVENTS) {
+		pthread_mutex_lock(&trace_lock);
+		trace_buffer_write(buffer);
+		pthread_mutex_unlock(&trace_lock);
+	}
+}
+
+void trace_flush(void)
+{
+	trace_buffer_t *buffer = trace_buffer_get();
+
+	if (buffer == NULL) {
+		return;
+	}
+
+	pthread_mutex_lock(&trace_lock);
+	trace_buffer_write(buffer);
+	pthread_mutex_unlock(&trace_lock);
+}
+
+#endif
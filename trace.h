@@ -0,0 +1,60 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Copyright (c) 2019 Sartura Ltd.
+ *
+ * Author: Domagoj Pintaric <domagoj.pintaric@sartura.hr>
+ *
+ * https://www.sartura.hr/
+ */
+
+#ifndef TRACE_H_ONCE
+#define TRACE_H_ONCE
+
+// trace events, build with -DTRACE and link trace.c
+// - TRACE_BEGIN/TRACE_END mark a span, TRACE_INSTANT a point in time, name has to be a string literal
+// - events are recorded with a CLOCK_MONOTONIC nanosecond timestamp into a per thread buffer
+// - full buffers are appended to the file named by TRACE_FILE (default trace.bin), the rest is written at thread exit,
+//   at process exit or on trace_flush()
+// - convert the file with trace2json for chrome://tracing or https://ui.perfetto.dev
+// - without TRACE the macros compile to nothing
+
+#include <stdint.h>
+
+#define TRACE_FILE_MAGIC "UVTRACE1"
+
+typedef enum {
+	TRACE_PHASE_BEGIN = 'B',
+	TRACE_PHASE_END = 'E',
+	TRACE_PHASE_INSTANT = 'i',
+} trace_phase;
+
+// on disk record, followed by name_length bytes of name
+typedef struct {
+	uint64_t timestamp; // nanoseconds, CLOCK_MONOTONIC
+	uint32_t thread_id;
+	uint8_t phase;
+	uint8_t name_length;
+	uint16_t reserved;
+} trace_file_record_t;
+
+#ifdef TRACE
+void trace_record(trace_phase phase, const char *name);
+void trace_flush(void);
+
+#define TRACE_BEGIN(name) trace_record(TRACE_PHASE_BEGIN, "" name)
+#define TRACE_END(name) trace_record(TRACE_PHASE_END, "" name)
+#define TRACE_INSTANT(name) trace_record(TRACE_PHASE_INSTANT, "" name)
+#else
+#define TRACE_BEGIN(name)                                                                                                                            \
+	do {                                                                                                                                             \
+	} while (0)
+#define TRACE_END(name)                                                                                                                              \
+	do {                                                                                                                                             \
+	} while (0)
+#define TRACE_INSTANT(name)                                                                                                                          \
+	do {                                                                                                                                             \
+	} while (0)
+#endif
+
+#endif /* TRACE_H_ONCE */
@@ -0,0 +1,112 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Copyright (c) 2019 Sartura Ltd.
+ *
+ * Author: Domagoj Pintaric <domagoj.pintaric@sartura.hr>
+ *
+ * https://www.sartura.hr/
+ */
+
+// offline converter from the binary trace file (see trace.h) to chrome trace event json
+// usage: trace2json [trace.bin] > trace.json
+// open the output in chrome://tracing or https://ui.perfetto.dev
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "trace.h"
+
+static void json_string_print(FILE *output, const char *string, size_t length)
+{
+	fputc('"', output);
+	for (size_t i = 0; i < length; i++) {
+		unsigned char c = (unsigned char) string[i];
+
+		if (c == '"' || c == '\\') {
+			fprintf(output, "\\%c", c);
+		} else if (c < 0x20) {
+			fprintf(output, "\\u%04x", c);
+		} else {
+			fputc(c, output);
+		}
+	}
+	fputc('"', output);
+}
+
+// 1 on a record, 0 at the end of the file, -1 on a truncated record
+static int trace_record_read(FILE *input, trace_file_record_t *record, char *name)
+{
+	if (fread(record, sizeof(*record), 1, input) != 1) {
+		return 0;
+	}
+
+	if (record->name_length && fread(name, record->name_length, 1, input) != 1) {
+		return -1;
+	}
+
+	return 1;
+}
+
+int main(int argc, char **argv)
+{
+	const char *path = argc > 1 ? argv[1] : "trace.bin";
+	char magic[sizeof(TRACE_FILE_MAGIC) - 1] = {0};
+	trace_file_record_t record = {0};
+	char name[UINT8_MAX + 1] = {0};
+	uint64_t timestamp_first = UINT64_MAX;
+	size_t count = 0;
+	int rc = 0;
+
+	FILE *input = fopen(path, "rb");
+	if (input == NULL) {
+		fprintf(stderr, "unable to open %s\n", path);
+		return 1;
+	}
+
+	if (fread(magic, sizeof(magic), 1, input) != 1 || memcmp(magic, TRACE_FILE_MAGIC, sizeof(magic)) != 0) {
+		fprintf(stderr, "%s is not a trace file\n", path);
+		fclose(input);
+		return 1;
+	}
+
+	// timestamps are relative to the earliest event so the viewer does not start at the system uptime
+	// the file is in flush order, not time order (every thread flushes its own buffer), so the earliest event is found first
+	long records = ftell(input);
+	while (trace_record_read(input, &record, name) == 1) {
+		if (record.timestamp < timestamp_first) {
+			timestamp_first = record.timestamp;
+		}
+	}
+
+	if (fseek(input, records, SEEK_SET) != 0) {
+		fprintf(stderr, "unable to seek in %s\n", path);
+		fclose(input);
+		return 1;
+	}
+
+	printf("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+
+	while ((rc = trace_record_read(input, &record, name)) == 1) {
+		uint64_t timestamp = record.timestamp - timestamp_first;
+
+		printf("%s\n{\"name\":", count ? "," : "");
+		json_string_print(stdout, name, record.name_length);
+		// chrome trace timestamps are microseconds
+		printf(",\"ph\":\"%c\",\"ts\":%" PRIu64 ".%03" PRIu64 ",\"pid\":1,\"tid\":%" PRIu32 "%s}", record.phase, timestamp / 1000, timestamp % 1000,
+			   record.thread_id, record.phase == TRACE_PHASE_INSTANT ? ",\"s\":\"t\"" : "");
+
+		count++;
+	}
+
+	if (rc < 0) {
+		fprintf(stderr, "truncated record at event %zu\n", count);
+	}
+
+	printf("\n]}\n");
+
+	fclose(input);
+
+	return 0;
+}
@@ -0,0 +1,352 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Copyright (c) 2019 Sartura Ltd.
+ *
+ * Author: Domagoj Pintaric <domagoj.pintaric@sartura.hr>
+ *
+ * https://www.sartura.hr/
+ */
+
+// test for the uv_curlm_driver.h response cache and request coalescing, runs offline against a stub http/1.1 server on loopback
+// usage: uv_curlm_cache_test
+// - the stub server answers every request with the Authorization header it received as the body, cacheable for a minute
+// - GET requests that differ only in their headers have to reach the server each, neither the cache nor coalescing may share them
+// - GET requests without headers have to be answered from the cache and coalesced
+// - under /revalidate the server sends an ETag with max-age=0 and answers If-None-Match with a 304, the second request has to
+//   complete with the cached body and status 200, also when the cache is disabled while the revalidation is in flight
+// exits with 1 on any failure
+// build: cc -O1 -g -D_GNU_SOURCE uv_curlm_cache_test.c list.c memory.c mpsc_queue.c hash_map.c histogram.c -luv -lcurl -lpthread -lm
+
+#include <arpa/inet.h>
+#include <inttypes.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define UV_CURLM_DRIVER_NO_LEGACY
+#include "uv_curlm_driver.h"
+
+#define TEST_REQUEST_SIZE 8192
+#define TEST_BODY_SIZE 64
+#define TEST_ETAG "\"v1\""
+
+typedef struct {
+	int listen_fd;
+	int port;
+	pthread_t thread;
+	atomic_size_t requests;
+	atomic_size_t not_modified; // 304 responses
+} test_server_t;
+
+typedef struct test_s test_t;
+typedef void (*test_step_cb)(test_t *test);
+
+typedef struct {
+	test_t *test;
+	const char *expected; // body the server has to send for this request
+	test_step_cb next;	  // submits the next request once this one completed, NULL if none
+} test_request_t;
+
+struct test_s {
+	uv_curlm_driver_t *driver;
+	char url[64];
+	size_t pending;
+	int failures;
+};
+
+static const char *const test_headers_alice[] = {"Authorization: Bearer alice", NULL};
+static const char *const test_headers_bob[] = {"Authorization: Bearer bob", NULL};
+
+#define TEST_CHECK(test, condition, ...)                                                                                           \
+	do {                                                                                                                           \
+		if (!(condition)) {                                                                                                        \
+			fprintf(stderr, "FAIL %s:%d: ", __FILE__, __LINE__);                                                                   \
+			fprintf(stderr, __VA_ARGS__);                                                                                          \
+			fprintf(stderr, "\n");                                                                                                 \
+			(test)->failures++;                                                                                                    \
+		}                                                                                                                          \
+	} while (0)
+
+// stub server, one request per connection
+
+static void test_server_respond(test_server_t *server, int fd)
+{
+	char request[TEST_REQUEST_SIZE] = {0};
+	char body[TEST_BODY_SIZE] = "none";
+	char response[TEST_REQUEST_SIZE] = {0};
+	size_t request_size = 0;
+	ssize_t nread = 0;
+	const char *header = NULL;
+
+	while (request_size < sizeof(request) - 1 && strstr(request, "\r\n\r\n") == NULL) {
+		nread = read(fd, request + request_size, sizeof(request) - 1 - request_size);
+		if (nread <= 0) {
+			return;
+		}
+		request_size += (size_t) nread;
+	}
+
+	header = strcasestr(request, "\r\nAuthorization: Bearer ");
+	if (header) {
+		header += strlen("\r\nAuthorization: Bearer ");
+		size_t length = strcspn(header, "\r\n");
+		snprintf(body, sizeof(body), "%.*s", (int) length, header);
+	}
+
+	atomic_fetch_add(&server->requests, 1);
+
+	int response_size = 0;
+	if (strncmp(request, "GET /revalidate", strlen("GET /revalidate")) != 0) {
+		response_size = snprintf(response, sizeof(response),
+								 "HTTP/1.1 200 OK\r\nCache-Control: max-age=60\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n%s", strlen(body),
+								 body);
+	} else if (strcasestr(request, "\r\nIf-None-Match: " TEST_ETAG "\r\n")) {
+		atomic_fetch_add(&server->not_modified, 1);
+		response_size = snprintf(response, sizeof(response),
+								 "HTTP/1.1 304 Not Modified\r\nCache-Control: max-age=0\r\nETag: " TEST_ETAG "\r\nConnection: close\r\n\r\n");
+	} else {
+		response_size = snprintf(response, sizeof(response),
+								 "HTTP/1.1 200 OK\r\nCache-Control: max-age=0\r\nETag: " TEST_ETAG
+								 "\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n%s",
+								 strlen("fresh"), "fresh");
+	}
+	(void) !write(fd, response, (size_t) response_size);
+}
+
+static void *test_server_thread(void *arg)
+{
+	test_server_t *server = (test_server_t *) arg;
+	int fd = -1;
+
+	// shutdown() of the listening socket makes accept() fail
+	while ((fd = accept(server->listen_fd, NULL, NULL)) >= 0) {
+		test_server_respond(server, fd);
+		close(fd);
+	}
+
+	return NULL;
+}
+
+static int test_server_start(test_server_t *server)
+{
+	struct sockaddr_in address = {0};
+	socklen_t address_size = sizeof(address);
+
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	server->listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (server->listen_fd < 0 || bind(server->listen_fd, (struct sockaddr *) &address, sizeof(address)) != 0 ||
+		listen(server->listen_fd, 64) != 0 || getsockname(server->listen_fd, (struct sockaddr *) &address, &address_size) != 0) {
+		fprintf(stderr, "unable to listen on loopback\n");
+		return -1;
+	}
+
+	server->port = ntohs(address.sin_port);
+
+	return pthread_create(&server->thread, NULL, test_server_thread, server);
+}
+
+static void test_server_stop(test_server_t *server)
+{
+	shutdown(server->listen_fd, SHUT_RDWR);
+	pthread_join(server->thread, NULL);
+	close(server->listen_fd);
+}
+
+// client
+
+static void test_response_cb(uv_curlm_response_t *response, void *userdata)
+{
+	test_request_t *request = (test_request_t *) userdata;
+	test_t *test = request->test;
+	size_t size = response->body.size - response->body.offset;
+
+	TEST_CHECK(test, response->result == CURLE_OK && response->status == 200, "request failed: %d, status %ld", response->result, response->status);
+	TEST_CHECK(test, size == strlen(request->expected) && memcmp(response->body.data + response->body.offset, request->expected, size) == 0,
+			   "expected body \"%s\", got \"%.*s\"", request->expected, (int) size, response->body.data + response->body.offset);
+
+	test->pending--;
+	if (request->next) {
+		request->next(test);
+	}
+
+	xfree(request);
+}
+
+static void test_submit(test_t *test, const char *const *headers, const char *expected, test_step_cb next)
+{
+	uv_curlm_request_options_t options = {0};
+	test_request_t *request = xmalloc(sizeof(test_request_t));
+
+	request->test = test;
+	request->expected = expected;
+	request->next = next;
+
+	options.url = test->url;
+	options.headers = headers;
+
+	test->pending++;
+	if (uv_curlm_request_submit(test->driver, &options, test_response_cb, request) != 0) {
+		TEST_CHECK(test, false, "unable to submit request");
+		test->pending--;
+		xfree(request);
+	}
+}
+
+static void test_run(test_t *test, uv_loop_t *loop, uv_curlm_driver_metrics_t *metrics)
+{
+	while (test->pending) {
+		uv_run(loop, UV_RUN_ONCE);
+	}
+
+	uv_curlm_driver_metrics_get(test->driver, metrics);
+	uv_curlm_driver_destroy(test->driver);
+	uv_run(loop, UV_RUN_DEFAULT);
+}
+
+static void test_cache_anonymous_again(test_t *test)
+{
+	test_submit(test, NULL, "none", NULL);
+}
+
+static void test_cache_anonymous(test_t *test)
+{
+	test_submit(test, NULL, "none", test_cache_anonymous_again);
+}
+
+static void test_cache_bob(test_t *test)
+{
+	test_submit(test, test_headers_bob, "bob", test_cache_anonymous);
+}
+
+// alice, then bob once alice is stored, then the same request without headers twice
+static int test_cache(uv_loop_t *loop, test_server_t *server)
+{
+	test_t test = {0};
+	uv_curlm_driver_metrics_t metrics = {0};
+	size_t requests = atomic_load(&server->requests);
+
+	snprintf(test.url, sizeof(test.url), "http://127.0.0.1:%d/cache", server->port);
+	if (uv_curlm_driver_new(&test.driver, loop, NULL, NULL) != 0) {
+		fprintf(stderr, "unable to create the driver\n");
+		return 1;
+	}
+	uv_curlm_driver_cache_set(test.driver, 1 << 20);
+
+	test_submit(&test, test_headers_alice, "alice", test_cache_bob);
+	test_run(&test, loop, &metrics);
+
+	requests = atomic_load(&server->requests) - requests;
+	TEST_CHECK(&test, requests == 3, "expected 3 requests on the server, got %zu", requests);
+	TEST_CHECK(&test, metrics.values[UV_CURLM_METRIC_CACHE_HIT] == 1, "expected 1 cache hit, got %" PRIu64,
+			   metrics.values[UV_CURLM_METRIC_CACHE_HIT]);
+
+	return test.failures;
+}
+
+static void test_revalidate_again(test_t *test)
+{
+	test_submit(test, NULL, "fresh", NULL);
+}
+
+// the 304 has to be answered with the cached response even though the cache is gone by then
+static void test_revalidate_disable(test_t *test)
+{
+	test_submit(test, NULL, "fresh", NULL);
+	uv_curlm_driver_cache_set(test->driver, 0);
+}
+
+// a stored response that is stale right away, the second request revalidates it with If-None-Match
+static int test_revalidate(uv_loop_t *loop, test_server_t *server, bool disable)
+{
+	test_t test = {0};
+	uv_curlm_driver_metrics_t metrics = {0};
+	size_t requests = atomic_load(&server->requests);
+	size_t not_modified = atomic_load(&server->not_modified);
+
+	snprintf(test.url, sizeof(test.url), "http://127.0.0.1:%d/revalidate", server->port);
+	if (uv_curlm_driver_new(&test.driver, loop, NULL, NULL) != 0) {
+		fprintf(stderr, "unable to create the driver\n");
+		return 1;
+	}
+	uv_curlm_driver_cache_set(test.driver, 1 << 20);
+
+	test_submit(&test, NULL, "fresh", disable ? test_revalidate_disable : test_revalidate_again);
+	test_run(&test, loop, &metrics);
+
+	requests = atomic_load(&server->requests) - requests;
+	not_modified = atomic_load(&server->not_modified) - not_modified;
+	TEST_CHECK(&test, requests == 2, "expected 2 requests on the server, got %zu", requests);
+	TEST_CHECK(&test, not_modified == 1, "expected 1 conditional request answered with 304, got %zu", not_modified);
+	TEST_CHECK(&test, metrics.values[UV_CURLM_METRIC_CACHE_REVALIDATED] == 1, "expected 1 revalidation, got %" PRIu64,
+			   metrics.values[UV_CURLM_METRIC_CACHE_REVALIDATED]);
+	TEST_CHECK(&test, metrics.values[UV_CURLM_METRIC_CACHE_HIT] == 0, "expected no cache hit, got %" PRIu64,
+			   metrics.values[UV_CURLM_METRIC_CACHE_HIT]);
+	if (disable) {
+		TEST_CHECK(&test, metrics.values[UV_CURLM_METRIC_CACHE_SIZE] == 0, "expected an empty cache, got %" PRIu64 " bytes",
+				   metrics.values[UV_CURLM_METRIC_CACHE_SIZE]);
+	}
+
+	return test.failures;
+}
+
+// alice and bob in flight at the same time, then two requests without headers
+static int test_coalesce(uv_loop_t *loop, test_server_t *server)
+{
+	test_t test = {0};
+	uv_curlm_driver_metrics_t metrics = {0};
+	size_t requests = atomic_load(&server->requests);
+
+	snprintf(test.url, sizeof(test.url), "http://127.0.0.1:%d/coalesce", server->port);
+	if (uv_curlm_driver_new(&test.driver, loop, NULL, NULL) != 0) {
+		fprintf(stderr, "unable to create the driver\n");
+		return 1;
+	}
+	uv_curlm_driver_coalesce_set(test.driver, true);
+
+	test_submit(&test, test_headers_alice, "alice", NULL);
+	test_submit(&test, test_headers_bob, "bob", NULL);
+	test_submit(&test, NULL, "none", NULL);
+	test_submit(&test, NULL, "none", NULL);
+	test_run(&test, loop, &metrics);
+
+	requests = atomic_load(&server->requests) - requests;
+	TEST_CHECK(&test, requests == 3, "expected 3 requests on the server, got %zu", requests);
+	TEST_CHECK(&test, metrics.values[UV_CURLM_METRIC_COALESCED] == 1, "expected 1 coalesced request, got %" PRIu64,
+			   metrics.values[UV_CURLM_METRIC_COALESCED]);
+
+	return test.failures;
+}
+
+int main(void)
+{
+	test_server_t server = {0};
+	uv_loop_t loop;
+	int failures = 0;
+
+	curl_global_init(CURL_GLOBAL_ALL);
+	if (test_server_start(&server) != 0) {
+		return EXIT_FAILURE;
+	}
+	uv_loop_init(&loop);
+
+	failures += test_cache(&loop, &server);
+	failures += test_coalesce(&loop, &server);
+	failures += test_revalidate(&loop, &server, false);
+	failures += test_revalidate(&loop, &server, true);
+
+	uv_loop_close(&loop);
+	test_server_stop(&server);
+	curl_global_cleanup();
+
+	printf("%s\n", failures ? "FAIL" : "OK");
+
+	return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
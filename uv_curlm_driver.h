@@ -9,58 +9,1852 @@
  */
 
 // #include "uv_curlm_driver.h"
+// call uv_curlm_driver_new() with a loop and a done callback
+// attach curl easy handles using uv_curlm_driver_add_handle(driver, <curl_easy_handle_name>);
+// done callback is called for every finished transfer, the easy handle is already removed from the multi handle
+// or submit requests with uv_curlm_request(driver, method, url, headers, body, body_size, cb, userdata);
+// optionally cap in flight transfers per driver and per host with uv_curlm_driver_limits_set(), requests over the limits are
+// queued by priority and shared fairly between tenants, see uv_curlm_request_submit()
+// set chunk_cb in the request options to stream the body instead of buffering it, see uv_curlm_request_consumed()
+// optionally answer GET/HEAD requests from an in-memory cache with uv_curlm_driver_cache_set()
+// and share one transfer between identical GET/HEAD requests with uv_curlm_driver_coalesce_set()
+// poll counters, gauges and timing histograms with uv_curlm_driver_metrics_get() and uv_curlm_driver_histogram_get()
+// call uv_curlm_driver_destroy() on the loop thread, the driver memory is released once the loop runs the close callbacks
+//
+// sharded mode, N loops on N threads:
+// call uv_curlm_driver_shards_new() with the number of shards (0: one per CPU)
+// call uv_curlm_driver_shards_add_handle() from any thread, transfers are spread round-robin across the shards
+// done callback is called on the thread of the shard that ran the transfer
+// call uv_curlm_driver_shards_destroy() once no more transfers are submitted, the ones still in flight are aborted
+//
+// legacy single instance on uv_default_loop(), unless UV_CURLM_DRIVER_NO_LEGACY is defined:
 // call uv_curlm_driver_init()
 // attach curl easy handles using curl_multi_add_handle(curl_multi, <curl_easy_handle_name>);
 // implement curl_multi_info_check() and call curl_multi_info_read()
 // call uv_curlm_driver_clean()
+//
+// define TRACE and link trace.c to record trace events for the callbacks (see trace.h)
 
+#ifndef UV_CURLM_DRIVER_H_ONCE
+#define UV_CURLM_DRIVER_H_ONCE
+
+#include <ctype.h>
+#include <pthread.h>
 #include <stdbool.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <uv.h>
+#include <curl/curl.h>
+
+#include "debug.h"
+#include "hash_map.h"
+#include "histogram.h"
+#include "list.h"
+#include "memory.h"
+#include "trace.h"
+#include "uv_mpsc_queue.h"
+
+typedef struct uv_curlm_driver_s uv_curlm_driver_t;
+typedef struct uv_curlm_driver_shard_s uv_curlm_driver_shard_t;
+typedef struct uv_curlm_driver_shards_s uv_curlm_driver_shards_t;
+typedef struct uv_curlm_socket_s uv_curlm_socket_t;
+typedef struct uv_curlm_request_s uv_curlm_request_t;
+typedef struct uv_curlm_response_s uv_curlm_response_t;
+typedef struct uv_curlm_host_s uv_curlm_host_t;
+typedef struct uv_curlm_tenant_s uv_curlm_tenant_t;
+typedef struct uv_curlm_cache_entry_s uv_curlm_cache_entry_t;
+
+typedef void (*uv_curlm_driver_done_cb)(uv_curlm_driver_t *driver, CURL *curl_easy, CURLcode result, void *userdata);
+typedef void (*uv_curlm_driver_task_cb)(uv_curlm_driver_t *driver, void *data);
+typedef void (*uv_curlm_request_cb)(uv_curlm_response_t *response, void *userdata);
+typedef void (*uv_curlm_request_chunk_cb)(uv_curlm_request_t *request, const char *data, size_t size, void *userdata);
+typedef void (*uv_curlm_driver_backpressure_cb)(uv_curlm_driver_t *driver, bool backpressure, void *userdata);
+
+// idle easy handles kept per driver for reuse by uv_curlm_request()
+#define UV_CURLM_DRIVER_EASY_POOL_SIZE 64
+
+// uv_curlm_request_submit() return value when the queue is full
+#define UV_CURLM_REQUEST_BUSY -2
+
+#define UV_CURLM_HOST_SIZE 256
+#define UV_CURLM_TAG_STEP (1ULL << 20)
+
+// priority classes, lower runs first, any int works
+enum {
+	UV_CURLM_PRIORITY_HIGH = -1,
+	UV_CURLM_PRIORITY_NORMAL = 0,
+	UV_CURLM_PRIORITY_LOW = 1,
+};
+
+// counters and gauges kept by every driver, written on the loop thread and readable from any thread
+enum {
+	UV_CURLM_METRIC_SOCKETS,		   // gauge, socket polls libcurl asked for
+	UV_CURLM_METRIC_RUNNING,		   // gauge, transfers running in curl_multi
+	UV_CURLM_METRIC_IN_FLIGHT,		   // gauge, uv_curlm_request() transfers in flight
+	UV_CURLM_METRIC_QUEUED,			   // gauge, requests waiting for a slot
+	UV_CURLM_METRIC_DONE,			   // transfers completed, failed ones included
+	UV_CURLM_METRIC_FAILED,			   // transfers completed with a CURLcode other than CURLE_OK
+	UV_CURLM_METRIC_REFUSED,		   // requests refused with UV_CURLM_REQUEST_BUSY
+	UV_CURLM_METRIC_BYTES,			   // body bytes received
+	UV_CURLM_METRIC_TIMER,			   // curl_multi_timer_cb() calls
+	UV_CURLM_METRIC_EVENTS,			   // curl_socket_poll_cb() calls
+	UV_CURLM_METRIC_SOCKET_ACTIONS,	   // poll requests from libcurl, the ones repeating the current mask do not reach epoll
+	UV_CURLM_METRIC_POLL_START,		   // uv_poll_start() calls, each one is an epoll update
+	UV_CURLM_METRIC_CACHE_HIT,		   // requests answered from the cache without a transfer
+	UV_CURLM_METRIC_CACHE_MISS,		   // cacheable requests sent to the network, revalidations included
+	UV_CURLM_METRIC_CACHE_REVALIDATED, // stale entries confirmed with a 304
+	UV_CURLM_METRIC_CACHE_BYTES,	   // body bytes served from the cache
+	UV_CURLM_METRIC_CACHE_SIZE,		   // gauge, bytes held by the cache
+	UV_CURLM_METRIC_COALESCED,		   // requests that joined a transfer already in flight
+	UV_CURLM_METRIC_COUNT,
+};
+
+// timing histograms kept by every driver, values in microseconds
+// - DNS, CONNECT and TLS are the durations of those phases, recorded only for transfers that opened a connection
+// - TTFB and TOTAL are measured from the start of the transfer
+// - LOOP_LAG is how late curl_multi_timer_cb() ran compared to the timeout libcurl asked for
+enum {
+	UV_CURLM_HISTOGRAM_LOOP_LAG,
+	UV_CURLM_HISTOGRAM_DNS,
+	UV_CURLM_HISTOGRAM_CONNECT,
+	UV_CURLM_HISTOGRAM_TLS,
+	UV_CURLM_HISTOGRAM_TTFB,
+	UV_CURLM_HISTOGRAM_TOTAL,
+	UV_CURLM_HISTOGRAM_COUNT,
+};
+
+typedef struct {
+	uint64_t values[UV_CURLM_METRIC_COUNT]; // by UV_CURLM_METRIC_*
+} uv_curlm_driver_metrics_t;
+
+// scheduling limits, 0 means unlimited/disabled
+typedef struct {
+	size_t in_flight_max;	   // transfers handed to curl_multi
+	size_t host_in_flight_max; // transfers per host[:port]
+	size_t queued_max;		   // queued requests before uv_curlm_request_submit() refuses with UV_CURLM_REQUEST_BUSY
+	size_t queued_high;		   // backpressure_cb(true) at this queue depth, backpressure_cb(false) once it drained to half
+	uv_curlm_driver_backpressure_cb backpressure_cb;
+} uv_curlm_driver_limits_t;
+
+typedef struct {
+	const char *method;			// NULL means GET, HEAD is sent without reading a body
+	const char *url;
+	const char *const *headers; // NULL terminated array of "Name: value" strings
+	const void *body;			// copied, can be NULL
+	size_t body_size;
+	int priority;				// UV_CURLM_PRIORITY_*
+	const char *tenant;			// requests are shared fairly between tenants, NULL is one default tenant
+	unsigned int tenant_weight; // share of the tenant relative to the others, 0 means 1
+	// streaming, the body is handed to chunk_cb as it arrives and not kept in the response
+	// - bytes are pending from chunk_cb until the consumer acknowledges them with uv_curlm_request_consumed()
+	// - the transfer is paused once high_water bytes are pending and resumed from the loop when they drop to low_water
+	// - cb is called after the transfer is done and every chunk was acknowledged
+	uv_curlm_request_chunk_cb chunk_cb;
+	size_t high_water; // 0 never pauses
+	size_t low_water;
+} uv_curlm_request_options_t;
+
+struct uv_curlm_driver_s {
+	CURLM *curl_multi;
+	uv_timer_t curl_multi_timer;
+	uv_loop_t *loop;
+	uv_curlm_driver_done_cb done_cb;
+	void *userdata;
+	list_intrusive_t sockets; // open socket polls, closed on destroy if libcurl did not remove them
+	hash_map_t *requests;	  // in flight uv_curlm_request() transfers by easy handle
+	CURL *curl_easy_pool[UV_CURLM_DRIVER_EASY_POOL_SIZE];
+	size_t curl_easy_pool_count;
+	uv_curlm_driver_limits_t limits;
+	uv_curlm_request_t **queue; // binary heap by priority, fair queuing tag and submit order
+	size_t queue_size;
+	size_t queue_capacity;
+	size_t queued; // queue plus requests parked on a busy host
+	size_t in_flight;
+	uint64_t virtual_time;
+	uint64_t sequence;
+	hash_map_t *hosts;	 // host -> uv_curlm_host_t, while it has queued or in flight requests
+	hash_map_t *tenants; // tenant -> uv_curlm_tenant_t, while it has queued requests
+	uv_idle_t idle;
+	list_intrusive_t resumes;	  // paused streams to resume on the next loop iteration
+	list_intrusive_t draining;	  // finished streams waiting for the consumer to acknowledge the last chunks
+	list_intrusive_t completions; // cache hits to complete on the next loop iteration
+	hash_map_t *cache;			  // "METHOD url" -> uv_curlm_cache_entry_t, NULL while the cache is disabled
+	list_intrusive_t cache_lru;	  // most recently used entry at the head
+	size_t cache_size;			  // bytes held by the entries
+	size_t cache_size_max;		  // 0 while the cache is disabled
+	hash_map_t *flights;		  // "METHOD url" -> uv_curlm_request_t leading the transfer, NULL while coalescing is disabled
+	int handles;				  // open uv handles, the driver is freed when the last one is closed
+	atomic_uint_fast64_t metrics[UV_CURLM_METRIC_COUNT];
+	histogram_t *histograms[UV_CURLM_HISTOGRAM_COUNT];
+	uint64_t timer_deadline; // loop time the timer is due at in ns, compared with uv_hrtime() for the loop lag
+	bool backpressure;
+	bool pumping;
+	bool closing;
+	bool legacy; // completions go to the user defined curl_multi_info_check()
+};
+
+// shared by reference, see uv_curlm_response_ref()
+struct uv_curlm_response_s {
+	atomic_int refcount;
+	CURLcode result;
+	long status;
+	xbuffer_t headers; // raw header block of the last response
+	xbuffer_t body;
+};
+
+struct uv_curlm_request_s {
+	uv_curlm_driver_t *driver;
+	CURL *curl_easy; // only while in flight
+	char *method;
+	char *url;
+	struct curl_slist *headers;
+	char *body;
+	size_t body_size;
+	uv_curlm_response_t *response;
+	uv_curlm_request_cb cb;
+	void *userdata;
+	int priority;
+	uint64_t tag;
+	uint64_t sequence;
+	uv_curlm_host_t *host;
+	uv_curlm_tenant_t *tenant;		 // while in the queue
+	list_intrusive_node_t list_node; // while parked on the host or draining
+	uv_curlm_request_chunk_cb chunk_cb;
+	size_t high_water;
+	size_t low_water;
+	size_t pending; // streamed bytes not acknowledged yet
+	list_intrusive_node_t resume_node;
+	char *key;							 // "METHOD url", set for requests the cache or coalescing can answer
+	uv_curlm_response_t *cache_response; // stale cached response being revalidated
+	list_intrusive_t waiters;			 // identical requests sharing the response of this one
+	bool flight;						 // this request leads a transfer, waiters can be attached
+	bool in_flight;
+	bool paused;
+	bool resume_pending;
+	bool finished;
+};
+
+struct uv_curlm_host_s {
+	size_t requests; // queued, parked or in flight requests for this host
+	size_t in_flight;
+	list_intrusive_t parked; // dequeued requests waiting for a free slot on this host
+	char name[];
+};
+
+struct uv_curlm_tenant_s {
+	uint64_t tag; // tag of the last queued request
+	size_t queued;
+	char name[];
+};
+
+// one allocation per socket, taken from a process wide pool
+struct uv_curlm_socket_s {
+	uv_poll_t curl_socket_poll;
+	curl_socket_t curl_socket;
+	int events; // UV_READABLE/UV_WRITABLE mask the poll is started with, 0 when stopped
+	uv_curlm_driver_t *driver;
+	list_intrusive_node_t list_node;
+};
+
+typedef struct {
+	mpsc_queue_node_t queue_node;
+	uv_curlm_driver_task_cb cb;
+	void *data;
+} uv_curlm_driver_task_t;
+
+struct uv_curlm_cache_entry_s {
+	uv_curlm_response_t *response;
+	uint64_t expires; // uv_now() the entry turns stale at
+	size_t size;
+	list_intrusive_node_t list_node;
+	char key[];
+};
+
+struct uv_curlm_driver_shard_s {
+	uv_thread_t thread;
+	uv_loop_t loop;
+	uv_curlm_driver_t *driver;
+	uv_mpsc_queue_t tasks; // work submitted from other threads, run on the shard loop
+	uv_curlm_driver_done_cb done_cb;
+	hash_map_t *handles; // easy handles added with uv_curlm_driver_shards_add_handle() that are not done yet
+};
+
+struct uv_curlm_driver_shards_s {
+	size_t count;
+	atomic_size_t next;
+	uv_curlm_driver_shard_t *shards;
+};
+
+static int curl_debug_cb(CURL *handle, curl_infotype type, char *data, size_t size, void *userp);
+static void curl_multi_timer_start_cb(CURLM *handle, long timeout_ms, void *userp);
+static void curl_multi_timer_cb(uv_timer_t *handle);
+static int curl_socket_poll_start_cb(CURL *handle, curl_socket_t curl_socket, int action, void *userp, void *socketp);
+static void curl_socket_poll_cb(uv_poll_t *handle, int error, int events);
+static void curl_socket_poll_free_cb(uv_handle_t *handle);
+static void uv_curlm_driver_info_check(uv_curlm_driver_t *driver);
+static void uv_curlm_request_done(uv_curlm_request_t *request, CURLcode result);
+static void uv_curlm_request_complete(uv_curlm_request_t *request);
+static void uv_curlm_driver_cache_set(uv_curlm_driver_t *driver, size_t size_max);
+static void uv_curlm_driver_coalesce_set(uv_curlm_driver_t *driver, bool coalesce);
+static uv_curlm_request_t *uv_curlm_request_dequeue(uv_curlm_driver_t *driver);
+static void uv_curlm_queue_push(uv_curlm_driver_t *driver, uv_curlm_request_t *request);
+
+#ifndef UV_CURLM_DRIVER_NO_LEGACY
+static void curl_multi_info_check(void);
+
+static CURLM *curl_multi = NULL;
+static uv_curlm_driver_t *uv_curlm_driver_default = NULL;
+#endif
+
+// never destroyed, close callbacks of socket polls can run after uv_curlm_driver_destroy()
+static pthread_once_t uv_curlm_xpool_once = PTHREAD_ONCE_INIT;
+static xpool_t *curl_socket_xpool = NULL;
+static xpool_t *uv_curlm_request_xpool = NULL;
+
+// only the loop thread writes, a plain load and store is enough and avoids a locked instruction
+static inline void uv_curlm_metric_add(uv_curlm_driver_t *driver, int metric, uint64_t value)
+{
+	atomic_store_explicit(&driver->metrics[metric], atomic_load_explicit(&driver->metrics[metric], memory_order_relaxed) + value,
+						  memory_order_relaxed);
+}
+
+static inline void uv_curlm_metric_set(uv_curlm_driver_t *driver, int metric, uint64_t value)
+{
+	atomic_store_explicit(&driver->metrics[metric], value, memory_order_relaxed);
+}
+
+static void uv_curlm_xpool_init(void)
+{
+	curl_socket_xpool = xpool_new(sizeof(uv_curlm_socket_t), 0, XPOOL_OPT_ZERO);
+	uv_curlm_request_xpool = xpool_new(sizeof(uv_curlm_request_t), 0, XPOOL_OPT_ZERO);
+}
+
+static int uv_curlm_driver_new(uv_curlm_driver_t **driver, uv_loop_t *loop, uv_curlm_driver_done_cb done_cb, void *userdata)
+{
+	if (driver == NULL || loop == NULL) {
+		return -1;
+	}
+
+	*driver = xcalloc(1, sizeof(uv_curlm_driver_t));
+
+	if (hash_map_new(&(*driver)->requests, HASH_MAP_KEY_INTEGER, NULL) != HASH_MAP_SUCCESS ||
+		hash_map_new(&(*driver)->hosts, HASH_MAP_KEY_STRING, NULL) != HASH_MAP_SUCCESS ||
+		hash_map_new(&(*driver)->tenants, HASH_MAP_KEY_STRING, NULL) != HASH_MAP_SUCCESS) {
+		_error("failed to init request maps");
+		goto error_out;
+	}
+
+	for (size_t i = 0; i < UV_CURLM_HISTOGRAM_COUNT; i++) {
+		if (histogram_new(&(*driver)->histograms[i]) != HISTOGRAM_SUCCESS) {
+			_error("failed to init metrics histograms");
+			goto error_out;
+		}
+	}
+
+	(*driver)->curl_multi = curl_multi_init();
+	if ((*driver)->curl_multi == NULL) {
+		_error("failed to init curl multi hadndle");
+		goto error_out;
+	}
+
+	(*driver)->loop = loop;
+	(*driver)->done_cb = done_cb;
+	(*driver)->userdata = userdata;
+	list_intrusive_init(&(*driver)->sockets);
+
+	curl_multi_setopt((*driver)->curl_multi, CURLMOPT_TIMERFUNCTION, curl_multi_timer_start_cb);
+	curl_multi_setopt((*driver)->curl_multi, CURLMOPT_TIMERDATA, *driver);
+	curl_multi_setopt((*driver)->curl_multi, CURLMOPT_SOCKETFUNCTION, curl_socket_poll_start_cb);
+	curl_multi_setopt((*driver)->curl_multi, CURLMOPT_SOCKETDATA, *driver);
+	uv_timer_init(loop, &(*driver)->curl_multi_timer);
+	(*driver)->curl_multi_timer.data = *driver;
+	uv_idle_init(loop, &(*driver)->idle);
+	(*driver)->idle.data = *driver;
+	(*driver)->handles = 2;
+	list_intrusive_init(&(*driver)->resumes);
+	list_intrusive_init(&(*driver)->draining);
+	list_intrusive_init(&(*driver)->completions);
+	list_intrusive_init(&(*driver)->cache_lru);
+
+	pthread_once(&uv_curlm_xpool_once, uv_curlm_xpool_init);
+
+	return 0;
+
+error_out:
+	hash_map_destroy((*driver)->requests);
+	hash_map_destroy((*driver)->hosts);
+	hash_map_destroy((*driver)->tenants);
+	for (size_t i = 0; i < UV_CURLM_HISTOGRAM_COUNT; i++) {
+		histogram_destroy((*driver)->histograms[i]);
+	}
+	FREE_SAFE(*driver);
+
+	return -1;
+}
+
+static void uv_curlm_driver_free_cb(uv_handle_t *handle)
+{
+	uv_curlm_driver_t *driver = (uv_curlm_driver_t *) handle->data;
+
+	if (--driver->handles == 0) {
+		for (size_t i = 0; i < UV_CURLM_HISTOGRAM_COUNT; i++) {
+			histogram_destroy(driver->histograms[i]);
+		}
+		xfree(driver);
+	}
+}
+
+// in flight and queued requests complete with CURLE_ABORTED_BY_CALLBACK
+// other easy handles still attached to the multi handle are left to the caller
+static void uv_curlm_driver_destroy(uv_curlm_driver_t *driver)
+{
+	list_intrusive_node_t *list_node = NULL;
+	hash_map_iterator_t map_iterator = {0};
+	uv_curlm_request_t *request = NULL;
+	const void *key = NULL;
+	void *value = NULL;
+
+	if (driver == NULL) {
+		return;
+	}
+
+	driver->closing = true;
+
+	while (hash_map_iterator_init(driver->requests, &map_iterator) == HASH_MAP_SUCCESS &&
+		   hash_map_iterator_next(&map_iterator, &key, &value) == HASH_MAP_SUCCESS) {
+		request = (uv_curlm_request_t *) value;
+
+		hash_map_remove(driver->requests, key, NULL);
+		curl_multi_remove_handle(driver->curl_multi, request->curl_easy);
+		uv_curlm_request_done(request, CURLE_ABORTED_BY_CALLBACK);
+	}
+
+	// parked requests go back into the queue, the queue is then drained
+	hash_map_iterator_init(driver->hosts, &map_iterator);
+	while (hash_map_iterator_next(&map_iterator, &key, &value) == HASH_MAP_SUCCESS) {
+		uv_curlm_host_t *host = (uv_curlm_host_t *) value;
+
+		while (list_intrusive_peek(&host->parked, LIST_OPT_HEAD, &list_node) == LIST_SUCCESS) {
+			list_intrusive_remove(&host->parked, list_node);
+			uv_curlm_queue_push(driver, LIST_CONTAINER_OF(list_node, uv_curlm_request_t, list_node));
+		}
+	}
+
+	while ((request = uv_curlm_request_dequeue(driver))) {
+		driver->queued--;
+		uv_curlm_request_done(request, CURLE_ABORTED_BY_CALLBACK);
+	}
+	uv_curlm_metric_set(driver, UV_CURLM_METRIC_QUEUED, 0);
+
+	// streams still waiting for their consumer complete without the last acknowledgements
+	while (list_intrusive_peek(&driver->draining, LIST_OPT_HEAD, &list_node) == LIST_SUCCESS) {
+		list_intrusive_remove(&driver->draining, list_node);
+		uv_curlm_request_complete(LIST_CONTAINER_OF(list_node, uv_curlm_request_t, list_node));
+	}
+
+	// cache hits already have their response
+	while (list_intrusive_peek(&driver->completions, LIST_OPT_HEAD, &list_node) == LIST_SUCCESS) {
+		list_intrusive_remove(&driver->completions, list_node);
+		uv_curlm_request_complete(LIST_CONTAINER_OF(list_node, uv_curlm_request_t, list_node));
+	}
+
+	uv_curlm_driver_cache_set(driver, 0);
+	uv_curlm_driver_coalesce_set(driver, false);
+
+	hash_map_destroy(driver->requests);
+	hash_map_destroy(driver->hosts);
+	hash_map_destroy(driver->tenants);
+	driver->requests = NULL;
+	driver->hosts = NULL;
+	driver->tenants = NULL;
+	FREE_SAFE(driver->queue);
+
+	while (driver->curl_easy_pool_count) {
+		curl_easy_cleanup(driver->curl_easy_pool[--driver->curl_easy_pool_count]);
+	}
+
+	if (driver->curl_multi) {
+		curl_multi_cleanup(driver->curl_multi);
+		driver->curl_multi = NULL;
+	}
+
+	// sockets libcurl did not report as removed during cleanup
+	while (list_intrusive_peek(&driver->sockets, LIST_OPT_HEAD, &list_node) == LIST_SUCCESS) {
+		uv_curlm_socket_t *curlm_socket = LIST_CONTAINER_OF(list_node, uv_curlm_socket_t, list_node);
+
+		list_intrusive_remove(&driver->sockets, list_node);
+		uv_close((uv_handle_t *) &curlm_socket->curl_socket_poll, curl_socket_poll_free_cb);
+	}
+	uv_curlm_metric_set(driver, UV_CURLM_METRIC_SOCKETS, 0);
+	uv_curlm_metric_set(driver, UV_CURLM_METRIC_RUNNING, 0);
+
+	uv_close((uv_handle_t *) &driver->idle, uv_curlm_driver_free_cb);
+	uv_close((uv_handle_t *) &driver->curl_multi_timer, uv_curlm_driver_free_cb);
+}
+
+static int uv_curlm_driver_add_handle(uv_curlm_driver_t *driver, CURL *curl_easy)
+{
+	if (driver == NULL || driver->curl_multi == NULL || curl_easy == NULL) {
+		return -1;
+	}
+
+	if (curl_multi_add_handle(driver->curl_multi, curl_easy) != CURLM_OK) {
+		_error("failed to add curl easy handle");
+		return -1;
+	}
+
+	return 0;
+}
+
+#ifndef UV_CURLM_DRIVER_NO_LEGACY
+static int uv_curlm_driver_init(void)
+{
+	if (uv_curlm_driver_new(&uv_curlm_driver_default, uv_default_loop(), NULL, NULL) != 0) {
+		return -1;
+	}
+
+	uv_curlm_driver_default->legacy = true;
+	curl_multi = uv_curlm_driver_default->curl_multi;
+
+	return 0;
+}
+
+static int uv_curlm_driver_clean(void)
+{
+	uv_curlm_driver_destroy(uv_curlm_driver_default);
+	uv_curlm_driver_default = NULL;
+	curl_multi = NULL;
+
+	return 0;
+}
+#endif
+
+static void uv_curlm_response_init(uv_curlm_response_t *response)
+{
+	atomic_init(&response->refcount, 1);
+	response->result = CURLE_OK;
+	response->status = 0;
+	xbuffer_init(&response->headers);
+	xbuffer_init(&response->body);
+}
+
+// keep the response past the request callback
+static uv_curlm_response_t *uv_curlm_response_ref(uv_curlm_response_t *response)
+{
+	atomic_fetch_add_explicit(&response->refcount, 1, memory_order_relaxed);
+
+	return response;
+}
+
+static void uv_curlm_response_unref(uv_curlm_response_t *response)
+{
+	if (response == NULL || atomic_fetch_sub_explicit(&response->refcount, 1, memory_order_acq_rel) != 1) {
+		return;
+	}
+
+	xbuffer_free(&response->headers);
+	xbuffer_free(&response->body);
+	xfree(response);
+}
+
+static size_t uv_curlm_response_header_cb(char *ptr, size_t size, size_t nmemb, void *userdata)
+{
+	uv_curlm_response_t *response = (uv_curlm_response_t *) userdata;
+
+	// only keep the headers of the last response, e.g. after a redirect or a 100 Continue
+	// the status is parsed here so it is known before the first streamed chunk
+	if (size * nmemb > 5 && strncmp(ptr, "HTTP/", 5) == 0) {
+		const char *status = memchr(ptr, ' ', size * nmemb);
+
+		xbuffer_consume(&response->headers, response->headers.size - response->headers.offset);
+		response->status = status ? strtol(status + 1, NULL, 10) : 0;
+	}
+
+	return xbuffer_write_cb(ptr, size, nmemb, &response->headers);
+}
+
+// easy handles keep their connection, DNS and TLS session state across curl_easy_reset()
+static CURL *uv_curlm_driver_easy_get(uv_curlm_driver_t *driver)
+{
+	if (driver->curl_easy_pool_count) {
+		return driver->curl_easy_pool[--driver->curl_easy_pool_count];
+	}
+
+	return curl_easy_init();
+}
+
+static void uv_curlm_driver_easy_put(uv_curlm_driver_t *driver, CURL *curl_easy)
+{
+	// the driver can be destroyed from a request callback, after the pool was emptied
+	if (driver->closing || driver->curl_easy_pool_count == UV_CURLM_DRIVER_EASY_POOL_SIZE) {
+		curl_easy_cleanup(curl_easy);
+		return;
+	}
+
+	curl_easy_reset(curl_easy);
+	driver->curl_easy_pool[driver->curl_easy_pool_count++] = curl_easy;
+}
+
+// authority part of the URL (host[:port]) in lower case, without user info
+static void uv_curlm_url_host(const char *url, char *host, size_t size)
+{
+	const char *start = strstr(url, "://");
+	start = start ? start + 3 : url;
+
+	size_t length = strcspn(start, "/?#");
+	const char *user_info = memchr(start, '@', length);
+	if (user_info) {
+		length -= (size_t) (user_info + 1 - start);
+		start = user_info + 1;
+	}
+
+	if (length >= size) {
+		length = size - 1;
+	}
+
+	for (size_t i = 0; i < length; i++) {
+		host[i] = (char) tolower((unsigned char) start[i]);
+	}
+	host[length] = '\0';
+}
+
+static uv_curlm_host_t *uv_curlm_host_get(uv_curlm_driver_t *driver, const char *url)
+{
+	char name[UV_CURLM_HOST_SIZE] = {0};
+	uv_curlm_host_t *host = NULL;
+
+	uv_curlm_url_host(url, name, sizeof(name));
+	if (hash_map_get(driver->hosts, name, (void **) &host) == HASH_MAP_SUCCESS) {
+		host->requests++;
+		return host;
+	}
+
+	size_t length = strlen(name);
+	host = xmalloc(sizeof(uv_curlm_host_t) + length + 1);
+	host->requests = 1;
+	host->in_flight = 0;
+	list_intrusive_init(&host->parked);
+	memcpy(host->name, name, length + 1);
+
+	if (hash_map_insert(driver->hosts, host->name, host) != HASH_MAP_SUCCESS) {
+		xfree(host);
+		return NULL;
+	}
+
+	return host;
+}
+
+static void uv_curlm_host_release(uv_curlm_driver_t *driver, uv_curlm_host_t *host)
+{
+	if (--host->requests) {
+		return;
+	}
+
+	hash_map_remove(driver->hosts, host->name, NULL);
+	xfree(host);
+}
+
+static uv_curlm_tenant_t *uv_curlm_tenant_get(uv_curlm_driver_t *driver, const char *name)
+{
+	uv_curlm_tenant_t *tenant = NULL;
+
+	if (hash_map_get(driver->tenants, name, (void **) &tenant) == HASH_MAP_SUCCESS) {
+		return tenant;
+	}
+
+	size_t length = strlen(name);
+	tenant = xmalloc(sizeof(uv_curlm_tenant_t) + length + 1);
+	tenant->tag = 0;
+	tenant->queued = 0;
+	memcpy(tenant->name, name, length + 1);
+
+	if (hash_map_insert(driver->tenants, tenant->name, tenant) != HASH_MAP_SUCCESS) {
+		xfree(tenant);
+		return NULL;
+	}
+
+	return tenant;
+}
+
+static void uv_curlm_tenant_release(uv_curlm_driver_t *driver, uv_curlm_tenant_t *tenant)
+{
+	if (--tenant->queued) {
+		return;
+	}
+
+	hash_map_remove(driver->tenants, tenant->name, NULL);
+	xfree(tenant);
+}
+
+static bool uv_curlm_request_before(uv_curlm_request_t *request, uv_curlm_request_t *other)
+{
+	if (request->priority != other->priority) {
+		return request->priority < other->priority;
+	}
+
+	if (request->tag != other->tag) {
+		return request->tag < other->tag;
+	}
+
+	return request->sequence < other->sequence;
+}
+
+static void uv_curlm_queue_push(uv_curlm_driver_t *driver, uv_curlm_request_t *request)
+{
+	if (driver->queue_size == driver->queue_capacity) {
+		driver->queue_capacity = driver->queue_capacity ? driver->queue_capacity * 2 : 64;
+		driver->queue = xrealloc(driver->queue, driver->queue_capacity * sizeof(uv_curlm_request_t *));
+	}
+
+	size_t index = driver->queue_size++;
+	while (index > 0) {
+		size_t parent = (index - 1) / 2;
+		if (uv_curlm_request_before(request, driver->queue[parent]) == false) {
+			break;
+		}
+
+		driver->queue[index] = driver->queue[parent];
+		index = parent;
+	}
+
+	driver->queue[index] = request;
+}
+
+static uv_curlm_request_t *uv_curlm_queue_pop(uv_curlm_driver_t *driver)
+{
+	if (driver->queue_size == 0) {
+		return NULL;
+	}
+
+	uv_curlm_request_t *request = driver->queue[0];
+	uv_curlm_request_t *last = driver->queue[--driver->queue_size];
+	size_t index = 0;
+
+	while (index * 2 + 1 < driver->queue_size) {
+		size_t child = index * 2 + 1;
+		if (child + 1 < driver->queue_size && uv_curlm_request_before(driver->queue[child + 1], driver->queue[child])) {
+			child++;
+		}
+
+		if (uv_curlm_request_before(driver->queue[child], last) == false) {
+			break;
+		}
+
+		driver->queue[index] = driver->queue[child];
+		index = child;
+	}
+
+	if (driver->queue_size) {
+		driver->queue[index] = last;
+	}
+
+	return request;
+}
+
+static void uv_curlm_driver_backpressure_update(uv_curlm_driver_t *driver)
+{
+	if (driver->limits.queued_high == 0 || driver->limits.backpressure_cb == NULL) {
+		return;
+	}
+
+	if (driver->backpressure == false && driver->queued >= driver->limits.queued_high) {
+		driver->backpressure = true;
+		driver->limits.backpressure_cb(driver, true, driver->userdata);
+	} else if (driver->backpressure && driver->queued <= driver->limits.queued_high / 2) {
+		driver->backpressure = false;
+		driver->limits.backpressure_cb(driver, false, driver->userdata);
+	}
+}
+
+// self-clocked fair queuing, every queued request of a tenant advances its tag by UV_CURLM_TAG_STEP / weight
+// a tenant that was idle restarts at the current virtual time, so it can not bank credit
+static void uv_curlm_request_enqueue(uv_curlm_driver_t *driver, uv_curlm_request_t *request, const char *tenant_name, unsigned int tenant_weight)
+{
+	uv_curlm_tenant_t *tenant = uv_curlm_tenant_get(driver, tenant_name ? tenant_name : "");
+	uint64_t start = driver->virtual_time;
+
+	if (tenant && tenant->tag > start) {
+		start = tenant->tag;
+	}
+
+	request->tag = start + UV_CURLM_TAG_STEP / (tenant_weight ? tenant_weight : 1);
+	if (tenant) {
+		tenant->tag = request->tag;
+		tenant->queued++;
+		request->tenant = tenant;
+	}
+
+	uv_curlm_queue_push(driver, request);
+	driver->queued++;
+	uv_curlm_metric_set(driver, UV_CURLM_METRIC_QUEUED, driver->queued);
+}
+
+static uv_curlm_request_t *uv_curlm_request_dequeue(uv_curlm_driver_t *driver)
+{
+	uv_curlm_request_t *request = uv_curlm_queue_pop(driver);
+
+	if (request == NULL) {
+		return NULL;
+	}
+
+	if (request->tag > driver->virtual_time) {
+		driver->virtual_time = request->tag;
+	}
+
+	if (request->tenant) {
+		uv_curlm_tenant_release(driver, request->tenant);
+		request->tenant = NULL;
+	}
+
+	return request;
+}
+
+static bool uv_curlm_request_ready(uv_curlm_driver_t *driver, uv_curlm_request_t *request)
+{
+	if (driver->limits.in_flight_max && driver->in_flight >= driver->limits.in_flight_max) {
+		return false;
+	}
+
+	return request->host == NULL || driver->limits.host_in_flight_max == 0 || request->host->in_flight < driver->limits.host_in_flight_max;
+}
+
+static size_t uv_curlm_request_stream_cb(char *ptr, size_t size, size_t nmemb, void *userdata)
+{
+	uv_curlm_request_t *request = (uv_curlm_request_t *) userdata;
+
+	// libcurl keeps the chunk and delivers it again after curl_easy_pause(CURLPAUSE_CONT)
+	if (request->high_water && request->pending >= request->high_water) {
+		request->paused = true;
+		return CURL_WRITEFUNC_PAUSE;
+	}
+
+	request->pending += size * nmemb;
+	request->chunk_cb(request, ptr, size * nmemb, request->userdata);
+
+	return size * nmemb;
+}
+
+// runs while streams wait to be resumed or cache hits wait to be completed
+// curl_easy_pause() must not be called from inside libcurl callbacks, resumes are collected and done from the loop
+static void uv_curlm_driver_idle_cb(uv_idle_t *handle)
+{
+	uv_curlm_driver_t *driver = (uv_curlm_driver_t *) handle->data;
+	list_intrusive_node_t *list_node = NULL;
+	size_t count = 0;
+
+	// a resumed stream can pause and be queued again, only handle the ones queued so far
+	list_intrusive_size_get(&driver->resumes, &count);
+	while (count-- && list_intrusive_peek(&driver->resumes, LIST_OPT_HEAD, &list_node) == LIST_SUCCESS) {
+		uv_curlm_request_t *request = LIST_CONTAINER_OF(list_node, uv_curlm_request_t, resume_node);
+
+		list_intrusive_remove(&driver->resumes, list_node);
+		request->resume_pending = false;
+		request->paused = false;
+		curl_easy_pause(request->curl_easy, CURLPAUSE_CONT);
+	}
+
+	// same for cache hits, a callback can submit another hit
+	list_intrusive_size_get(&driver->completions, &count);
+	while (count-- && list_intrusive_peek(&driver->completions, LIST_OPT_HEAD, &list_node) == LIST_SUCCESS) {
+		list_intrusive_remove(&driver->completions, list_node);
+		uv_curlm_request_complete(LIST_CONTAINER_OF(list_node, uv_curlm_request_t, list_node));
+	}
+
+	if (list_intrusive_peek(&driver->resumes, LIST_OPT_HEAD, &list_node) != LIST_SUCCESS &&
+		list_intrusive_peek(&driver->completions, LIST_OPT_HEAD, &list_node) != LIST_SUCCESS) {
+		uv_idle_stop(handle);
+	}
+}
+
+// acknowledge streamed bytes, can be called from chunk_cb or later from the loop thread until cb was called
+static void uv_curlm_request_consumed(uv_curlm_request_t *request, size_t size)
+{
+	uv_curlm_driver_t *driver = request->driver;
+
+	request->pending -= size < request->pending ? size : request->pending;
+
+	if (request->finished) {
+		if (request->pending == 0) {
+			list_intrusive_remove(&driver->draining, &request->list_node);
+			uv_curlm_request_complete(request);
+		}
+		return;
+	}
+
+	if (request->paused && request->resume_pending == false && request->pending <= request->low_water) {
+		request->resume_pending = true;
+		list_intrusive_insert(&driver->resumes, LIST_OPT_TAIL, &request->resume_node);
+		uv_idle_start(&driver->idle, uv_curlm_driver_idle_cb);
+	}
+}
+
+static int uv_curlm_request_start(uv_curlm_request_t *request)
+{
+	uv_curlm_driver_t *driver = request->driver;
+
+	request->curl_easy = uv_curlm_driver_easy_get(driver);
+	if (request->curl_easy == NULL) {
+		_error("failed to init curl easy handle");
+		return -1;
+	}
+
+	curl_easy_setopt(request->curl_easy, CURLOPT_URL, request->url);
+	curl_easy_setopt(request->curl_easy, CURLOPT_HTTPHEADER, request->headers);
+	curl_easy_setopt(request->curl_easy, CURLOPT_HEADERFUNCTION, uv_curlm_response_header_cb);
+	curl_easy_setopt(request->curl_easy, CURLOPT_HEADERDATA, request->response);
+
+	if (request->chunk_cb) {
+		curl_easy_setopt(request->curl_easy, CURLOPT_WRITEFUNCTION, uv_curlm_request_stream_cb);
+		curl_easy_setopt(request->curl_easy, CURLOPT_WRITEDATA, request);
+	} else {
+		curl_easy_setopt(request->curl_easy, CURLOPT_WRITEFUNCTION, xbuffer_write_cb);
+		curl_easy_setopt(request->curl_easy, CURLOPT_WRITEDATA, &request->response->body);
+	}
+
+	if (request->method == NULL) {
+		curl_easy_setopt(request->curl_easy, CURLOPT_HTTPGET, 1L);
+	} else if (strcmp(request->method, "HEAD") == 0) {
+		curl_easy_setopt(request->curl_easy, CURLOPT_NOBODY, 1L);
+	} else if (strcmp(request->method, "POST") == 0) {
+		curl_easy_setopt(request->curl_easy, CURLOPT_POST, 1L);
+	} else {
+		curl_easy_setopt(request->curl_easy, CURLOPT_CUSTOMREQUEST, request->method);
+	}
+
+	if (request->body) {
+		curl_easy_setopt(request->curl_easy, CURLOPT_POSTFIELDSIZE_LARGE, (curl_off_t) request->body_size);
+		curl_easy_setopt(request->curl_easy, CURLOPT_POSTFIELDS, request->body);
+	} else if (request->method && strcmp(request->method, "POST") == 0) {
+		// without POSTFIELDS libcurl falls back to its default read callback, which reads stdin on the loop thread
+		curl_easy_setopt(request->curl_easy, CURLOPT_POSTFIELDSIZE_LARGE, (curl_off_t) 0);
+		curl_easy_setopt(request->curl_easy, CURLOPT_POSTFIELDS, "");
+	}
+
+	if (hash_map_insert(driver->requests, HASH_MAP_KEY(request->curl_easy), request) != HASH_MAP_SUCCESS) {
+		_error("failed to track request");
+		goto error_out;
+	}
+
+	if (uv_curlm_driver_add_handle(driver, request->curl_easy) != 0) {
+		hash_map_remove(driver->requests, HASH_MAP_KEY(request->curl_easy), NULL);
+		goto error_out;
+	}
+
+	request->in_flight = true;
+	driver->in_flight++;
+	uv_curlm_metric_set(driver, UV_CURLM_METRIC_IN_FLIGHT, driver->in_flight);
+	if (request->host) {
+		request->host->in_flight++;
+	}
+
+	return 0;
+
+error_out:
+	uv_curlm_driver_easy_put(driver, request->curl_easy);
+	request->curl_easy = NULL;
+
+	return -1;
+}
+
+static void uv_curlm_request_free(uv_curlm_request_t *request)
+{
+	if (request->curl_easy) {
+		uv_curlm_driver_easy_put(request->driver, request->curl_easy);
+	}
+
+	curl_slist_free_all(request->headers);
+	uv_curlm_response_unref(request->cache_response);
+	xfree(request->key);
+	xfree(request->method);
+	xfree(request->url);
+	xfree(request->body);
+	xpool_put(uv_curlm_request_xpool, request);
+}
+
+// release a request that was never queued or started, without calling its callback
+static void uv_curlm_request_discard(uv_curlm_request_t *request)
+{
+	uv_curlm_driver_t *driver = request->driver;
+	uv_curlm_host_t *host = request->host;
+
+	uv_curlm_response_unref(request->response);
+	uv_curlm_request_free(request);
+	if (host) {
+		uv_curlm_host_release(driver, host);
+	}
+}
+
+// start queued requests until a limit is hit, requests for a busy host wait on that host instead of blocking the queue
+static void uv_curlm_driver_pump(uv_curlm_driver_t *driver)
+{
+	if (driver->pumping || driver->closing) {
+		return;
+	}
+
+	driver->pumping = true;
+
+	while (driver->queue_size && (driver->limits.in_flight_max == 0 || driver->in_flight < driver->limits.in_flight_max)) {
+		uv_curlm_request_t *request = uv_curlm_request_dequeue(driver);
+
+		if (uv_curlm_request_ready(driver, request) == false) {
+			list_intrusive_insert(&request->host->parked, LIST_OPT_TAIL, &request->list_node);
+			continue;
+		}
+
+		driver->queued--;
+		uv_curlm_metric_set(driver, UV_CURLM_METRIC_QUEUED, driver->queued);
+		if (uv_curlm_request_start(request) != 0) {
+			uv_curlm_request_done(request, CURLE_FAILED_INIT);
+		}
+	}
+
+	driver->pumping = false;
+
+	uv_curlm_driver_backpressure_update(driver);
+}
+
+// copies the value of the first header called name from the last response, false if there is none
+static bool uv_curlm_response_header(uv_curlm_response_t *response, const char *name, char *value, size_t value_size)
+{
+	const char *line = response->headers.data + response->headers.offset;
+	const char *end = response->headers.data + response->headers.size;
+	size_t name_length = strlen(name);
+
+	if (response->headers.data == NULL) {
+		return false;
+	}
+
+	while (line < end) {
+		const char *line_end = memchr(line, '\n', (size_t) (end - line));
+		if (line_end == NULL) {
+			line_end = end;
+		}
+
+		if ((size_t) (line_end - line) > name_length && line[name_length] == ':' && strncasecmp(line, name, name_length) == 0) {
+			const char *start = line + name_length + 1;
+			const char *stop = line_end;
+
+			while (start < stop && isspace((unsigned char) *start)) {
+				start++;
+			}
+			while (stop > start && isspace((unsigned char) stop[-1])) {
+				stop--;
+			}
+
+			size_t length = (size_t) (stop - start) < value_size ? (size_t) (stop - start) : value_size - 1;
+			memcpy(value, start, length);
+			value[length] = '\0';
+
+			return true;
+		}
+
+		line = line_end + 1;
+	}
+
+	return false;
+}
+
+// matches a whole Cache-Control directive, "no-store" does not match "no-storefoo"
+// argument is set to the value after '=', or NULL if there is none
+static bool uv_curlm_cache_directive(const char *token, const char *name, const char **argument)
+{
+	size_t length = strlen(name);
+
+	if (strncasecmp(token, name, length) != 0) {
+		return false;
+	}
+
+	token += length;
+	while (isspace((unsigned char) *token)) {
+		token++;
+	}
+
+	if (*token == '=') {
+		*argument = token + 1;
+		return true;
+	}
+
+	*argument = NULL;
+
+	return *token == '\0';
+}
+
+// freshness lifetime in ms from Cache-Control max-age or Expires
+// returns -1 if the response must not be stored, 0 if it does not say, 1 if lifetime was set
+static int uv_curlm_cache_lifetime(uv_curlm_response_t *response, uint64_t *lifetime)
+{
+	char value[256] = {0};
+	char *token_save = NULL;
+	const char *argument = NULL;
+	bool no_cache = false;
+	int64_t max_age = -1;
+	int64_t age = 0;
+
+	if (uv_curlm_response_header(response, "Vary", value, sizeof(value)) && strchr(value, '*')) {
+		return -1;
+	}
+
+	if (uv_curlm_response_header(response, "Cache-Control", value, sizeof(value))) {
+		for (char *token = strtok_r(value, ",", &token_save); token; token = strtok_r(NULL, ",", &token_save)) {
+			while (isspace((unsigned char) *token)) {
+				token++;
+			}
+
+			// every directive is looked at, no-store can come after no-cache
+			if (uv_curlm_cache_directive(token, "no-store", &argument)) {
+				return -1;
+			} else if (uv_curlm_cache_directive(token, "no-cache", &argument)) {
+				no_cache = true;
+			} else if (uv_curlm_cache_directive(token, "max-age", &argument) && argument) {
+				max_age = strtoll(argument, NULL, 10);
+			}
+		}
+	}
+
+	// stored, but revalidated before every use
+	if (no_cache) {
+		max_age = 0;
+	}
+
+	if (max_age >= 0) {
+		if (uv_curlm_response_header(response, "Age", value, sizeof(value))) {
+			age = strtoll(value, NULL, 10);
+		}
+
+		*lifetime = max_age > age ? (uint64_t) (max_age - age) * 1000 : 0;
+		return 1;
+	}
+
+	if (uv_curlm_response_header(response, "Expires", value, sizeof(value))) {
+		time_t expires = curl_getdate(value, NULL);
+		time_t date = uv_curlm_response_header(response, "Date", value, sizeof(value)) ? curl_getdate(value, NULL) : -1;
+
+		if (date < 0) {
+			date = time(NULL);
+		}
+
+		// an invalid date such as "0" means already expired
+		*lifetime = expires > date ? (uint64_t) (expires - date) * 1000 : 0;
+		return 1;
+	}
+
+	return 0;
+}
+
+static void uv_curlm_cache_entry_remove(uv_curlm_driver_t *driver, uv_curlm_cache_entry_t *entry)
+{
+	hash_map_remove(driver->cache, entry->key, NULL);
+	list_intrusive_remove(&driver->cache_lru, &entry->list_node);
+	driver->cache_size -= entry->size;
+	uv_curlm_metric_set(driver, UV_CURLM_METRIC_CACHE_SIZE, driver->cache_size);
+	uv_curlm_response_unref(entry->response);
+	xfree(entry);
+}
+
+// least recently used entries go first
+static void uv_curlm_cache_evict(uv_curlm_driver_t *driver, size_t size_max)
+{
+	list_intrusive_node_t *list_node = NULL;
+
+	while (driver->cache_size > size_max && list_intrusive_peek(&driver->cache_lru, LIST_OPT_TAIL, &list_node) == LIST_SUCCESS) {
+		uv_curlm_cache_entry_remove(driver, LIST_CONTAINER_OF(list_node, uv_curlm_cache_entry_t, list_node));
+	}
+}
+
+// replaces an older entry for the same key
+static void uv_curlm_cache_store(uv_curlm_driver_t *driver, const char *key, uv_curlm_response_t *response, uint64_t lifetime)
+{
+	uv_curlm_cache_entry_t *entry = NULL;
+	size_t key_size = strlen(key) + 1;
+	size_t size = sizeof(uv_curlm_cache_entry_t) + key_size + response->headers.size + response->body.size;
+
+	if (hash_map_get(driver->cache, key, (void **) &entry) == HASH_MAP_SUCCESS) {
+		uv_curlm_cache_entry_remove(driver, entry);
+	}
+
+	if (size > driver->cache_size_max) {
+		return;
+	}
+
+	uv_curlm_cache_evict(driver, driver->cache_size_max - size);
+
+	entry = xmalloc(sizeof(uv_curlm_cache_entry_t) + key_size);
+	memcpy(entry->key, key, key_size);
+	entry->response = uv_curlm_response_ref(response);
+	entry->expires = uv_now(driver->loop) + lifetime;
+	entry->size = size;
+
+	if (hash_map_insert(driver->cache, entry->key, entry) != HASH_MAP_SUCCESS) {
+		uv_curlm_response_unref(entry->response);
+		xfree(entry);
+		return;
+	}
+
+	list_intrusive_insert(&driver->cache_lru, LIST_OPT_HEAD, &entry->list_node);
+	driver->cache_size += size;
+	uv_curlm_metric_set(driver, UV_CURLM_METRIC_CACHE_SIZE, driver->cache_size);
+}
+
+// returns true for a fresh hit, the request then completes on the next loop iteration without a transfer
+// a stale entry with a validator turns the request into a conditional one, see uv_curlm_cache_response()
+static bool uv_curlm_cache_lookup(uv_curlm_driver_t *driver, uv_curlm_request_t *request)
+{
+	uv_curlm_cache_entry_t *entry = NULL;
+	char header[512] = {0};
+	char value[256] = {0};
+
+	if (hash_map_get(driver->cache, request->key, (void **) &entry) != HASH_MAP_SUCCESS) {
+		uv_curlm_metric_add(driver, UV_CURLM_METRIC_CACHE_MISS, 1);
+		return false;
+	}
+
+	if (uv_now(driver->loop) < entry->expires) {
+		list_intrusive_remove(&driver->cache_lru, &entry->list_node);
+		list_intrusive_insert(&driver->cache_lru, LIST_OPT_HEAD, &entry->list_node);
+
+		uv_curlm_response_unref(request->response);
+		request->response = uv_curlm_response_ref(entry->response);
+		list_intrusive_insert(&driver->completions, LIST_OPT_TAIL, &request->list_node);
+		uv_idle_start(&driver->idle, uv_curlm_driver_idle_cb);
+
+		uv_curlm_metric_add(driver, UV_CURLM_METRIC_CACHE_HIT, 1);
+		uv_curlm_metric_add(driver, UV_CURLM_METRIC_CACHE_BYTES, entry->response->body.size - entry->response->body.offset);
+		return true;
+	}
+
+	uv_curlm_metric_add(driver, UV_CURLM_METRIC_CACHE_MISS, 1);
+
+	if (uv_curlm_response_header(entry->response, "ETag", value, sizeof(value))) {
+		snprintf(header, sizeof(header), "If-None-Match: %s", value);
+	} else if (uv_curlm_response_header(entry->response, "Last-Modified", value, sizeof(value))) {
+		snprintf(header, sizeof(header), "If-Modified-Since: %s", value);
+	} else {
+		uv_curlm_cache_entry_remove(driver, entry);
+		return false;
+	}
+
+	struct curl_slist *headers_new = curl_slist_append(request->headers, header);
+	if (headers_new) {
+		request->headers = headers_new;
+		request->cache_response = uv_curlm_response_ref(entry->response);
+	}
+
+	return false;
+}
+
+// stores a 200 response, a 304 answer to a revalidation is replaced by the cached response
+static void uv_curlm_cache_response(uv_curlm_driver_t *driver, uv_curlm_request_t *request)
+{
+	uv_curlm_response_t *response = request->response;
+	uint64_t lifetime = 0;
+	int rc = 0;
+
+	if (response->result != CURLE_OK) {
+		return;
+	}
+
+	// the caller never gets a bare 304, even if the cache was disabled while the revalidation was in flight
+	if (response->status == 304 && request->cache_response) {
+		// the 304 headers can carry a new lifetime, otherwise the one of the cached response applies again
+		rc = uv_curlm_cache_lifetime(response, &lifetime);
+		if (rc == 0) {
+			rc = uv_curlm_cache_lifetime(request->cache_response, &lifetime);
+		}
 
-#include <uv.h>
-#include <curl/curl.h>
+		request->response = request->cache_response;
+		request->cache_response = NULL;
+		uv_curlm_response_unref(response);
 
-#include "debug.h"
-#include "memory.h"
+		uv_curlm_metric_add(driver, UV_CURLM_METRIC_CACHE_REVALIDATED, 1);
+		uv_curlm_metric_add(driver, UV_CURLM_METRIC_CACHE_BYTES, request->response->body.size - request->response->body.offset);
 
-static int curl_debug_cb(CURL *handle, curl_infotype type, char *data, size_t size, void *userp);
-static void curl_multi_timer_start_cb(CURLM *handle, long timeout_ms, void *userp);
-static void curl_multi_timer_cb(uv_timer_t *handle);
-static int curl_socket_poll_start_cb(CURL *handle, curl_socket_t curl_socket, int action, void *userp, void *socketp);
-static void curl_socket_poll_cb(uv_poll_t *handle, int error, int events);
-static void curl_socket_poll_free_cb(uv_handle_t *handle);
-static void curl_multi_info_check(void);
+		if (driver->cache && rc >= 0) {
+			uv_curlm_cache_store(driver, request->key, request->response, lifetime);
+		}
+		return;
+	}
 
-static CURLM *curl_multi = NULL;
-static uv_timer_t curl_multi_timer = {0};
+	if (driver->cache == NULL || response->status != 200) {
+		return;
+	}
 
-static int uv_curlm_driver_init(void)
+	// without a lifetime the response is only kept if it can be revalidated
+	rc = uv_curlm_cache_lifetime(response, &lifetime);
+	if (rc < 0 || (rc == 0 && uv_curlm_response_header(response, "ETag", (char[1]){0}, 1) == false &&
+				   uv_curlm_response_header(response, "Last-Modified", (char[1]){0}, 1) == false)) {
+		return;
+	}
+
+	uv_curlm_cache_store(driver, request->key, response, lifetime);
+}
+
+// the request leads the transfer for its key, identical requests submitted until it is done wait on it
+static void uv_curlm_request_flight_begin(uv_curlm_driver_t *driver, uv_curlm_request_t *request)
 {
-	curl_multi = curl_multi_init();
-	if (curl_multi == NULL) {
-		_error("failed to init curl multi hadndle");
+	if (request->key == NULL || driver->flights == NULL || hash_map_insert(driver->flights, request->key, request) != HASH_MAP_SUCCESS) {
+		return;
+	}
+
+	list_intrusive_init(&request->waiters);
+	request->flight = true;
+}
+
+// every waiter completes with the response of the leading request, shared by reference
+static void uv_curlm_request_flight_end(uv_curlm_driver_t *driver, uv_curlm_request_t *request)
+{
+	list_intrusive_node_t *list_node = NULL;
+	void *value = NULL;
+
+	// removed first, so callbacks submitting the same request start a new transfer
+	if (driver->flights && hash_map_get(driver->flights, request->key, &value) == HASH_MAP_SUCCESS && value == request) {
+		hash_map_remove(driver->flights, request->key, NULL);
+	}
+	request->flight = false;
+
+	while (list_intrusive_peek(&request->waiters, LIST_OPT_HEAD, &list_node) == LIST_SUCCESS) {
+		uv_curlm_request_t *waiter = LIST_CONTAINER_OF(list_node, uv_curlm_request_t, list_node);
+
+		list_intrusive_remove(&request->waiters, list_node);
+		uv_curlm_response_unref(waiter->response);
+		waiter->response = uv_curlm_response_ref(request->response);
+		uv_curlm_request_complete(waiter);
+	}
+}
+
+// transfer side of a finished request, releases the easy handle and the scheduler slots
+static void uv_curlm_request_finish(uv_curlm_request_t *request, CURLcode result)
+{
+	uv_curlm_driver_t *driver = request->driver;
+	uv_curlm_host_t *host = request->host;
+	list_intrusive_node_t *list_node = NULL;
+
+	request->response->result = result;
+	request->finished = true;
+
+	if (request->curl_easy) {
+		curl_easy_getinfo(request->curl_easy, CURLINFO_RESPONSE_CODE, &request->response->status);
+		uv_curlm_driver_easy_put(driver, request->curl_easy);
+		request->curl_easy = NULL;
+	}
+
+	if (request->resume_pending) {
+		list_intrusive_remove(&driver->resumes, &request->resume_node);
+		request->resume_pending = false;
+	}
+
+	if (request->in_flight) {
+		driver->in_flight--;
+		uv_curlm_metric_set(driver, UV_CURLM_METRIC_IN_FLIGHT, driver->in_flight);
+	}
+
+	if (host) {
+		if (request->in_flight) {
+			host->in_flight--;
+
+			// a slot on this host is free, the oldest parked request goes back into the queue at its original position
+			if (driver->closing == false && list_intrusive_peek(&host->parked, LIST_OPT_HEAD, &list_node) == LIST_SUCCESS) {
+				list_intrusive_remove(&host->parked, list_node);
+				uv_curlm_queue_push(driver, LIST_CONTAINER_OF(list_node, uv_curlm_request_t, list_node));
+			}
+		}
+
+		uv_curlm_host_release(driver, host);
+		request->host = NULL;
+	}
+
+	request->in_flight = false;
+}
+
+static void uv_curlm_request_complete(uv_curlm_request_t *request)
+{
+	uv_curlm_response_t *response = request->response;
+
+	request->cb(response, request->userdata);
+
+	uv_curlm_response_unref(response);
+	uv_curlm_request_free(request);
+}
+
+static void uv_curlm_request_done(uv_curlm_request_t *request, CURLcode result)
+{
+	uv_curlm_driver_t *driver = request->driver;
+
+	uv_curlm_request_finish(request, result);
+
+	if (request->key) {
+		uv_curlm_cache_response(driver, request);
+	}
+
+	if (request->flight) {
+		uv_curlm_request_flight_end(driver, request);
+	}
+
+	// a stream consumer still working on chunks gets cb after its last uv_curlm_request_consumed()
+	if (request->pending && driver->closing == false) {
+		list_intrusive_insert(&driver->draining, LIST_OPT_TAIL, &request->list_node);
+	} else {
+		uv_curlm_request_complete(request);
+	}
+
+	uv_curlm_driver_pump(driver);
+}
+
+// submit a request on the driver loop thread, for shards use uv_curlm_driver_shards_call()
+// - the request is started right away unless a limit is hit, then it is queued (see uv_curlm_driver_limits_set())
+// - cb gets the response once the transfer is done, it is released after cb unless referenced with uv_curlm_response_ref()
+// - returns UV_CURLM_REQUEST_BUSY when the queue is full, cb is not called in that case
+static int uv_curlm_request_submit(uv_curlm_driver_t *driver, const uv_curlm_request_options_t *options, uv_curlm_request_cb cb, void *userdata)
+{
+	if (driver == NULL || driver->curl_multi == NULL || driver->closing || options == NULL || options->url == NULL || cb == NULL) {
 		return -1;
 	}
-	curl_multi_setopt(curl_multi, CURLMOPT_TIMERFUNCTION, curl_multi_timer_start_cb);
-	curl_multi_setopt(curl_multi, CURLMOPT_SOCKETFUNCTION, curl_socket_poll_start_cb);
-	uv_timer_init(uv_default_loop(), &curl_multi_timer);
+
+	uv_curlm_request_t *request = xpool_get(uv_curlm_request_xpool);
+	request->driver = driver;
+	request->cb = cb;
+	request->userdata = userdata;
+	request->priority = options->priority;
+	request->sequence = driver->sequence++;
+	request->chunk_cb = options->chunk_cb;
+	request->high_water = options->high_water;
+	request->low_water = options->low_water < options->high_water ? options->low_water : options->high_water / 2;
+	request->url = xstrdup(options->url);
+	request->response = xmalloc(sizeof(uv_curlm_response_t));
+	uv_curlm_response_init(request->response);
+
+	if (options->method && strcmp(options->method, "GET") != 0) {
+		request->method = xstrdup(options->method);
+	}
+
+	for (size_t i = 0; options->headers && options->headers[i]; i++) {
+		struct curl_slist *headers_new = curl_slist_append(request->headers, options->headers[i]);
+		if (headers_new == NULL) {
+			_error("failed to append request header");
+			goto error_out;
+		}
+		request->headers = headers_new;
+	}
+
+	if (options->body) {
+		request->body = xmalloc(options->body_size ? options->body_size : 1);
+		memcpy(request->body, options->body, options->body_size);
+		request->body_size = options->body_size;
+	}
+
+	// streams do not keep the body and are never cached or shared, neither are requests with their own
+	// headers since those are not part of the key and can change the response (e.g. Authorization)
+	if ((driver->cache || driver->flights) && request->body == NULL && request->chunk_cb == NULL && request->headers == NULL &&
+		(request->method == NULL || strcmp(request->method, "HEAD") == 0)) {
+		size_t key_size = strlen(request->method ? request->method : "GET") + 1 + strlen(request->url) + 1;
+
+		request->key = xmalloc(key_size);
+		snprintf(request->key, key_size, "%s %s", request->method ? request->method : "GET", request->url);
+
+		if (driver->cache && uv_curlm_cache_lookup(driver, request)) {
+			return 0;
+		}
+
+		uv_curlm_request_t *leader = NULL;
+		if (driver->flights && hash_map_get(driver->flights, request->key, (void **) &leader) == HASH_MAP_SUCCESS) {
+			list_intrusive_insert(&leader->waiters, LIST_OPT_TAIL, &request->list_node);
+			uv_curlm_metric_add(driver, UV_CURLM_METRIC_COALESCED, 1);
+
+			return 0;
+		}
+	}
+
+	if (driver->limits.host_in_flight_max) {
+		request->host = uv_curlm_host_get(driver, request->url);
+	}
+
+	if (driver->queue_size == 0 && uv_curlm_request_ready(driver, request)) {
+		if (uv_curlm_request_start(request) != 0) {
+			goto error_out;
+		}
+
+		uv_curlm_request_flight_begin(driver, request);
+
+		return 0;
+	}
+
+	if (driver->limits.queued_max && driver->queued >= driver->limits.queued_max) {
+		uv_curlm_request_discard(request);
+		uv_curlm_metric_add(driver, UV_CURLM_METRIC_REFUSED, 1);
+
+		return UV_CURLM_REQUEST_BUSY;
+	}
+
+	uv_curlm_request_enqueue(driver, request, options->tenant, options->tenant_weight);
+	uv_curlm_request_flight_begin(driver, request);
+	uv_curlm_driver_pump(driver);
 
 	return 0;
+
+error_out:
+	uv_curlm_request_discard(request);
+
+	return -1;
 }
 
-static int uv_curlm_driver_clean(void)
+// shorthand for uv_curlm_request_submit() with the default priority and tenant
+static int uv_curlm_request(uv_curlm_driver_t *driver, const char *method, const char *url, const char *const *headers, const void *body,
+							size_t body_size, uv_curlm_request_cb cb, void *userdata)
+{
+	uv_curlm_request_options_t options = {0};
+
+	options.method = method;
+	options.url = url;
+	options.headers = headers;
+	options.body = body;
+	options.body_size = body_size;
+
+	return uv_curlm_request_submit(driver, &options, cb, userdata);
+}
+
+// in-memory cache of GET and HEAD responses keyed by method and url, bounded to size_max bytes
+// - fresh entries (Cache-Control max-age, Expires) answer requests on the next loop iteration without a transfer
+// - stale entries are revalidated with If-None-Match or If-Modified-Since, a 304 completes with the cached response
+// - cached responses are shared by reference with every request they answer
+// - requests with their own headers bypass the cache, Vary is only honoured as far as "Vary: *" is never stored
+// - size_max 0 disables the cache and drops all entries
+static void uv_curlm_driver_cache_set(uv_curlm_driver_t *driver, size_t size_max)
+{
+	driver->cache_size_max = size_max;
+
+	if (driver->cache) {
+		uv_curlm_cache_evict(driver, size_max);
+	}
+
+	if (size_max == 0 && driver->cache) {
+		hash_map_destroy(driver->cache);
+		driver->cache = NULL;
+	} else if (size_max && driver->cache == NULL && hash_map_new(&driver->cache, HASH_MAP_KEY_STRING, NULL) != HASH_MAP_SUCCESS) {
+		_error("failed to init response cache");
+		driver->cache_size_max = 0;
+	}
+}
+
+// singleflight, GET and HEAD requests without a body or extra headers for a url that is already queued or in flight
+// join that transfer instead of starting their own, all of them complete with the same response
+static void uv_curlm_driver_coalesce_set(uv_curlm_driver_t *driver, bool coalesce)
+{
+	if (coalesce && driver->flights == NULL && hash_map_new(&driver->flights, HASH_MAP_KEY_STRING, NULL) != HASH_MAP_SUCCESS) {
+		_error("failed to init request coalescing");
+	} else if (coalesce == false && driver->flights) {
+		// transfers in flight keep their waiters, they just stop accepting new ones
+		hash_map_destroy(driver->flights);
+		driver->flights = NULL;
+	}
+}
+
+// limits apply to requests submitted afterwards, raising them starts queued requests right away
+static void uv_curlm_driver_limits_set(uv_curlm_driver_t *driver, const uv_curlm_driver_limits_t *limits)
+{
+	driver->limits = *limits;
+	uv_curlm_driver_pump(driver);
+}
+
+// queued requests, including the ones waiting for a busy host
+static size_t uv_curlm_driver_queued_get(uv_curlm_driver_t *driver)
+{
+	return driver->queued;
+}
+
+// cheap enough to poll every second, can be called from any thread while the driver exists
+static void uv_curlm_driver_metrics_get(uv_curlm_driver_t *driver, uv_curlm_driver_metrics_t *metrics)
+{
+	for (size_t i = 0; i < UV_CURLM_METRIC_COUNT; i++) {
+		metrics->values[i] = atomic_load_explicit(&driver->metrics[i], memory_order_relaxed);
+	}
+}
+
+// histogram is one of UV_CURLM_HISTOGRAM_*, can be called from any thread while the driver exists
+static int uv_curlm_driver_histogram_get(uv_curlm_driver_t *driver, int histogram, histogram_snapshot_t *snapshot)
+{
+	if (driver == NULL || histogram < 0 || histogram >= UV_CURLM_HISTOGRAM_COUNT || snapshot == NULL) {
+		return -1;
+	}
+
+	return histogram_snapshot(driver->histograms[histogram], snapshot) == HISTOGRAM_SUCCESS ? 0 : -1;
+}
+
+// per transfer timings, CURLINFO_*_TIME_T values are microseconds since the start of the transfer
+static void uv_curlm_driver_metrics_transfer(uv_curlm_driver_t *driver, CURL *curl_easy, CURLcode result)
+{
+	curl_off_t namelookup = 0, connect = 0, appconnect = 0, starttransfer = 0, total = 0, bytes = 0;
+
+	uv_curlm_metric_add(driver, UV_CURLM_METRIC_DONE, 1);
+	if (result != CURLE_OK) {
+		uv_curlm_metric_add(driver, UV_CURLM_METRIC_FAILED, 1);
+	}
+
+	curl_easy_getinfo(curl_easy, CURLINFO_NAMELOOKUP_TIME_T, &namelookup);
+	curl_easy_getinfo(curl_easy, CURLINFO_CONNECT_TIME_T, &connect);
+	curl_easy_getinfo(curl_easy, CURLINFO_APPCONNECT_TIME_T, &appconnect);
+	curl_easy_getinfo(curl_easy, CURLINFO_STARTTRANSFER_TIME_T, &starttransfer);
+	curl_easy_getinfo(curl_easy, CURLINFO_TOTAL_TIME_T, &total);
+	curl_easy_getinfo(curl_easy, CURLINFO_SIZE_DOWNLOAD_T, &bytes);
+
+	// a reused connection reports 0 for connect, its DNS time is only the cache lookup
+	if (connect > 0) {
+		histogram_record(driver->histograms[UV_CURLM_HISTOGRAM_DNS], (uint64_t) namelookup);
+		histogram_record(driver->histograms[UV_CURLM_HISTOGRAM_CONNECT], (uint64_t) (connect - namelookup));
+		if (appconnect > connect) {
+			histogram_record(driver->histograms[UV_CURLM_HISTOGRAM_TLS], (uint64_t) (appconnect - connect));
+		}
+	}
+
+	if (starttransfer > 0) {
+		histogram_record(driver->histograms[UV_CURLM_HISTOGRAM_TTFB], (uint64_t) starttransfer);
+	}
+
+	histogram_record(driver->histograms[UV_CURLM_HISTOGRAM_TOTAL], (uint64_t) total);
+	uv_curlm_metric_add(driver, UV_CURLM_METRIC_BYTES, (uint64_t) bytes);
+}
+
+static void uv_curlm_driver_shard_task_cb(uv_mpsc_queue_t *queue, mpsc_queue_node_t *queue_node)
+{
+	uv_curlm_driver_shard_t *shard = (uv_curlm_driver_shard_t *) queue->data;
+	uv_curlm_driver_task_t *task = LIST_CONTAINER_OF(queue_node, uv_curlm_driver_task_t, queue_node);
+
+	task->cb(shard->driver, task->data);
+	xfree(task);
+}
+
+static void uv_curlm_driver_shard_thread(void *arg)
+{
+	uv_curlm_driver_shard_t *shard = (uv_curlm_driver_shard_t *) arg;
+
+	// the task queue keeps the loop alive until the shard is stopped
+	uv_run(&shard->loop, UV_RUN_DEFAULT);
+}
+
+// the driver of a shard runs on the shard loop, so the shard is found from the loop
+static void uv_curlm_driver_shard_done_cb(uv_curlm_driver_t *driver, CURL *curl_easy, CURLcode result, void *userdata)
+{
+	uv_curlm_driver_shard_t *shard = LIST_CONTAINER_OF(driver->loop, uv_curlm_driver_shard_t, loop);
+
+	hash_map_remove(shard->handles, HASH_MAP_KEY(curl_easy), NULL);
+	if (shard->done_cb) {
+		shard->done_cb(driver, curl_easy, result, userdata);
+	}
+}
+
+// transfers still in flight are removed and reported to done_cb with CURLE_ABORTED_BY_CALLBACK, the caller cannot reach them
+static void uv_curlm_driver_shard_stop_cb(uv_curlm_driver_t *driver, void *data)
+{
+	uv_curlm_driver_shard_t *shard = (uv_curlm_driver_shard_t *) data;
+	hash_map_iterator_t map_iterator = {0};
+	const void *key = NULL;
+	void *value = NULL;
+
+	while (hash_map_iterator_init(shard->handles, &map_iterator) == HASH_MAP_SUCCESS &&
+		   hash_map_iterator_next(&map_iterator, &key, &value) == HASH_MAP_SUCCESS) {
+		CURL *curl_easy = (CURL *) value;
+
+		curl_multi_remove_handle(driver->curl_multi, curl_easy);
+		uv_curlm_driver_shard_done_cb(driver, curl_easy, CURLE_ABORTED_BY_CALLBACK, driver->userdata);
+	}
+
+	uv_curlm_driver_destroy(driver);
+	shard->driver = NULL;
+	uv_mpsc_queue_close(&shard->tasks, NULL);
+}
+
+static void uv_curlm_driver_shard_add_handle_cb(uv_curlm_driver_t *driver, void *data)
+{
+	uv_curlm_driver_shard_t *shard = LIST_CONTAINER_OF(driver->loop, uv_curlm_driver_shard_t, loop);
+	CURL *curl_easy = (CURL *) data;
+
+	if (hash_map_insert(shard->handles, HASH_MAP_KEY(curl_easy), curl_easy) != HASH_MAP_SUCCESS) {
+		_error("failed to track easy handle");
+		if (shard->done_cb) {
+			shard->done_cb(driver, curl_easy, CURLE_FAILED_INIT, driver->userdata);
+		}
+		return;
+	}
+
+	if (uv_curlm_driver_add_handle(driver, curl_easy) != 0) {
+		uv_curlm_driver_shard_done_cb(driver, curl_easy, CURLE_FAILED_INIT, driver->userdata);
+	}
+}
+
+static void uv_curlm_driver_shards_destroy(uv_curlm_driver_shards_t *shards);
+
+static int uv_curlm_driver_shards_new(uv_curlm_driver_shards_t **shards, size_t count, uv_curlm_driver_done_cb done_cb, void *userdata)
+{
+	if (shards == NULL) {
+		return -1;
+	}
+
+	if (count == 0) {
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		count = cpus > 0 ? (size_t) cpus : 1;
+	}
+
+	*shards = xcalloc(1, sizeof(uv_curlm_driver_shards_t));
+	(*shards)->shards = xcalloc(count, sizeof(uv_curlm_driver_shard_t));
+	atomic_init(&(*shards)->next, 0);
+
+	for (size_t i = 0; i < count; i++) {
+		uv_curlm_driver_shard_t *shard = &(*shards)->shards[i];
+
+		// everything is set up before the thread starts, so submitters never see a half initialized shard
+		if (uv_loop_init(&shard->loop) < 0) {
+			_error("failed to init uv loop");
+			goto error_out;
+		}
+
+		if (hash_map_new(&shard->handles, HASH_MAP_KEY_INTEGER, NULL) != HASH_MAP_SUCCESS) {
+			_error("failed to init shard handle map");
+			uv_loop_close(&shard->loop);
+			goto error_out;
+		}
+
+		shard->done_cb = done_cb;
+		if (uv_curlm_driver_new(&shard->driver, &shard->loop, uv_curlm_driver_shard_done_cb, userdata) != 0) {
+			hash_map_destroy(shard->handles);
+			uv_loop_close(&shard->loop);
+			goto error_out;
+		}
+
+		shard->tasks.data = shard;
+		if (uv_mpsc_queue_init(&shard->loop, &shard->tasks, 0, uv_curlm_driver_shard_task_cb) != 0) {
+			uv_curlm_driver_destroy(shard->driver);
+			uv_run(&shard->loop, UV_RUN_DEFAULT);
+			uv_loop_close(&shard->loop);
+			hash_map_destroy(shard->handles);
+			goto error_out;
+		}
+
+		if (uv_thread_create(&shard->thread, uv_curlm_driver_shard_thread, shard) < 0) {
+			_error("failed to create shard thread");
+			uv_curlm_driver_destroy(shard->driver);
+			uv_mpsc_queue_close(&shard->tasks, NULL);
+			uv_run(&shard->loop, UV_RUN_DEFAULT);
+			uv_loop_close(&shard->loop);
+			hash_map_destroy(shard->handles);
+			goto error_out;
+		}
+
+		(*shards)->count++;
+	}
+
+	return 0;
+
+error_out:
+	uv_curlm_driver_shards_destroy(*shards);
+	*shards = NULL;
+
+	return -1;
+}
+
+// run cb on the loop thread of a shard, index -1 picks the next shard round-robin
+// returns the shard index
+static int uv_curlm_driver_shards_call(uv_curlm_driver_shards_t *shards, int index, uv_curlm_driver_task_cb cb, void *data)
+{
+	if (shards == NULL || shards->count == 0 || cb == NULL || index >= (int) shards->count) {
+		return -1;
+	}
+
+	if (index < 0) {
+		index = (int) (atomic_fetch_add_explicit(&shards->next, 1, memory_order_relaxed) % shards->count);
+	}
+
+	uv_curlm_driver_task_t *task = xmalloc(sizeof(uv_curlm_driver_task_t));
+	task->cb = cb;
+	task->data = data;
+	uv_mpsc_queue_push(&shards->shards[index].tasks, &task->queue_node);
+
+	return index;
+}
+
+static int uv_curlm_driver_shards_add_handle(uv_curlm_driver_shards_t *shards, CURL *curl_easy)
+{
+	if (curl_easy == NULL) {
+		return -1;
+	}
+
+	return uv_curlm_driver_shards_call(shards, -1, uv_curlm_driver_shard_add_handle_cb, curl_easy) < 0 ? -1 : 0;
+}
+
+// sum of the shard metrics, gauges included
+static void uv_curlm_driver_shards_metrics_get(uv_curlm_driver_shards_t *shards, uv_curlm_driver_metrics_t *metrics)
+{
+	uv_curlm_driver_metrics_t shard_metrics = {0};
+
+	memset(metrics, 0, sizeof(uv_curlm_driver_metrics_t));
+	for (size_t i = 0; i < shards->count; i++) {
+		uv_curlm_driver_metrics_get(shards->shards[i].driver, &shard_metrics);
+		for (size_t j = 0; j < UV_CURLM_METRIC_COUNT; j++) {
+			metrics->values[j] += shard_metrics.values[j];
+		}
+	}
+}
+
+// merged histogram of all shards
+static int uv_curlm_driver_shards_histogram_get(uv_curlm_driver_shards_t *shards, int histogram, histogram_snapshot_t *snapshot)
 {
-	if (curl_multi) {
-		curl_multi_cleanup(curl_multi);
-		curl_multi = NULL;
+	histogram_snapshot_t *shard_snapshot = NULL;
+
+	if (shards == NULL || snapshot == NULL) {
+		return -1;
 	}
 
-	if (uv_has_ref((uv_handle_t *) &curl_multi_timer) && uv_is_closing((uv_handle_t *) &curl_multi_timer) == false) {
-		uv_close((uv_handle_t *) &curl_multi_timer, NULL);
+	shard_snapshot = xmalloc(sizeof(histogram_snapshot_t));
+	memset(snapshot, 0, sizeof(histogram_snapshot_t));
+
+	for (size_t i = 0; i < shards->count; i++) {
+		if (uv_curlm_driver_histogram_get(shards->shards[i].driver, histogram, shard_snapshot) != 0) {
+			xfree(shard_snapshot);
+			return -1;
+		}
+
+		if (shard_snapshot->count == 0) {
+			continue;
+		}
+
+		for (size_t j = 0; j < HISTOGRAM_BUCKETS; j++) {
+			snapshot->counts[j] += shard_snapshot->counts[j];
+		}
+
+		snapshot->min = snapshot->count == 0 || shard_snapshot->min < snapshot->min ? shard_snapshot->min : snapshot->min;
+		snapshot->max = shard_snapshot->max > snapshot->max ? shard_snapshot->max : snapshot->max;
+		snapshot->count += shard_snapshot->count;
+		snapshot->sum += shard_snapshot->sum;
 	}
 
+	xfree(shard_snapshot);
+
 	return 0;
 }
 
+// stops and joins the shard threads, must not race with uv_curlm_driver_shards_call()
+// transfers still in flight complete with CURLE_ABORTED_BY_CALLBACK on their shard thread
+static void uv_curlm_driver_shards_destroy(uv_curlm_driver_shards_t *shards)
+{
+	if (shards == NULL) {
+		return;
+	}
+
+	for (size_t i = 0; i < shards->count; i++) {
+		uv_curlm_driver_shards_call(shards, (int) i, uv_curlm_driver_shard_stop_cb, &shards->shards[i]);
+	}
+
+	for (size_t i = 0; i < shards->count; i++) {
+		uv_thread_join(&shards->shards[i].thread);
+		uv_loop_close(&shards->shards[i].loop);
+		hash_map_destroy(shards->shards[i].handles);
+	}
+
+	FREE_SAFE(shards->shards);
+	FREE_SAFE(shards);
+}
+
 static int curl_debug_cb(CURL *handle, curl_infotype type, char *data, size_t size, void *userp)
 {
 	switch (type) {
@@ -92,26 +1886,86 @@ static int curl_debug_cb(CURL *handle, curl_infotype type, char *data, size_t si
 	return 0;
 }
 
+static void uv_curlm_driver_info_check(uv_curlm_driver_t *driver)
+{
+	CURLMsg *curl_message = NULL;
+	int curl_messages_left = 0;
+	uv_curlm_request_t *request = NULL;
+
+	TRACE_BEGIN("curl_multi_info_check");
+
+#ifndef UV_CURLM_DRIVER_NO_LEGACY
+	if (driver->legacy) {
+		curl_multi_info_check();
+		TRACE_END("curl_multi_info_check");
+		return;
+	}
+#endif
+
+	// drain everything libcurl has queued, a single socket action can finish several transfers
+	while ((curl_message = curl_multi_info_read(driver->curl_multi, &curl_messages_left))) {
+		if (curl_message->msg != CURLMSG_DONE) {
+			continue;
+		}
+
+		// the message is invalidated by curl_multi_remove_handle()
+		CURL *curl_easy = curl_message->easy_handle;
+		CURLcode result = curl_message->data.result;
+
+		uv_curlm_driver_metrics_transfer(driver, curl_easy, result);
+		curl_multi_remove_handle(driver->curl_multi, curl_easy);
+		if (hash_map_remove(driver->requests, HASH_MAP_KEY(curl_easy), (void **) &request) == HASH_MAP_SUCCESS) {
+			uv_curlm_request_done(request, result);
+		} else if (driver->done_cb) {
+			driver->done_cb(driver, curl_easy, result, driver->userdata);
+		}
+	}
+
+	TRACE_END("curl_multi_info_check");
+}
+
 static void curl_multi_timer_start_cb(CURLM *handle, long timeout_ms, void *userp)
 {
 	___debug("curl_multi_timer_start_cb: %ld", timeout_ms);
 
+	uv_curlm_driver_t *driver = (uv_curlm_driver_t *) userp;
+
 	// don't call the timer anymore
 	// ref: https://curl.haxx.se/libcurl/c/CURLMOPT_TIMERFUNCTION.html
 	if (timeout_ms == -1) {
-		uv_timer_stop(&curl_multi_timer);
+		uv_timer_stop(&driver->curl_multi_timer);
 		return;
 	}
 
-	uv_timer_start(&curl_multi_timer, curl_multi_timer_cb, (uint64_t) timeout_ms, 0);
+	// the timer counts from the cached loop time, which can be a whole loop iteration old by now, update it so the timer and the
+	// deadline start from the moment libcurl asked, uv_now() is uv_hrtime() in ms so the lag can be measured with uv_hrtime()
+	uv_update_time(driver->loop);
+	driver->timer_deadline = (uv_now(driver->loop) + (uint64_t) timeout_ms) * 1000000;
+	uv_timer_start(&driver->curl_multi_timer, curl_multi_timer_cb, (uint64_t) timeout_ms, 0);
 }
 
 static void curl_multi_timer_cb(uv_timer_t *handle)
 {
 	___debug("curl_multi_timer_cb");
 
-	curl_multi_socket_action(curl_multi, CURL_SOCKET_TIMEOUT, 0, &(int){0});
-	curl_multi_info_check();
+	uv_curlm_driver_t *driver = (uv_curlm_driver_t *) handle->data;
+	uint64_t now = uv_hrtime();
+	int running = 0;
+
+	TRACE_BEGIN("curl_multi_timer_cb");
+
+	histogram_record(driver->histograms[UV_CURLM_HISTOGRAM_LOOP_LAG], now > driver->timer_deadline ? (now - driver->timer_deadline) / 1000 : 0);
+	uv_curlm_metric_add(driver, UV_CURLM_METRIC_TIMER, 1);
+
+	TRACE_BEGIN("curl_multi_socket_action");
+	curl_multi_socket_action(driver->curl_multi, CURL_SOCKET_TIMEOUT, 0, &running);
+	TRACE_END("curl_multi_socket_action");
+
+	uv_curlm_metric_set(driver, UV_CURLM_METRIC_RUNNING, (uint64_t) running);
+
+	uv_curlm_driver_info_check(driver);
+
+	TRACE_END("curl_multi_timer_cb");
 }
 
 static int curl_socket_poll_start_cb(CURL *curl_easy, curl_socket_t curl_socket, int action, void *userp, void *socketp)
@@ -119,58 +1973,81 @@ static int curl_socket_poll_start_cb(CURL *curl_easy, curl_socket_t curl_socket,
 	___debug("curl_socket_poll_start_cb");
 
 	// NOTE:
-	// - curl_socket_poll is "self contained"
+	// - curlm_socket is "self contained"
 	// - created, driven and destroyed by libcurl via this callback
 
-	uv_poll_t *curl_socket_poll = NULL;
+	uv_curlm_driver_t *driver = (uv_curlm_driver_t *) userp;
+	uv_curlm_socket_t *curlm_socket = NULL;
+	int events = 0;
 
 	if (socketp) {
-		curl_socket_poll = (uv_poll_t *) socketp;
+		curlm_socket = (uv_curlm_socket_t *) socketp;
 	} else {
-		// create curl_socket_poll and attach curl_socket to it's data pointer for usage in curl_socket_poll_cb()
-		curl_socket_poll = xcalloc(1, sizeof(uv_poll_t));
-		curl_socket_poll->data = xcalloc(1, sizeof(curl_socket_t));
-		*((curl_socket_t *) curl_socket_poll->data) = curl_socket;
-		uv_poll_init_socket(uv_default_loop(), curl_socket_poll, curl_socket);
-		curl_multi_assign(curl_multi, curl_socket, curl_socket_poll);
+		// create curlm_socket, the poll handle is embedded so curl_socket_poll_cb() can get back to it
+		curlm_socket = xpool_get(curl_socket_xpool);
+		curlm_socket->curl_socket = curl_socket;
+		curlm_socket->driver = driver;
+		uv_poll_init_socket(driver->loop, &curlm_socket->curl_socket_poll, curl_socket);
+		list_intrusive_insert(&driver->sockets, LIST_OPT_TAIL, &curlm_socket->list_node);
+		curl_multi_assign(driver->curl_multi, curl_socket, curlm_socket);
+		uv_curlm_metric_add(driver, UV_CURLM_METRIC_SOCKETS, 1);
 	}
 
-	uv_poll_stop(curl_socket_poll);
 	switch (action) {
 		case CURL_POLL_IN:
 			___debug("curl poll in");
-			uv_poll_start(curl_socket_poll, UV_READABLE, curl_socket_poll_cb);
+			events = UV_READABLE;
 			break;
 		case CURL_POLL_OUT:
 			___debug("curl poll out");
-			uv_poll_start(curl_socket_poll, UV_WRITABLE, curl_socket_poll_cb);
+			events = UV_WRITABLE;
 			break;
 		case CURL_POLL_INOUT:
 			___debug("curl poll inout");
-			uv_poll_start(curl_socket_poll, UV_READABLE | UV_WRITABLE, curl_socket_poll_cb);
+			events = UV_READABLE | UV_WRITABLE;
 			break;
 		case CURL_POLL_REMOVE:
-			// destroy curl_socket_poll
+			// destroy curlm_socket
 			___debug("curl poll remove");
-			uv_close((uv_handle_t *) curl_socket_poll, curl_socket_poll_free_cb);
-			curl_multi_assign(curl_multi, curl_socket, NULL);
-			break;
+			list_intrusive_remove(&driver->sockets, &curlm_socket->list_node);
+			uv_close((uv_handle_t *) &curlm_socket->curl_socket_poll, curl_socket_poll_free_cb);
+			curl_multi_assign(driver->curl_multi, curl_socket, NULL);
+			uv_curlm_metric_add(driver, UV_CURLM_METRIC_SOCKETS, (uint64_t) -1);
+			return 0;
 		default:
 			_error("unreachable");
 			abort();
 	}
 
+	uv_curlm_metric_add(driver, UV_CURLM_METRIC_SOCKET_ACTIONS, 1);
+
+	// libcurl repeats the same action a lot, only touch epoll when the mask changes
+	// uv_poll_start() on an active poll updates the mask in place, no uv_poll_stop() needed
+	if (events != curlm_socket->events) {
+		uv_poll_start(&curlm_socket->curl_socket_poll, events, curl_socket_poll_cb);
+		curlm_socket->events = events;
+		uv_curlm_metric_add(driver, UV_CURLM_METRIC_POLL_START, 1);
+	}
+
 	return 0;
 }
 
 static void curl_socket_poll_cb(uv_poll_t *handle, int error, int events)
 {
-	___debug("curl_socket_poll_cb");
+	// called for every socket event, only trace a sample
+	DEBUG_EVERY_N(DEBUG3, 100, ___debug("curl_socket_poll_cb"));
 
+	uv_curlm_socket_t *curlm_socket = LIST_CONTAINER_OF(handle, uv_curlm_socket_t, curl_socket_poll);
+	uv_curlm_driver_t *driver = curlm_socket->driver;
+	int running = 0;
 	int flags = 0;
 
+	TRACE_BEGIN("curl_socket_poll_cb");
+
 	if (error < 0) {
 		flags = CURL_CSELECT_ERR;
+		// libuv already stopped the poll, the next action from libcurl has to start it again even with the same mask
+		curlm_socket->events = 0;
 	}
 
 	if (!error && (events & UV_READABLE)) {
@@ -181,14 +2058,23 @@ static void curl_socket_poll_cb(uv_poll_t *handle, int error, int events)
 		flags |= CURL_CSELECT_OUT;
 	}
 
-	curl_multi_socket_action(curl_multi, *((curl_socket_t *) handle->data), flags, &(int){0});
-	curl_multi_info_check();
+	uv_curlm_metric_add(driver, UV_CURLM_METRIC_EVENTS, 1);
+
+	TRACE_BEGIN("curl_multi_socket_action");
+	curl_multi_socket_action(driver->curl_multi, curlm_socket->curl_socket, flags, &running);
+	TRACE_END("curl_multi_socket_action");
+
+	uv_curlm_metric_set(driver, UV_CURLM_METRIC_RUNNING, (uint64_t) running);
+	uv_curlm_driver_info_check(driver);
+
+	TRACE_END("curl_socket_poll_cb");
 }
 
 static void curl_socket_poll_free_cb(uv_handle_t *handle)
 {
 	___debug("curl_socket_poll_free_cb");
 
-	FREE_SAFE(handle->data);
-	FREE_SAFE(handle);
+	xpool_put(curl_socket_xpool, LIST_CONTAINER_OF(handle, uv_curlm_socket_t, curl_socket_poll));
 }
+
+#endif /* UV_CURLM_DRIVER_H_ONCE */
@@ -0,0 +1,549 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Copyright (c) 2019 Sartura Ltd.
+ *
+ * Author: Domagoj Pintaric <domagoj.pintaric@sartura.hr>
+ *
+ * https://www.sartura.hr/
+ */
+
+// load generator and benchmark for uv_curlm_driver.h, runs offline against a stub http/1.1 server on loopback
+// usage: uv_curlm_loadgen [-c concurrency] [-r rate] [-d seconds] [-s size] [-D delay_ms] [-k 0|1] [-u url]
+// - without -c and -r a suite of closed and open loop scenarios is run
+// - -c alone keeps that many requests in flight (closed loop)
+// - -r sends that many requests per second whatever the response times are (open loop), -c then caps the requests in flight
+// - -s, -D and -k set the stub server response body size, delay before responding and keep-alive
+// - -u skips the stub server and targets the given url
+// open loop latency is measured from the time the request was due, not the time it was sent, so queueing is not hidden
+// per request costs:
+// - allocations are the libcurl allocations (counted through curl_global_init_mem()), plus the x* allocations with -DMEMORY_PROFILE
+// - epoll_ctl() syscalls of the client thread are counted directly, by interposing epoll_ctl() in front of libc for libuv
+// - other syscalls are not counted, the calls that lead to them are reported instead: loop iterations (one epoll_wait each),
+//   curl timer callbacks, poll requests from libcurl (actions), epoll updates the driver passed on to libuv and socket events
+// - cpu time and context switches are those of the client thread, the stub server runs on its own thread
+// build: cc -O2 -D_GNU_SOURCE uv_curlm_loadgen.c list.c memory.c mpsc_queue.c hash_map.c histogram.c -luv -lcurl -lpthread -lm
+
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define UV_CURLM_DRIVER_NO_LEGACY
+#include "uv_curlm_driver.h"
+
+#define LOADGEN_DURATION_DEFAULT 2
+#define LOADGEN_SIZE_DEFAULT 1024
+#define LOADGEN_RATE_TICK_MS 1
+#define LOADGEN_REQUEST_SIZE 8192
+
+typedef struct {
+	size_t concurrency; // closed loop: requests in flight, open loop: cap on requests in flight, 0 uncapped
+	size_t rate;		// requests per second, 0 for closed loop
+} loadgen_scenario_t;
+
+typedef struct {
+	uv_loop_t loop;
+	uv_tcp_t listen;
+	uv_async_t stop;
+	uv_thread_t thread;
+	char *response;
+	size_t response_size;
+	uint64_t delay;
+	bool keep_alive;
+	int port;
+} loadgen_server_t;
+
+typedef struct {
+	uv_tcp_t tcp;
+	uv_timer_t delay;
+	uv_write_t write;
+	loadgen_server_t *server;
+	char request[LOADGEN_REQUEST_SIZE];
+	size_t request_size;
+	int handles;
+} loadgen_server_connection_t;
+
+typedef struct {
+	uv_loop_t *loop;
+	uv_curlm_driver_t *driver;
+	xpool_t *requests; // loadgen_request_t
+	uv_timer_t rate_timer;
+	uv_prepare_t loop_prepare; // counts loop iterations
+	size_t loop_count;
+	histogram_t *latency;
+	const char *url;
+	loadgen_scenario_t scenario;
+	uint64_t start;
+	uint64_t end;
+	size_t sent;
+	size_t done;
+	size_t errors;
+	size_t in_flight;
+} loadgen_t;
+
+typedef struct {
+	loadgen_t *loadgen;
+	uint64_t due; // uv_hrtime() the request was due at, latency is measured from here
+} loadgen_request_t;
+
+static const loadgen_scenario_t loadgen_suite[] = {
+	{1, 0}, {16, 0}, {256, 0}, {64, 1000}, {64, 10000}, {256, 20000},
+};
+
+static atomic_size_t loadgen_curl_allocations;
+static _Thread_local size_t loadgen_epoll_ctl_count; // per thread, the stub server loop has its own
+
+// libuv calls epoll_ctl() through the plt, this definition takes precedence over the libc one
+int epoll_ctl(int epfd, int op, int fd, struct epoll_event *event)
+{
+	loadgen_epoll_ctl_count++;
+
+	return (int) syscall(SYS_epoll_ctl, epfd, op, fd, event);
+}
+
+// libcurl allocations go through these, only the count is kept
+static void *loadgen_curl_malloc(size_t size)
+{
+	atomic_fetch_add_explicit(&loadgen_curl_allocations, 1, memory_order_relaxed);
+	return malloc(size);
+}
+
+static void *loadgen_curl_calloc(size_t nmemb, size_t size)
+{
+	atomic_fetch_add_explicit(&loadgen_curl_allocations, 1, memory_order_relaxed);
+	return calloc(nmemb, size);
+}
+
+static void *loadgen_curl_realloc(void *ptr, size_t size)
+{
+	atomic_fetch_add_explicit(&loadgen_curl_allocations, 1, memory_order_relaxed);
+	return realloc(ptr, size);
+}
+
+static char *loadgen_curl_strdup(const char *s)
+{
+	atomic_fetch_add_explicit(&loadgen_curl_allocations, 1, memory_order_relaxed);
+	return strdup(s);
+}
+
+static size_t loadgen_allocations(void)
+{
+	size_t count = atomic_load_explicit(&loadgen_curl_allocations, memory_order_relaxed);
+#ifdef MEMORY_PROFILE
+	size_t xcount = 0, xbytes = 0;
+
+	xmemory_profile_totals(&xcount, &xbytes);
+	count += xcount;
+#endif
+
+	return count;
+}
+
+// stub server, plain malloc/free so its allocations stay out of the MEMORY_PROFILE counts
+
+static void loadgen_server_close_cb(uv_handle_t *handle)
+{
+	loadgen_server_connection_t *connection = (loadgen_server_connection_t *) handle->data;
+
+	if (--connection->handles == 0) {
+		free(connection);
+	}
+}
+
+static void loadgen_server_connection_close(loadgen_server_connection_t *connection)
+{
+	if (uv_is_closing((uv_handle_t *) &connection->tcp) == 0) {
+		uv_close((uv_handle_t *) &connection->tcp, loadgen_server_close_cb);
+		uv_close((uv_handle_t *) &connection->delay, loadgen_server_close_cb);
+	}
+}
+
+static void loadgen_server_write_cb(uv_write_t *write, int status)
+{
+	loadgen_server_connection_t *connection = (loadgen_server_connection_t *) write->data;
+
+	if (status < 0 || connection->server->keep_alive == false) {
+		loadgen_server_connection_close(connection);
+	}
+}
+
+static void loadgen_server_respond(loadgen_server_connection_t *connection)
+{
+	uv_buf_t buffer = uv_buf_init(connection->server->response, (unsigned int) connection->server->response_size);
+
+	connection->write.data = connection;
+	uv_write(&connection->write, (uv_stream_t *) &connection->tcp, &buffer, 1, loadgen_server_write_cb);
+}
+
+static void loadgen_server_delay_cb(uv_timer_t *handle)
+{
+	loadgen_server_respond((loadgen_server_connection_t *) handle->data);
+}
+
+static void loadgen_server_alloc_cb(uv_handle_t *handle, size_t suggested_size, uv_buf_t *buffer)
+{
+	loadgen_server_connection_t *connection = (loadgen_server_connection_t *) handle->data;
+
+	buffer->base = connection->request + connection->request_size;
+	buffer->len = sizeof(connection->request) - connection->request_size;
+}
+
+// the client sends one request at a time per connection, bodies are not expected
+static void loadgen_server_read_cb(uv_stream_t *stream, ssize_t nread, const uv_buf_t *buffer)
+{
+	loadgen_server_connection_t *connection = (loadgen_server_connection_t *) stream->data;
+	char *end = NULL;
+
+	if (nread < 0) {
+		loadgen_server_connection_close(connection);
+		return;
+	}
+
+	connection->request_size += (size_t) nread;
+	end = memmem(connection->request, connection->request_size, "\r\n\r\n", 4);
+	if (end == NULL) {
+		if (connection->request_size == sizeof(connection->request)) {
+			loadgen_server_connection_close(connection);
+		}
+		return;
+	}
+
+	connection->request_size = 0;
+	if (connection->server->delay) {
+		uv_timer_start(&connection->delay, loadgen_server_delay_cb, connection->server->delay, 0);
+	} else {
+		loadgen_server_respond(connection);
+	}
+}
+
+static void loadgen_server_connection_cb(uv_stream_t *listen, int status)
+{
+	loadgen_server_t *server = (loadgen_server_t *) listen->data;
+	loadgen_server_connection_t *connection = NULL;
+
+	if (status < 0) {
+		return;
+	}
+
+	connection = calloc(1, sizeof(loadgen_server_connection_t));
+	connection->server = server;
+	connection->handles = 2;
+	uv_tcp_init(&server->loop, &connection->tcp);
+	uv_timer_init(&server->loop, &connection->delay);
+	connection->tcp.data = connection;
+	connection->delay.data = connection;
+
+	if (uv_accept(listen, (uv_stream_t *) &connection->tcp) != 0) {
+		loadgen_server_connection_close(connection);
+		return;
+	}
+
+	uv_tcp_nodelay(&connection->tcp, 1);
+	uv_read_start((uv_stream_t *) &connection->tcp, loadgen_server_alloc_cb, loadgen_server_read_cb);
+}
+
+static void loadgen_server_walk_cb(uv_handle_t *handle, void *arg)
+{
+	if (uv_is_closing(handle)) {
+		return;
+	}
+
+	if (handle->type == UV_TCP && handle->data != arg) {
+		loadgen_server_connection_close((loadgen_server_connection_t *) handle->data);
+	} else if (handle->type != UV_TIMER) {
+		uv_close(handle, NULL);
+	}
+}
+
+static void loadgen_server_stop_cb(uv_async_t *handle)
+{
+	uv_walk(handle->loop, loadgen_server_walk_cb, handle->data);
+}
+
+static void loadgen_server_thread(void *arg)
+{
+	loadgen_server_t *server = (loadgen_server_t *) arg;
+
+	uv_run(&server->loop, UV_RUN_DEFAULT);
+}
+
+// listens on an ephemeral loopback port, everything is set up before the server thread starts
+static int loadgen_server_start(loadgen_server_t *server, size_t size, uint64_t delay, bool keep_alive)
+{
+	struct sockaddr_storage address = {0};
+	int address_size = sizeof(address);
+	size_t header_size = 0;
+
+	server->delay = delay;
+	server->keep_alive = keep_alive;
+	server->response = malloc(size + 128);
+	header_size = (size_t) sprintf(server->response, "HTTP/1.1 200 OK\r\nContent-Length: %zu\r\nConnection: %s\r\n\r\n", size,
+								   keep_alive ? "keep-alive" : "close");
+	memset(server->response + header_size, 'x', size);
+	server->response_size = header_size + size;
+
+	uv_loop_init(&server->loop);
+	uv_tcp_init(&server->loop, &server->listen);
+	uv_async_init(&server->loop, &server->stop, loadgen_server_stop_cb);
+	server->listen.data = server;
+	server->stop.data = server;
+
+	uv_ip4_addr("127.0.0.1", 0, (struct sockaddr_in *) &address);
+	if (uv_tcp_bind(&server->listen, (struct sockaddr *) &address, 0) != 0 ||
+		uv_listen((uv_stream_t *) &server->listen, 4096, loadgen_server_connection_cb) != 0 ||
+		uv_tcp_getsockname(&server->listen, (struct sockaddr *) &address, &address_size) != 0) {
+		fprintf(stderr, "unable to listen on loopback\n");
+		return -1;
+	}
+
+	server->port = ntohs(((struct sockaddr_in *) &address)->sin_port);
+
+	return uv_thread_create(&server->thread, loadgen_server_thread, server);
+}
+
+static void loadgen_server_stop(loadgen_server_t *server)
+{
+	uv_async_send(&server->stop);
+	uv_thread_join(&server->thread);
+	uv_loop_close(&server->loop);
+	free(server->response);
+}
+
+// client
+
+static void loadgen_submit(loadgen_t *loadgen, uint64_t due);
+
+static void loadgen_response_cb(uv_curlm_response_t *response, void *userdata)
+{
+	loadgen_request_t *request = (loadgen_request_t *) userdata;
+	loadgen_t *loadgen = request->loadgen;
+	uint64_t now = uv_hrtime();
+
+	loadgen->in_flight--;
+	loadgen->done++;
+	if (response->result != CURLE_OK || response->status != 200) {
+		loadgen->errors++;
+	} else {
+		histogram_record(loadgen->latency, now - request->due);
+	}
+
+	xpool_put(loadgen->requests, request);
+
+	// closed loop, every completion sends the next request
+	if (loadgen->scenario.rate == 0 && now < loadgen->end) {
+		loadgen_submit(loadgen, now);
+	}
+}
+
+static void loadgen_submit(loadgen_t *loadgen, uint64_t due)
+{
+	loadgen_request_t *request = xpool_get(loadgen->requests);
+
+	request->loadgen = loadgen;
+	request->due = due;
+	loadgen->sent++;
+	loadgen->in_flight++;
+
+	if (uv_curlm_request(loadgen->driver, NULL, loadgen->url, NULL, NULL, 0, loadgen_response_cb, request) != 0) {
+		loadgen->in_flight--;
+		loadgen->done++;
+		loadgen->errors++;
+		xpool_put(loadgen->requests, request);
+	}
+}
+
+// open loop, sends every request that is due by now, a late tick catches up instead of dropping requests
+static void loadgen_rate_cb(uv_timer_t *handle)
+{
+	loadgen_t *loadgen = (loadgen_t *) handle->data;
+	uint64_t now = uv_hrtime();
+	uint64_t until = now < loadgen->end ? now : loadgen->end;
+	size_t due = (size_t) ((until - loadgen->start) * loadgen->scenario.rate / 1000000000ULL);
+
+	while (loadgen->sent < due) {
+		loadgen_submit(loadgen, loadgen->start + (uint64_t) loadgen->sent * 1000000000ULL / loadgen->scenario.rate);
+	}
+
+	if (now >= loadgen->end) {
+		uv_timer_stop(handle);
+	}
+}
+
+static void loadgen_prepare_cb(uv_prepare_t *handle)
+{
+	((loadgen_t *) handle->data)->loop_count++;
+}
+
+static void loadgen_print_header(void)
+{
+	printf("%11s %7s %9s %9s %11s %9s %9s %9s %9s %9s %9s %9s %9s %9s %9s %9s %9s\n", "concurrency", "rate", "requests", "errors", "req/s",
+		   "p50 us", "p99 us", "p999 us", "allocs", "loops", "timers", "actions", "epoll", "epoll_ctl", "events", "cpu us", "ctxsw");
+}
+
+static void loadgen_run(uv_loop_t *loop, const char *url, loadgen_scenario_t scenario, unsigned int duration)
+{
+	loadgen_t loadgen = {0};
+	histogram_snapshot_t *snapshot = xmalloc(sizeof(histogram_snapshot_t));
+	uv_curlm_driver_metrics_t metrics = {0};
+	uv_curlm_driver_limits_t limits = {0};
+	struct rusage usage_before = {0}, usage_after = {0};
+	uint64_t p50 = 0, p99 = 0, p999 = 0;
+	size_t allocations = 0;
+	size_t epoll_ctl_count = 0;
+
+	loadgen.loop = loop;
+	loadgen.url = url;
+	loadgen.scenario = scenario;
+	loadgen.requests = xpool_new(sizeof(loadgen_request_t), 0, 0);
+	histogram_new(&loadgen.latency);
+	if (uv_curlm_driver_new(&loadgen.driver, loop, NULL, NULL) != 0) {
+		fprintf(stderr, "unable to create the driver\n");
+		exit(EXIT_FAILURE);
+	}
+
+	if (scenario.rate) {
+		limits.in_flight_max = scenario.concurrency;
+		uv_curlm_driver_limits_set(loadgen.driver, &limits);
+	}
+
+	uv_prepare_init(loop, &loadgen.loop_prepare);
+	loadgen.loop_prepare.data = &loadgen;
+	uv_prepare_start(&loadgen.loop_prepare, loadgen_prepare_cb);
+
+	getrusage(RUSAGE_THREAD, &usage_before);
+	allocations = loadgen_allocations();
+	epoll_ctl_count = loadgen_epoll_ctl_count;
+	loadgen.start = uv_hrtime();
+	loadgen.end = loadgen.start + (uint64_t) duration * 1000000000ULL;
+
+	if (scenario.rate) {
+		uv_timer_init(loop, &loadgen.rate_timer);
+		loadgen.rate_timer.data = &loadgen;
+		uv_timer_start(&loadgen.rate_timer, loadgen_rate_cb, 0, LOADGEN_RATE_TICK_MS);
+	} else {
+		for (size_t i = 0; i < scenario.concurrency; i++) {
+			loadgen_submit(&loadgen, loadgen.start);
+		}
+	}
+
+	while (uv_hrtime() < loadgen.end || loadgen.in_flight) {
+		uv_run(loop, UV_RUN_ONCE);
+	}
+
+	uint64_t elapsed = uv_hrtime() - loadgen.start;
+
+	allocations = loadgen_allocations() - allocations;
+	epoll_ctl_count = loadgen_epoll_ctl_count - epoll_ctl_count;
+	getrusage(RUSAGE_THREAD, &usage_after);
+	uv_prepare_stop(&loadgen.loop_prepare);
+	uv_curlm_driver_metrics_get(loadgen.driver, &metrics);
+
+	histogram_snapshot(loadgen.latency, snapshot);
+	histogram_snapshot_percentile(snapshot, 50, &p50);
+	histogram_snapshot_percentile(snapshot, 99, &p99);
+	histogram_snapshot_percentile(snapshot, 99.9, &p999);
+
+	double done = loadgen.done ? (double) loadgen.done : 1;
+	uint64_t cpu = (uint64_t) (usage_after.ru_utime.tv_sec - usage_before.ru_utime.tv_sec + usage_after.ru_stime.tv_sec -
+							   usage_before.ru_stime.tv_sec) * 1000000 +
+				   (uint64_t) (usage_after.ru_utime.tv_usec - usage_before.ru_utime.tv_usec + usage_after.ru_stime.tv_usec -
+							   usage_before.ru_stime.tv_usec);
+	long context_switches = usage_after.ru_nvcsw - usage_before.ru_nvcsw + usage_after.ru_nivcsw - usage_before.ru_nivcsw;
+
+	printf("%11zu %7zu %9zu %9zu %11.0f %9.1f %9.1f %9.1f %9.2f %9.2f %9.2f %9.2f %9.2f %9.2f %9.2f %9.2f %9.3f\n", scenario.concurrency,
+		   scenario.rate, loadgen.done, loadgen.errors, (double) loadgen.done * 1e9 / (double) elapsed, (double) p50 / 1000, (double) p99 / 1000,
+		   (double) p999 / 1000, (double) allocations / done, (double) loadgen.loop_count / done,
+		   (double) metrics.values[UV_CURLM_METRIC_TIMER] / done, (double) metrics.values[UV_CURLM_METRIC_SOCKET_ACTIONS] / done,
+		   (double) metrics.values[UV_CURLM_METRIC_POLL_START] / done, (double) epoll_ctl_count / done,
+		   (double) metrics.values[UV_CURLM_METRIC_EVENTS] / done, (double) cpu / done, (double) context_switches / done);
+
+	uv_close((uv_handle_t *) &loadgen.loop_prepare, NULL);
+	if (scenario.rate) {
+		uv_close((uv_handle_t *) &loadgen.rate_timer, NULL);
+	}
+	uv_curlm_driver_destroy(loadgen.driver);
+	uv_run(loop, UV_RUN_DEFAULT);
+
+	histogram_destroy(loadgen.latency);
+	xpool_destroy(loadgen.requests);
+	xfree(snapshot);
+}
+
+int main(int argc, char **argv)
+{
+	loadgen_server_t server = {0};
+	loadgen_scenario_t scenario = {0};
+	unsigned int duration = LOADGEN_DURATION_DEFAULT;
+	size_t size = LOADGEN_SIZE_DEFAULT;
+	uint64_t delay = 0;
+	bool keep_alive = true;
+	const char *url = NULL;
+	char url_local[64] = {0};
+	uv_loop_t loop;
+	int option = 0;
+
+	while ((option = getopt(argc, argv, "c:r:d:s:D:k:u:")) != -1) {
+		switch (option) {
+			case 'c':
+				scenario.concurrency = strtoul(optarg, NULL, 10);
+				break;
+			case 'r':
+				scenario.rate = strtoul(optarg, NULL, 10);
+				break;
+			case 'd':
+				duration = (unsigned int) strtoul(optarg, NULL, 10);
+				break;
+			case 's':
+				size = strtoul(optarg, NULL, 10);
+				break;
+			case 'D':
+				delay = strtoull(optarg, NULL, 10);
+				break;
+			case 'k':
+				keep_alive = strtol(optarg, NULL, 10) != 0;
+				break;
+			case 'u':
+				url = optarg;
+				break;
+			default:
+				fprintf(stderr, "usage: %s [-c concurrency] [-r rate] [-d seconds] [-s size] [-D delay_ms] [-k 0|1] [-u url]\n", argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+
+	curl_global_init_mem(CURL_GLOBAL_ALL, loadgen_curl_malloc, free, loadgen_curl_realloc, loadgen_curl_strdup, loadgen_curl_calloc);
+
+	if (url == NULL) {
+		if (loadgen_server_start(&server, size, delay, keep_alive) != 0) {
+			return EXIT_FAILURE;
+		}
+		snprintf(url_local, sizeof(url_local), "http://127.0.0.1:%d/", server.port);
+		url = url_local;
+		printf("stub server on %s, %zu byte responses, %" PRIu64 " ms delay, keep-alive %s\n", url, size, delay, keep_alive ? "on" : "off");
+	}
+
+	uv_loop_init(&loop);
+	loadgen_print_header();
+
+	if (scenario.concurrency || scenario.rate) {
+		loadgen_run(&loop, url, scenario, duration);
+	} else {
+		for (size_t i = 0; i < sizeof(loadgen_suite) / sizeof(loadgen_suite[0]); i++) {
+			loadgen_run(&loop, url, loadgen_suite[i], duration);
+		}
+	}
+
+	uv_loop_close(&loop);
+	if (url == url_local) {
+		loadgen_server_stop(&server);
+	}
+	curl_global_cleanup();
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,108 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Copyright (c) 2019 Sartura Ltd.
+ *
+ * Author: Domagoj Pintaric <domagoj.pintaric@sartura.hr>
+ *
+ * https://www.sartura.hr/
+ */
+
+// #include "uv_mpsc_queue.h"
+// call uv_mpsc_queue_init() on the loop thread with a callback that is called for every node
+// call uv_mpsc_queue_push() from any thread, nodes are delivered on the loop thread in FIFO order per producer
+// call uv_mpsc_queue_close() on the loop thread, the queue memory must stay valid until the close callback
+
+#ifndef UV_MPSC_QUEUE_H_ONCE
+#define UV_MPSC_QUEUE_H_ONCE
+
+#include <stdatomic.h>
+#include <stddef.h>
+
+#include <uv.h>
+
+#include "debug.h"
+#include "mpsc_queue.h"
+
+// maximum number of nodes handled per loop iteration, keeps producers from starving the rest of the loop
+#define UV_MPSC_QUEUE_BATCH_DEFAULT 256
+
+typedef struct uv_mpsc_queue_s uv_mpsc_queue_t;
+typedef void (*uv_mpsc_queue_cb)(uv_mpsc_queue_t *queue, mpsc_queue_node_t *queue_node);
+
+struct uv_mpsc_queue_s {
+	mpsc_queue_t queue;
+	atomic_int wakeup_pending; // set by the first producer after a drain, at most one uv_async_send per drain
+	uv_async_t async;
+	size_t batch;
+	uv_mpsc_queue_cb cb;
+	void *data;
+};
+
+static void uv_mpsc_queue_async_cb(uv_async_t *handle);
+
+static int uv_mpsc_queue_init(uv_loop_t *loop, uv_mpsc_queue_t *queue, size_t batch, uv_mpsc_queue_cb cb)
+{
+	if (loop == NULL || queue == NULL || cb == NULL) {
+		return -1;
+	}
+
+	mpsc_queue_init(&queue->queue);
+	atomic_init(&queue->wakeup_pending, 0);
+	queue->batch = batch ? batch : UV_MPSC_QUEUE_BATCH_DEFAULT;
+	queue->cb = cb;
+	queue->async.data = queue;
+
+	if (uv_async_init(loop, &queue->async, uv_mpsc_queue_async_cb) < 0) {
+		_error("failed to init uv async handle");
+		return -1;
+	}
+
+	return 0;
+}
+
+static void uv_mpsc_queue_push(uv_mpsc_queue_t *queue, mpsc_queue_node_t *queue_node)
+{
+	mpsc_queue_push(&queue->queue, queue_node);
+
+	// coalesce wakeups, only the producer that finds the flag clear pays for the syscall
+	if (atomic_exchange_explicit(&queue->wakeup_pending, 1, memory_order_acq_rel) == 0) {
+		uv_async_send(&queue->async);
+	}
+}
+
+static void uv_mpsc_queue_close(uv_mpsc_queue_t *queue, uv_close_cb close_cb)
+{
+	if (uv_is_closing((uv_handle_t *) &queue->async) == 0) {
+		uv_close((uv_handle_t *) &queue->async, close_cb);
+	}
+}
+
+static void uv_mpsc_queue_async_cb(uv_async_t *handle)
+{
+	___debug("uv_mpsc_queue_async_cb");
+
+	uv_mpsc_queue_t *queue = (uv_mpsc_queue_t *) handle->data;
+	mpsc_queue_node_t *queue_node = NULL;
+	mpsc_queue_rc rc = MPSC_QUEUE_SUCCESS;
+
+	// clear before draining, a push that misses this drain will wake us up again
+	// an exchange rather than a store, so it reads from the last producer exchange and the drain sees that push
+	atomic_exchange_explicit(&queue->wakeup_pending, 0, memory_order_acq_rel);
+
+	for (size_t i = 0; i < queue->batch; i++) {
+		rc = mpsc_queue_pop(&queue->queue, &queue_node);
+		if (rc != MPSC_QUEUE_SUCCESS) {
+			break;
+		}
+
+		queue->cb(queue, queue_node);
+	}
+
+	// batch limit reached or a producer is mid-push, continue on the next loop iteration
+	if (rc != MPSC_QUEUE_FAILURE_EMPTY && atomic_exchange_explicit(&queue->wakeup_pending, 1, memory_order_acq_rel) == 0) {
+		uv_async_send(&queue->async);
+	}
+}
+
+#endif /* UV_MPSC_QUEUE_H_ONCE */
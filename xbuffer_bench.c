@@ -0,0 +1,159 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Copyright (c) 2019 Sartura Ltd.
+ *
+ * Author: Juraj Vijtiuk <juraj.vijtiuk@sartura.hr>
+ *
+ * https://www.sartura.hr/
+ */
+
+// benchmark for xbuffer (memory.h) against the CURLOPT_WRITEFUNCTION users wrote by hand, xrealloc() to the exact new size on
+// every chunk
+// usage: xbuffer_bench [-b body_size] [-c chunk_size]
+// - 1 KB, 10 KB, 100 KB, 1 MB, 10 MB and 100 MB bodies (or -b body_size) are delivered in 16 KB chunks (or -c chunk_size), the
+//   largest chunk libcurl hands to a write callback by default
+// - both sides receive through a write callback with the libcurl signature, xbuffer through xbuffer_write_cb()
+// - small bodies are repeated so every measurement covers at least 256 MB
+// - reallocs counts the calls that changed the size of the allocation, per body
+// build: cc -O2 xbuffer_bench.c memory.c -lpthread
+
+#include <getopt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "memory.h"
+
+#define BENCH_CHUNK_SIZE_DEFAULT (16 * 1024)
+#define BENCH_BYTES_MIN (256 * 1024 * 1024)
+
+typedef struct {
+	char *data;
+	size_t size;
+	size_t reallocs;
+} bench_naive_t;
+
+static const size_t bench_suite[] = {1024, 10 * 1024, 100 * 1024, 1024 * 1024, 10 * 1024 * 1024, 100 * 1024 * 1024};
+
+static uint64_t bench_clock(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (uint64_t) now.tv_sec * 1000000000ULL + (uint64_t) now.tv_nsec;
+}
+
+// the usual hand written callback, the body grows by exactly one chunk at a time
+static size_t bench_naive_write_cb(char *ptr, size_t size, size_t nmemb, void *userdata)
+{
+	bench_naive_t *naive = (bench_naive_t *) userdata;
+
+	naive->data = xrealloc(naive->data, naive->size + size * nmemb + 1);
+	naive->reallocs++;
+	memcpy(naive->data + naive->size, ptr, size * nmemb);
+	naive->size += size * nmemb;
+	naive->data[naive->size] = '\0';
+
+	return size * nmemb;
+}
+
+static void bench_run(size_t body_size, size_t chunk_size)
+{
+	size_t repeat = body_size < BENCH_BYTES_MIN ? BENCH_BYTES_MIN / body_size : 1;
+	char *chunk = xmalloc(chunk_size);
+	size_t naive_reallocs = 0, xbuffer_reallocs = 0;
+	uint64_t naive_elapsed = 0, xbuffer_elapsed = 0;
+
+	memset(chunk, 'x', chunk_size);
+
+	uint64_t start = bench_clock();
+	for (size_t r = 0; r < repeat; r++) {
+		bench_naive_t naive = {0};
+
+		for (size_t received = 0; received < body_size; received += chunk_size) {
+			bench_naive_write_cb(chunk, 1, body_size - received < chunk_size ? body_size - received : chunk_size, &naive);
+		}
+
+		if (naive.size != body_size) {
+			fprintf(stderr, "naive body is %zu bytes, expected %zu\n", naive.size, body_size);
+			exit(EXIT_FAILURE);
+		}
+		naive_reallocs = naive.reallocs;
+		xfree(naive.data);
+	}
+	naive_elapsed = bench_clock() - start;
+
+	start = bench_clock();
+	for (size_t r = 0; r < repeat; r++) {
+		xbuffer_t buffer;
+		size_t capacity = 0;
+
+		xbuffer_init(&buffer);
+		xbuffer_reallocs = 0;
+		for (size_t received = 0; received < body_size; received += chunk_size) {
+			xbuffer_write_cb(chunk, 1, body_size - received < chunk_size ? body_size - received : chunk_size, &buffer);
+			if (buffer.capacity != capacity) {
+				capacity = buffer.capacity;
+				xbuffer_reallocs++;
+			}
+		}
+
+		// the parser gets a slice, nothing is copied again
+		xbuffer_slice_t slice = xbuffer_slice(&buffer, 0, SIZE_MAX);
+		if (slice.size != body_size) {
+			fprintf(stderr, "xbuffer body is %zu bytes, expected %zu\n", slice.size, body_size);
+			exit(EXIT_FAILURE);
+		}
+		xbuffer_free(&buffer);
+	}
+	xbuffer_elapsed = bench_clock() - start;
+
+	double bytes = (double) body_size * (double) repeat;
+	printf("%11zu %9zu %11.2f %11.2f %9zu %9zu %8.1fx\n", body_size, repeat, bytes / (double) naive_elapsed, bytes / (double) xbuffer_elapsed,
+		   naive_reallocs, xbuffer_reallocs, (double) naive_elapsed / (double) xbuffer_elapsed);
+
+	xfree(chunk);
+}
+
+int main(int argc, char **argv)
+{
+	size_t body_size = 0;
+	size_t chunk_size = BENCH_CHUNK_SIZE_DEFAULT;
+	int option = 0;
+
+	while ((option = getopt(argc, argv, "b:c:")) != -1) {
+		switch (option) {
+			case 'b':
+				body_size = strtoul(optarg, NULL, 10);
+				break;
+			case 'c':
+				chunk_size = strtoul(optarg, NULL, 10);
+				break;
+			default:
+				fprintf(stderr, "usage: %s [-b body_size] [-c chunk_size]\n", argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+
+	if (chunk_size == 0) {
+		fprintf(stderr, "chunk size must not be 0\n");
+		return EXIT_FAILURE;
+	}
+
+	printf("throughput in GB/s\n");
+	printf("%11s %9s %11s %11s %9s %9s %9s\n", "body", "bodies", "xrealloc", "xbuffer", "reallocs", "reallocs", "speedup");
+
+	if (body_size) {
+		bench_run(body_size, chunk_size);
+	} else {
+		for (size_t i = 0; i < sizeof(bench_suite) / sizeof(bench_suite[0]); i++) {
+			bench_run(bench_suite[i], chunk_size);
+		}
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,226 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Copyright (c) 2019 Sartura Ltd.
+ *
+ * Author: Juraj Vijtiuk <juraj.vijtiuk@sartura.hr>
+ *
+ * https://www.sartura.hr/
+ */
+
+// multithreaded benchmark for xpool (memory.h) against glibc malloc
+// usage: xpool_bench [-t threads] [-o operations] [-s size]
+// - 1, 2, 4, 8 and 16 threads (or -t threads) share one pool, every thread does -o get/put pairs
+// - 24 and 160 byte objects (or -s size), the sizes of list_node_t and uv_poll_t on 64-bit linux
+// - batch: every thread gets 64 objects and puts them back, the pattern of a request that builds a list and tears it down
+// - churn: every thread keeps 1024 live objects and replaces a random one per operation, objects outlive the thread caches
+// - malloc is compared with xpool_get(), calloc with a pool created with XPOOL_OPT_ZERO
+// build: cc -O2 xpool_bench.c memory.c -lpthread
+
+#include <getopt.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "memory.h"
+
+#define BENCH_OPERATIONS_DEFAULT 4000000
+#define BENCH_BATCH 64
+#define BENCH_LIVE 1024
+
+typedef enum {
+	BENCH_ALLOCATOR_MALLOC = 0,
+	BENCH_ALLOCATOR_CALLOC,
+	BENCH_ALLOCATOR_XPOOL,
+	BENCH_ALLOCATOR_XPOOL_ZERO,
+	BENCH_ALLOCATOR_COUNT,
+} bench_allocator;
+
+typedef enum {
+	BENCH_PATTERN_BATCH = 0,
+	BENCH_PATTERN_CHURN,
+} bench_pattern;
+
+typedef struct {
+	bench_allocator allocator;
+	bench_pattern pattern;
+	xpool_t *pool;
+	size_t size;
+	size_t operations;
+	pthread_barrier_t *barrier;
+	unsigned int seed;
+} bench_thread_t;
+
+static const size_t bench_threads_suite[] = {1, 2, 4, 8, 16};
+static const size_t bench_size_suite[] = {24, 160};
+
+static uint64_t bench_clock(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (uint64_t) now.tv_sec * 1000000000ULL + (uint64_t) now.tv_nsec;
+}
+
+static inline void *bench_get(bench_thread_t *thread)
+{
+	void *object = NULL;
+
+	switch (thread->allocator) {
+		case BENCH_ALLOCATOR_MALLOC:
+			object = malloc(thread->size);
+			break;
+		case BENCH_ALLOCATOR_CALLOC:
+			object = calloc(1, thread->size);
+			break;
+		default:
+			object = xpool_get(thread->pool);
+			break;
+	}
+
+	// touch the object like a user would, so lazily handed out memory is paid for here
+	*(volatile char *) object = 1;
+
+	return object;
+}
+
+static inline void bench_put(bench_thread_t *thread, void *object)
+{
+	if (thread->allocator == BENCH_ALLOCATOR_MALLOC || thread->allocator == BENCH_ALLOCATOR_CALLOC) {
+		free(object);
+	} else {
+		xpool_put(thread->pool, object);
+	}
+}
+
+static void *bench_thread(void *arg)
+{
+	bench_thread_t *thread = (bench_thread_t *) arg;
+	void *objects[BENCH_LIVE] = {0};
+
+	pthread_barrier_wait(thread->barrier);
+
+	if (thread->pattern == BENCH_PATTERN_BATCH) {
+		for (size_t done = 0; done < thread->operations; done += BENCH_BATCH) {
+			for (size_t i = 0; i < BENCH_BATCH; i++) {
+				objects[i] = bench_get(thread);
+			}
+			for (size_t i = 0; i < BENCH_BATCH; i++) {
+				bench_put(thread, objects[i]);
+			}
+		}
+	} else {
+		for (size_t i = 0; i < BENCH_LIVE; i++) {
+			objects[i] = bench_get(thread);
+		}
+		for (size_t done = 0; done < thread->operations; done++) {
+			size_t i = (size_t) rand_r(&thread->seed) % BENCH_LIVE;
+
+			bench_put(thread, objects[i]);
+			objects[i] = bench_get(thread);
+		}
+		for (size_t i = 0; i < BENCH_LIVE; i++) {
+			bench_put(thread, objects[i]);
+		}
+	}
+
+	return NULL;
+}
+
+// returns ns per get/put pair, wall clock over all threads
+static double bench_run(bench_allocator allocator, bench_pattern pattern, size_t threads_count, size_t size, size_t operations)
+{
+	pthread_t *threads = calloc(threads_count, sizeof(pthread_t));
+	bench_thread_t *args = calloc(threads_count, sizeof(bench_thread_t));
+	pthread_barrier_t barrier;
+	xpool_t *pool = NULL;
+
+	if (allocator == BENCH_ALLOCATOR_XPOOL || allocator == BENCH_ALLOCATOR_XPOOL_ZERO) {
+		pool = xpool_new(size, 0, allocator == BENCH_ALLOCATOR_XPOOL_ZERO ? XPOOL_OPT_ZERO : 0);
+	}
+
+	pthread_barrier_init(&barrier, NULL, (unsigned int) threads_count + 1);
+	for (size_t i = 0; i < threads_count; i++) {
+		args[i] = (bench_thread_t){allocator, pattern, pool, size, operations, &barrier, (unsigned int) i + 1};
+		pthread_create(&threads[i], NULL, bench_thread, &args[i]);
+	}
+
+	pthread_barrier_wait(&barrier);
+	uint64_t start = bench_clock();
+	for (size_t i = 0; i < threads_count; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	uint64_t elapsed = bench_clock() - start;
+
+	pthread_barrier_destroy(&barrier);
+	if (pool) {
+		xpool_destroy(pool);
+	}
+	free(args);
+	free(threads);
+
+	return (double) elapsed / (double) (operations * threads_count);
+}
+
+static void bench_print(bench_pattern pattern, size_t threads_count, size_t size, size_t operations)
+{
+	double result[BENCH_ALLOCATOR_COUNT] = {0};
+
+	for (int allocator = 0; allocator < BENCH_ALLOCATOR_COUNT; allocator++) {
+		result[allocator] = bench_run((bench_allocator) allocator, pattern, threads_count, size, operations);
+	}
+
+	printf("%7s %7zu %5zu %9.2f %9.2f %9.2f %9.2f %8.1fx %8.1fx\n", pattern == BENCH_PATTERN_BATCH ? "batch" : "churn", threads_count, size,
+		   result[BENCH_ALLOCATOR_MALLOC], result[BENCH_ALLOCATOR_XPOOL], result[BENCH_ALLOCATOR_CALLOC], result[BENCH_ALLOCATOR_XPOOL_ZERO],
+		   result[BENCH_ALLOCATOR_MALLOC] / result[BENCH_ALLOCATOR_XPOOL], result[BENCH_ALLOCATOR_CALLOC] / result[BENCH_ALLOCATOR_XPOOL_ZERO]);
+}
+
+int main(int argc, char **argv)
+{
+	size_t threads_count = 0;
+	size_t operations = BENCH_OPERATIONS_DEFAULT;
+	size_t size = 0;
+	int option = 0;
+
+	while ((option = getopt(argc, argv, "t:o:s:")) != -1) {
+		switch (option) {
+			case 't':
+				threads_count = strtoul(optarg, NULL, 10);
+				break;
+			case 'o':
+				operations = strtoul(optarg, NULL, 10);
+				break;
+			case 's':
+				size = strtoul(optarg, NULL, 10);
+				break;
+			default:
+				fprintf(stderr, "usage: %s [-t threads] [-o operations] [-s size]\n", argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+
+	printf("ns per get/put pair, wall clock\n");
+	printf("%7s %7s %5s %9s %9s %9s %9s %9s %9s\n", "pattern", "threads", "size", "malloc", "xpool", "calloc", "xpool 0", "vs malloc",
+		   "vs calloc");
+
+	for (int pattern = BENCH_PATTERN_BATCH; pattern <= BENCH_PATTERN_CHURN; pattern++) {
+		for (size_t t = 0; t < sizeof(bench_threads_suite) / sizeof(bench_threads_suite[0]); t++) {
+			for (size_t s = 0; s < sizeof(bench_size_suite) / sizeof(bench_size_suite[0]); s++) {
+				bench_print((bench_pattern) pattern, threads_count ? threads_count : bench_threads_suite[t], size ? size : bench_size_suite[s],
+							operations);
+				if (size) {
+					break;
+				}
+			}
+			if (threads_count) {
+				break;
+			}
+		}
+	}
+
+	return EXIT_SUCCESS;
+}